@@ -0,0 +1,27 @@
+/* bench_common.c - Clock and test text shared by the benchmarks */
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench_common.h"
+#include <stdio.h>
+#include <time.h>
+
+double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int bench_line(char *line, int size, unsigned int *seed) {
+    static const char *words[] = {
+        "int", "return", "buffer", "gap_insert", "for", "while", "struct",
+        "editor", "history", "(void)", "{", "}", "=", "0;", "pos", "len"
+    };
+    int n = 0;
+    int words_in_line = 3 + *seed % 8;
+    for (int w = 0; w < words_in_line; w++) {
+        *seed = *seed * 1103515245u + 12345u;
+        n += snprintf(line + n, size - n, "%s ", words[(*seed >> 16) % 16]);
+    }
+    line[n - 1] = '\n';
+    return n;
+}
@@ -0,0 +1,13 @@
+/* bench_common.h - Clock and test text shared by the benchmarks */
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+/* Monotonic time in seconds */
+double bench_now(void);
+
+/* One source-like line of 3 to 10 words and a newline, the same mix in
+ * every benchmark for the same seed. Advances *seed; returns the length,
+ * which is under 128 bytes. */
+int bench_line(char *line, int size, unsigned int *seed);
+
+#endif /* BENCH_COMMON_H */
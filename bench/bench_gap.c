@@ -0,0 +1,82 @@
+/* bench_gap.c - Gap growth and shrink policies on a load-then-delete run */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "buffer.h"
+#include "bench_common.h"
+
+/* Resident set size right now, in MB */
+static double rss_mb(void) {
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(fp);
+    }
+    return resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+/* Stream size bytes into a buffer that starts at the default 1024, as a
+ * paste or pipe would, then delete nine tenths of it and go idle. Runs
+ * in its own process so the peak RSS is this policy's alone. */
+static void run(const char *policy, int max_gap, int size) {
+    gap_set_max(max_gap);
+    struct gapbuf g;
+    gap_init(&g, 1024);
+    char chunk[4096];
+    for (int i = 0; i < (int)sizeof(chunk); i++) chunk[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+
+    double t0 = bench_now();
+    for (int n = 0; n < size; n += sizeof(chunk)) gap_insert_bytes(&g, chunk, sizeof(chunk));
+    double load = bench_now() - t0;
+
+    int len = gap_length(&g);
+    t0 = bench_now();
+    gap_move(&g, len / 20);
+    gap_delete_bytes(&g, len / 10 * 9);
+    double del = bench_now() - t0;
+    int cap_deleted = g.cap;
+
+    t0 = bench_now();
+    gap_trim(&g);
+    double idle = bench_now() - t0;
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%-12s %9.1f ms %9.1f ms %9.1f ms %9.0f MB %9.0f MB %9.0f MB %9.0f MB\n",
+           policy, load * 1e3, del * 1e3, idle * 1e3, ru.ru_maxrss / 1024.0, rss_mb(),
+           cap_deleted / (1024.0 * 1024.0), g.cap / (1024.0 * 1024.0));
+    gap_free(&g);
+}
+
+int main(int argc, char *argv[]) {
+    int mb = argc > 1 ? atoi(argv[1]) : 512;
+    if (mb <= 0 || mb > 1536) mb = 512;
+    static const struct { const char *name; int max_gap; } policies[] = {
+        { "unbounded", 0 },
+        { "max-64M", 64 << 20 },
+        { "max-16M", GAP_MAX_DEFAULT },
+        { "max-1M", 1 << 20 },
+    };
+
+    printf("buffer: %d MB streamed in, 90%% deleted, then one idle trim\n", mb);
+    printf("%-12s %12s %12s %12s %12s %12s %12s %12s\n", "policy", "load", "delete",
+           "idle", "peak RSS", "RSS after", "cap deleted", "cap idle");
+    fflush(stdout);
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(policies[i].name, policies[i].max_gap, mb * 1024 * 1024);
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+/* bench_grep.c - Directory grep throughput and scaling with threads */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "grep.h"
+#include "bench_common.h"
+
+/* Write mb megabytes of source-like files, 64 per directory and 16
+ * directories per level, so the walk itself gets exercised too */
+static void make_tree(const char *root, int mb) {
+    char path[256], line[128];
+    unsigned int seed = 12345;
+    long long total = (long long)mb * 1024 * 1024;
+    int file = 0;
+
+    mkdir(root, 0755);
+    while (total > 0) {
+        int dir = file / 64;
+        snprintf(path, sizeof(path), "%s/d%d", root, dir / 16);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/d%d/d%d", root, dir / 16, dir % 16);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/d%d/d%d/f%d.c", root, dir / 16, dir % 16, file++);
+
+        FILE *fp = fopen(path, "w");
+        if (!fp) {
+            perror(path);
+            exit(1);
+        }
+        int size = 16 * 1024 + seed % (256 * 1024);
+        for (int written = 0; written < size; ) {
+            int n = bench_line(line, sizeof(line), &seed);
+            fwrite(line, 1, n, fp);
+            written += n;
+        }
+        total -= size;
+        fclose(fp);
+    }
+}
+
+static double run(const char *root, const char *label, const char *pat, int regex,
+                  int nthreads, double base) {
+    struct grep gr;
+    char *out;
+    int len;
+
+    double t0 = bench_now();
+    grep_start(&gr, root, pat, strlen(pat), regex, nthreads);
+    struct timespec poll = {0, 1000000};
+    while (grep_take(&gr, &out, &len)) {
+        free(out);
+        nanosleep(&poll, NULL);
+    }
+    double t1 = bench_now();
+
+    int nmatches, nfiles;
+    long long nbytes;
+    grep_stats(&gr, &nmatches, &nfiles, &nbytes);
+    grep_stop(&gr);
+
+    double secs = t1 - t0;
+    printf("%-24s %3d threads %6d files %9d matches %8.1f ms %6.2f GB/s %5.2fx\n",
+           label, nthreads, nfiles, nmatches, secs * 1e3,
+           nbytes / secs / (1024.0 * 1024.0 * 1024.0), base > 0 ? base / secs : 1.0);
+    return secs;
+}
+
+int main(int argc, char *argv[]) {
+    int mb = argc > 1 ? atoi(argv[1]) : 1024;
+    const char *root = argc > 2 ? argv[2] : "/tmp/bench_grep_tree";
+    if (mb <= 0) mb = 1024;
+
+    struct stat st;
+    if (stat(root, &st) == -1) {
+        printf("writing %d MB tree under %s\n", mb, root);
+        make_tree(root, mb);
+    } else {
+        printf("using existing tree under %s\n", root);
+    }
+
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) ncpu = 1;
+
+    /* one warm-up pass so every row reads from the page cache */
+    run(root, "warm-up", "@", 0, ncpu, 0);
+
+    double base = 0;
+    for (int n = 1; ; n *= 2) {
+        if (n > ncpu) n = ncpu;
+        double secs = run(root, "absent literal", "Zebra crossing", 0, n, base);
+        if (n == 1) base = secs;
+        if (n == ncpu) break;
+    }
+    base = 0;
+    for (int n = 1; ; n *= 2) {
+        if (n > ncpu) n = ncpu;
+        double secs = run(root, "regex 'gap_\\w+ pos'", "gap_\\w+ pos", 1, n, base);
+        if (n == 1) base = secs;
+        if (n == ncpu) break;
+    }
+    return 0;
+}
@@ -0,0 +1,253 @@
+/* bench_micro.c - Buffer, history and selection primitives in isolation */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "history.h"
+#include "selection.h"
+#include "bench_common.h"
+
+/* Results go to stdout as JSON, one result object per line so a saved
+ * run can be read back as the baseline of the next one. */
+
+/* -------- baseline -------- */
+#define MAX_RESULTS 64
+
+static struct {
+    char name[48];
+    double ns_per_op;
+} baseline[MAX_RESULTS];
+static int nbaseline = 0;
+static int baseline_mb = 0;
+
+static void load_baseline(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "bench_micro: no baseline at %s\n", path);
+        return;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), fp) && nbaseline < MAX_RESULTS) {
+        char *mb = strstr(line, "\"buffer_mb\": ");
+        if (mb) sscanf(mb + 13, "%d", &baseline_mb);
+        char *name = strstr(line, "\"name\": \"");
+        char *ns = strstr(line, "\"ns_per_op\": ");
+        if (!name || !ns) continue;
+        if (sscanf(name + 9, "%47[^\"]", baseline[nbaseline].name) == 1 &&
+            sscanf(ns + 13, "%lf", &baseline[nbaseline].ns_per_op) == 1) {
+            nbaseline++;
+        }
+    }
+    fclose(fp);
+}
+
+static double baseline_of(const char *name) {
+    for (int i = 0; i < nbaseline; i++) {
+        if (strcmp(baseline[i].name, name) == 0) return baseline[i].ns_per_op;
+    }
+    return 0;
+}
+
+/* -------- results -------- */
+static int nresults = 0;
+
+/* ops operations over bytes bytes took secs */
+static void result(const char *name, long long ops, long long bytes, double secs) {
+    double ns = secs * 1e9 / ops;
+    printf("%s    {\"name\": \"%s\", \"ops\": %lld, \"ns_per_op\": %.3f", nresults ? ",\n" : "",
+           name, ops, ns);
+    if (bytes > 0) printf(", \"mb_per_s\": %.1f", bytes / secs / (1024.0 * 1024.0));
+    double base = baseline_of(name);
+    if (base > 0) printf(", \"baseline_ns_per_op\": %.3f, \"ratio\": %.3f", base, ns / base);
+    printf("}");
+    fflush(stdout);
+    nresults++;
+}
+
+/* Source-like lines of about 40 bytes, the gap left at the end */
+static void fill(struct gapbuf *g, int size) {
+    char line[128];
+    unsigned int seed = 12345;
+
+    while (gap_length(g) < size) {
+        int n = bench_line(line, sizeof(line), &seed);
+        gap_insert_bytes(g, line, n);
+    }
+}
+
+/* -------- gap buffer -------- */
+static void bench_gap_move(struct gapbuf *g) {
+    int len = gap_length(g);
+    int ops = 64;
+    double t0 = bench_now();
+    for (int i = 0; i < ops; i++) gap_move(g, i % 2 ? len / 10 : len - len / 10);
+    result("gap_move_far", ops, (long long)ops * (len - len / 5), bench_now() - t0);
+
+    ops = 1000000;
+    unsigned int seed = 1;
+    int pos = len / 2;
+    t0 = bench_now();
+    for (int i = 0; i < ops; i++) {
+        seed = seed * 1103515245u + 12345u;
+        pos += (int)(seed >> 16) % 129 - 64;
+        if (pos < 0 || pos > len) pos = len / 2;
+        gap_move(g, pos);
+    }
+    result("gap_move_near", ops, 0, bench_now() - t0);
+}
+
+static void bench_gap_insert(int size) {
+    struct gapbuf g;
+    gap_init(&g, 1024);
+    double t0 = bench_now();
+    for (int i = 0; i < size; i++) gap_insert(&g, 'a' + i % 26);
+    result("gap_insert_growth", size, size, bench_now() - t0);
+    gap_free(&g);
+
+    char chunk[4096];
+    memset(chunk, 'b', sizeof(chunk));
+    gap_init(&g, 1024);
+    t0 = bench_now();
+    for (int n = 0; n < size; n += sizeof(chunk)) gap_insert_bytes(&g, chunk, sizeof(chunk));
+    result("gap_insert_bytes_4k", size / sizeof(chunk), size, bench_now() - t0);
+    gap_free(&g);
+}
+
+static void bench_gap_scan(struct gapbuf *g) {
+    int len = gap_length(g);
+    gap_move(g, len / 2);
+    unsigned int sum = 0;
+    double t0 = bench_now();
+    for (int i = 0; i < len; i++) sum += (unsigned char)gap_char_at(g, i);
+    result("gap_char_at_scan", len, len, bench_now() - t0);
+
+    t0 = bench_now();
+    int lines = gap_count_char(g, '\n', 0, len);
+    result("gap_count_char_scan", len, len, bench_now() - t0);
+    if (sum == 0 || lines == 0) fprintf(stderr, "bench_micro: empty buffer\n");
+}
+
+/* -------- positions -------- */
+static void bench_positions(struct gapbuf *g) {
+    static const struct { const char *suffix; int percent; } depths[] = {
+        { "1pct", 1 }, { "50pct", 50 }, { "100pct", 100 }
+    };
+    int len = gap_length(g);
+    int lines = gap_count_char(g, '\n', 0, len);
+    gap_move(g, len / 2);
+
+    for (int d = 0; d < 3; d++) {
+        char name[48];
+        int row = (long long)lines * depths[d].percent / 100;
+        int pos = (long long)len * depths[d].percent / 100;
+        int ops = depths[d].percent == 1 ? 1000 : 20;
+        int r, c, sink = 0;
+
+        double t0 = bench_now();
+        for (int i = 0; i < ops; i++) sink += rowcol_to_pos(g, row, i % 8);
+        snprintf(name, sizeof(name), "rowcol_to_pos_%s", depths[d].suffix);
+        result(name, ops, (long long)ops * pos, bench_now() - t0);
+
+        t0 = bench_now();
+        for (int i = 0; i < ops; i++) {
+            pos_to_rowcol(g, pos - i % 8, &r, &c);
+            sink += r;
+        }
+        snprintf(name, sizeof(name), "pos_to_rowcol_%s", depths[d].suffix);
+        result(name, ops, (long long)ops * pos, bench_now() - t0);
+        if (sink == -1) fprintf(stderr, "bench_micro: sink\n");
+    }
+}
+
+/* -------- history -------- */
+static void bench_history(int ops) {
+    struct gapbuf g;
+    struct editHistory h;
+    gap_init(&g, 1024);
+    history_init(&h);
+
+    double t0 = bench_now();
+    for (int i = 0; i < ops; i++) {
+        char ch = 'a' + i % 26;
+        gap_insert(&g, ch);
+        history_push(&h, EDIT_INSERT, i, ch);
+    }
+    result("history_push_storm", ops, 0, bench_now() - t0);
+
+    t0 = bench_now();
+    for (int i = 0; i < ops; i++) history_undo(&h, &g);
+    result("history_undo_storm", ops, 0, bench_now() - t0);
+
+    t0 = bench_now();
+    for (int i = 0; i < ops; i++) history_redo(&h, &g);
+    result("history_redo_storm", ops, 0, bench_now() - t0);
+
+    history_free(&h);
+    gap_free(&g);
+}
+
+/* -------- clipboard -------- */
+static void bench_clipboard(struct gapbuf *g) {
+    int len = gap_length(g);
+    int lines = gap_count_char(g, '\n', 0, len);
+    struct selection sel;
+    struct clipboard clip = { NULL, 0, NULL, { 0, 0, NULL, NULL, NULL, NULL }, 0 };
+    struct editHistory h;
+    history_init(&h);
+    struct colMap cm;
+    colmap_init(&cm, g);
+
+    /* the middle half of the text */
+    selection_start(&sel, lines / 4, 0);
+    selection_update(&sel, lines / 4 * 3, 0);
+    gap_move(g, len / 2);
+    double t0 = bench_now();
+    clipboard_copy(&clip, &sel, &cm);
+    result("clipboard_copy_large", 1, clip.len, bench_now() - t0);
+
+    t0 = bench_now();
+    clipboard_paste(&clip, g, len / 3, &h);
+    result("clipboard_paste_large", 1, clip.len, bench_now() - t0);
+
+    clipboard_free(&clip);
+    colmap_free(&cm);
+    history_free(&h);
+}
+
+int main(int argc, char *argv[]) {
+    int mb = 64;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            load_baseline(argv[++i]);
+        } else {
+            mb = atoi(argv[i]);
+        }
+    }
+    if (mb <= 0 || mb > 1024) mb = 64;
+    int size = mb * 1024 * 1024;
+    if (nbaseline > 0 && baseline_mb != mb) {
+        /* scans and jumps grow with the buffer, so only like compares to like */
+        fprintf(stderr, "bench_micro: baseline is for %d MB, not comparing\n", baseline_mb);
+        nbaseline = 0;
+    }
+
+    printf("{\n  \"suite\": \"micro\",\n  \"buffer_mb\": %d,\n  \"results\": [\n", mb);
+
+    struct gapbuf g;
+    gap_init(&g, 1024);
+    fill(&g, size);
+
+    bench_gap_move(&g);
+    bench_gap_insert(size);
+    bench_gap_scan(&g);
+    bench_positions(&g);
+    bench_history(1000000);
+    bench_clipboard(&g);
+
+    printf("\n  ]\n}\n");
+    gap_free(&g);
+    return 0;
+}
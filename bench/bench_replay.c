@@ -0,0 +1,154 @@
+/* bench_replay.c - Keystroke scenarios replayed through editor --replay */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+
+#define DIR "/tmp"
+
+/* Source-like lines, the same mix bench_search scans */
+static void write_file(const char *path, long long size) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        perror(path);
+        exit(1);
+    }
+    char line[128];
+    unsigned int seed = 12345;
+    long long written = 0;
+
+    while (written < size) {
+        int n = bench_line(line, sizeof(line), &seed);
+        fwrite(line, 1, n, fp);
+        written += n;
+    }
+    fclose(fp);
+}
+
+/* -------- scenarios -------- */
+struct script {
+    char *data;
+    int len, cap;
+};
+
+static void put(struct script *s, const char *bytes, int len) {
+    if (s->len + len > s->cap) {
+        s->cap = (s->len + len) * 2;
+        s->data = realloc(s->data, s->cap);
+    }
+    memcpy(s->data + s->len, bytes, len);
+    s->len += len;
+}
+
+static void put_repeat(struct script *s, const char *bytes, int times) {
+    for (int i = 0; i < times; i++) put(s, bytes, strlen(bytes));
+}
+
+/* Type text with a newline every 60 characters */
+static void put_typing(struct script *s, int keys) {
+    for (int i = 0; i < keys; i++) {
+        char c = i % 60 == 59 ? '\r' : 'a' + i % 26;
+        put(s, &c, 1);
+    }
+}
+
+static void scrolling(struct script *s, int n) {
+    put_repeat(s, "\x1b[6~", n);       /* page down */
+    put_repeat(s, "\x1b[B", n);        /* arrow down */
+    put_repeat(s, "\x1b[5~", n);       /* page up */
+}
+
+/* n pastes of 64 KB */
+static void paste(struct script *s, int n) {
+    char line[64];
+    for (int i = 0; i < n; i++) {
+        put(s, "\x1b[200~", 6);
+        for (int len = 0; len < 64 * 1024; len += sizeof(line)) {
+            memset(line, 'p', sizeof(line) - 1);
+            line[sizeof(line) - 1] = '\r';
+            put(s, line, sizeof(line));
+        }
+        put(s, "\x1b[201~", 6);
+    }
+}
+
+static void undo_storm(struct script *s, int n) {
+    put_typing(s, n);
+    put_repeat(s, "\x1a", n);          /* undo */
+    put_repeat(s, "\x19", n);          /* redo */
+}
+
+/* A key costs about the same whatever the file's size, so every size
+ * replays the same n repeats and their timings compare directly */
+static const struct {
+    const char *name;
+    void (*build)(struct script *s, int n);
+    int n;
+} scenarios[] = {
+    { "typing", put_typing, 2000 },
+    { "scrolling", scrolling, 500 },
+    { "paste", paste, 16 },
+    { "undo-storm", undo_storm, 1000 },
+};
+
+#define NSCENARIOS (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+/* -------- runs -------- */
+static void run(const char *editor, const char *keys, const char *file) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(editor, editor, "--replay", keys, file, (char *)NULL);
+        perror(editor);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) printf("failed\n");
+}
+
+/* Write the script of scenario i to path */
+static void write_script(int i, const char *path) {
+    struct script s = { NULL, 0, 0 };
+    scenarios[i].build(&s, scenarios[i].n);
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        perror(path);
+        exit(1);
+    }
+    fwrite(s.data, 1, s.len, fp);
+    fclose(fp);
+    free(s.data);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: bench_replay editor [MB ...]\n");
+        return 1;
+    }
+    const char *editor = argv[1];
+    const char *keys = DIR "/bench_replay.keys";
+
+    int nsizes = argc > 2 ? argc - 2 : 1;
+    for (int j = 0; j < nsizes; j++) {
+        int mb = argc > 2 ? atoi(argv[j + 2]) : 1;
+        if (mb <= 0 || mb > 2000) mb = 1;
+        char file[64];
+        snprintf(file, sizeof(file), DIR "/bench_replay_%dmb.txt", mb);
+        write_file(file, (long long)mb * 1024 * 1024);
+
+        for (int i = 0; i < NSCENARIOS; i++) {
+            write_script(i, keys);
+            printf("%-10s %5d MB ", scenarios[i].name, mb);
+            run(editor, keys, file);
+        }
+        unlink(file);
+    }
+    unlink(keys);
+    return 0;
+}
@@ -0,0 +1,114 @@
+/* bench_search.c - Search throughput over a large gap buffer */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "search.h"
+#include "regex.h"
+#include "bench_common.h"
+
+/* Fill the buffer with source-like lines and leave the gap in the middle,
+ * so every full scan has to cross it. */
+static void fill(struct gapbuf *g, int size) {
+    char line[128];
+    unsigned int seed = 12345;
+
+    while (gap_length(g) < size) {
+        int n = bench_line(line, sizeof(line), &seed);
+        gap_insert_bytes(g, line, n);
+    }
+    gap_move(g, gap_length(g) / 2);
+}
+
+static void run(struct gapbuf *g, const char *label, const char *pat, int count_all) {
+    struct searchPattern sp;
+    search_compile(&sp, pat, strlen(pat));
+
+    double t0 = bench_now();
+    int matches = 0;
+    int pos = search_forward(g, &sp, 0);
+    if (count_all) {
+        while (pos != -1) {
+            matches++;
+            pos = search_forward(g, &sp, pos + 1);
+        }
+    } else {
+        matches = pos != -1;
+    }
+    double t1 = bench_now();
+
+    double mb = gap_length(g) / (1024.0 * 1024.0);
+    printf("%-28s %10d matches %8.1f ms %8.0f MB/s\n",
+           label, matches, (t1 - t0) * 1e3, mb / (t1 - t0));
+}
+
+static void run_regex(struct gapbuf *g, const char *label, const char *pat, int count_all) {
+    struct regex *re = regex_compile(pat, strlen(pat), NULL);
+
+    double t0 = bench_now();
+    int matches = 0, len;
+    int pos = regex_search_forward(re, g, 0, &len);
+    if (count_all) {
+        while (pos != -1) {
+            matches++;
+            pos = regex_search_forward(re, g, pos + (len > 0 ? len : 1), &len);
+        }
+    } else {
+        matches = pos != -1;
+    }
+    double t1 = bench_now();
+    regex_free(re);
+
+    double mb = gap_length(g) / (1024.0 * 1024.0);
+    printf("%-28s %10d matches %8.1f ms %8.0f MB/s\n",
+           label, matches, (t1 - t0) * 1e3, mb / (t1 - t0));
+}
+
+int main(int argc, char *argv[]) {
+    int mb = argc > 1 ? atoi(argv[1]) : 1024;
+    if (mb <= 0 || mb > 2000) mb = 1024;
+
+    struct gapbuf g;
+    gap_init(&g, 1024);
+    fill(&g, mb * 1024 * 1024);
+    printf("buffer: %d MB, gap at %d\n", mb, g.gap_start);
+
+    run(&g, "absent, 1 byte", "@", 0);
+    run(&g, "absent, rare first byte", "Zebra crossing", 0);
+    run(&g, "absent, common first byte", "ed-not-there", 0);
+    run(&g, "absent, long", "struct editor history while return buffer X", 0);
+    run(&g, "all matches, 'gap_insert'", "gap_insert", 1);
+
+    struct searchPattern sp;
+    search_compile(&sp, "@", 1);
+    double t0 = bench_now();
+    search_backward(&g, &sp, gap_length(&g));
+    double t1 = bench_now();
+    printf("%-28s %19s %8.1f ms %8.0f MB/s\n", "absent, backward", "",
+           (t1 - t0) * 1e3, mb / (t1 - t0));
+
+    run_regex(&g, "regex absent, prefix", "Zebra[0-9]+", 0);
+    run_regex(&g, "regex absent, no prefix", "[0-9]+x", 0);
+    run_regex(&g, "regex all, 'gap_\\w+'", "gap_\\w+", 1);
+    run_regex(&g, "regex all, '(for|while) \\('", "(for|while) \\(", 1);
+
+    gap_free(&g);
+
+    /* a prefix occurrence at every byte and no match: one pass, not one
+     * per occurrence */
+    gap_init(&g, 1024);
+    int line = 1024 * 1024;
+    char *as = malloc(line);
+    memset(as, 'a', line);
+    gap_insert_bytes(&g, as, line);
+    free(as);
+    printf("one line of %d 'a's\n", line);
+    run_regex(&g, "regex absent, 'a.*b'", "a.*b", 0);
+    run_regex(&g, "regex absent, 'a[ab]*c'", "a[ab]*c", 0);
+
+    gap_free(&g);
+    return 0;
+}
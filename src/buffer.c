@@ -1,18 +1,177 @@
 #include "buffer.h"
+#include "memstat.h"
 #include <stdlib.h>
 #include <string.h>
 
+static int gap_max = GAP_MAX_DEFAULT;
 
-struct gapbuf g;
+void gap_set_max(int bytes) { gap_max = bytes; }
 
 void gap_init(struct gapbuf *g, int initial_cap) {
     g->cap = initial_cap > 0 ? initial_cap : 1024;
-    g->buf = malloc(g->cap);
+    g->buf = mem_alloc(MEM_BUFFER, g->cap);
     g->gap_start = 0;
     g->gap_end = g->cap;
+    g->obs = NULL;
+    g->pins = NULL;
+    g->batch = 0;
+    g->lines.nl = NULL;
+    g->lines.cap = g->lines.before = g->lines.after = 0;
 }
 
-void gap_free(struct gapbuf *g) { free(g->buf); }
+static void gap_begin(struct gapbuf *g) {
+    if (g->obs && !g->batch) g->obs->lock(g->obs->arg);
+}
+
+static void gap_end(struct gapbuf *g, int pos, int removed, int inserted) {
+    if (!g->obs || g->batch) return;
+    if (removed || inserted) g->obs->changed(g->obs->arg, pos, removed, inserted);
+    g->obs->unlock(g->obs->arg);
+}
+
+/* -------- line index -------- */
+static void lines_reserve(struct lineIndex *li, int extra) {
+    if (li->before + li->after + extra <= li->cap) return;
+    int cap = li->cap ? li->cap * 2 : 64;
+    if (cap < li->before + li->after + extra) cap = li->before + li->after + extra;
+    li->nl = mem_realloc(MEM_BUFFER, li->nl, li->cap * sizeof(int), cap * sizeof(int));
+    memmove(li->nl + cap - li->after, li->nl + li->cap - li->after, li->after * sizeof(int));
+    li->cap = cap;
+}
+
+/* n bytes were just put in before the gap at from */
+static void lines_inserted(struct gapbuf *g, int from, int n) {
+    struct lineIndex *li = &g->lines;
+    const char *p = g->buf + from, *end = p + n;
+    while ((p = memchr(p, '\n', end - p))) {
+        lines_reserve(li, 1);
+        li->nl[li->before++] = p - g->buf;
+        p++;
+    }
+}
+
+/* The n bytes after the gap, in text of length len, are going away */
+static void lines_deleted(struct gapbuf *g, int len, int n) {
+    struct lineIndex *li = &g->lines;
+    while (li->after > 0 && len - li->nl[li->cap - li->after] < g->gap_start + n) li->after--;
+}
+
+/* The gap is moving to pos; newlines it passes change sides */
+static void lines_moved(struct gapbuf *g, int pos) {
+    struct lineIndex *li = &g->lines;
+    int len = gap_length(g);
+    while (li->before > 0 && li->nl[li->before - 1] >= pos) {
+        li->after++;
+        li->nl[li->cap - li->after] = len - li->nl[--li->before];
+    }
+    while (li->after > 0 && len - li->nl[li->cap - li->after] < pos) {
+        li->nl[li->before++] = len - li->nl[li->cap - li->after];
+        li->after--;
+    }
+}
+
+/* Offset of newline k, counting from 0 */
+static int lines_at(struct gapbuf *g, int k) {
+    struct lineIndex *li = &g->lines;
+    if (k < li->before) return li->nl[k];
+    return gap_length(g) - li->nl[li->cap - li->after + k - li->before];
+}
+
+int gap_line_count(struct gapbuf *g) {
+    return g->lines.before + g->lines.after + 1;
+}
+
+int gap_line_start(struct gapbuf *g, int row) {
+    int last = g->lines.before + g->lines.after;
+    if (row > last) row = last;
+    return row <= 0 ? 0 : lines_at(g, row - 1) + 1;
+}
+
+int gap_line_end(struct gapbuf *g, int row) {
+    if (row < 0) row = 0;
+    return row < g->lines.before + g->lines.after ? lines_at(g, row) : gap_length(g);
+}
+
+int gap_line_of(struct gapbuf *g, int pos) {
+    /* the newlines before pos, found by bisecting on their offsets */
+    int lo = 0, hi = g->lines.before + g->lines.after;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (lines_at(g, mid) < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void gap_reindex(struct gapbuf *g) {
+    struct lineIndex *li = &g->lines;
+    li->before = li->after = 0;
+    lines_inserted(g, 0, g->gap_start);
+    int suffix = g->cap - g->gap_end;
+    lines_reserve(li, gap_count_char(g, '\n', g->gap_start, gap_length(g)));
+    /* filled from the end backwards, so nearest the gap ends up first */
+    const char *text = g->buf + g->gap_end;
+    for (int i = suffix - 1; i >= 0; i--) {
+        if (text[i] == '\n') {
+            li->after++;
+            li->nl[li->cap - li->after] = suffix - i;
+        }
+    }
+}
+
+/* -------- pins -------- */
+void gap_pin(struct gapbuf *g, struct gapPin *pin) {
+    pin->next = g->pins;
+    g->pins = pin;
+}
+
+void gap_unpin(struct gapbuf *g, struct gapPin *pin) {
+    for (struct gapPin **p = &g->pins; *p; p = &(*p)->next) {
+        if (*p == pin) {
+            *p = pin->next;
+            return;
+        }
+    }
+}
+
+/* Called before an edit at pos removes and inserts bytes: pins wholly
+ * before pos stay, pins after the edit shift, pins it touches are cut
+ * short or go */
+static void gap_pins_edit(struct gapbuf *g, int pos, int removed, int inserted) {
+    struct gapPin **p = &g->pins;
+    while (*p) {
+        struct gapPin *pin = *p;
+        if (pos >= pin->start + pin->len) {
+            p = &pin->next;
+        } else if (pos + removed <= pin->start) {
+            pin->start += inserted - removed;
+            p = &pin->next;
+        } else if (pin->trim && pos > pin->start) {
+            pin->trim(pin, g, pos - pin->start);
+            p = &pin->next;
+        } else {
+            *p = pin->next;
+            pin->release(pin, g);
+        }
+    }
+}
+
+/* The whole text is about to be replaced or freed */
+static void gap_pins_release(struct gapbuf *g) {
+    while (g->pins) {
+        struct gapPin *pin = g->pins;
+        g->pins = pin->next;
+        pin->release(pin, g);
+    }
+}
+
+void gap_free(struct gapbuf *g) {
+    gap_pins_release(g);
+    mem_free(MEM_BUFFER, g->buf, g->cap);
+    mem_free(MEM_BUFFER, g->lines.nl, g->lines.cap * sizeof(int));
+    g->lines.nl = NULL;
+    g->lines.cap = g->lines.before = g->lines.after = 0;
+}
 
 int gap_length(struct gapbuf *g) { return g->cap - (g->gap_end - g->gap_start); }
 
@@ -20,6 +179,9 @@ void gap_move(struct gapbuf *g, int pos) {
     if (pos < 0) pos = 0;
     int len = gap_length(g);
     if (pos > len) pos = len;
+    if (pos == g->gap_start) return;
+    gap_begin(g);
+    lines_moved(g, pos);
     if (pos < g->gap_start) {
         int move_len = g->gap_start - pos;
         g->gap_end -= move_len;
@@ -31,37 +193,105 @@ void gap_move(struct gapbuf *g, int pos) {
         g->gap_start += move_len;
         g->gap_end += move_len;
     }
+    gap_end(g, pos, 0, 0);
 }
 
-void gap_insert(struct gapbuf *g, char c) {
-    if (g->gap_start == g->gap_end) {
-        int gap_size = g->cap / 2;
-        int newcap = g->cap + gap_size;
-        char *nb = malloc(newcap);
-        int prefix = g->gap_start;
-        int suffix = g->cap - g->gap_end;
-        if (prefix) memcpy(nb, g->buf, prefix);
-        if (suffix) memcpy(nb + newcap - suffix, g->buf + g->gap_end, suffix);
-        g->gap_end = newcap - suffix;
-        g->cap = newcap;
-        free(g->buf);
-        g->buf = nb;
+/* Give the buffer newcap bytes without touching the text before the gap.
+ * realloc resizes large blocks in place by remapping their pages, so
+ * only the text after the gap is moved. */
+static void gap_resize(struct gapbuf *g, int newcap) {
+    int suffix = g->cap - g->gap_end;
+    if (newcap < g->cap) memmove(g->buf + newcap - suffix, g->buf + g->gap_end, suffix);
+    char *nb = mem_realloc(MEM_BUFFER, g->buf, g->cap, newcap);
+    if (newcap > g->cap) memmove(nb + newcap - suffix, nb + g->gap_end, suffix);
+    g->buf = nb;
+    g->gap_end = newcap - suffix;
+    g->cap = newcap;
+}
+
+static void gap_grow(struct gapbuf *g, int need) {
+    int gap_size = g->cap / 2;
+    if (gap_max > 0 && gap_size > gap_max) gap_size = gap_max;
+    if (gap_size < need) gap_size = need;
+    gap_resize(g, g->cap + gap_size);
+}
+
+/* After a delete: a gap twice the max is shrunk back to the max, the
+ * slack in between keeps a delete and undo pair from resizing twice */
+static void gap_shrink(struct gapbuf *g) {
+    if (gap_max > 0 && g->gap_end - g->gap_start > 2 * gap_max) {
+        gap_resize(g, gap_length(g) + gap_max);
     }
+}
+
+void gap_insert(struct gapbuf *g, char c) {
+    gap_begin(g);
+    if (g->pins) gap_pins_edit(g, g->gap_start, 0, 1);
+    if (g->gap_start == g->gap_end) gap_grow(g, 1);
     g->buf[g->gap_start++] = c;
+    if (c == '\n') lines_inserted(g, g->gap_start - 1, 1);
+    gap_end(g, g->gap_start - 1, 0, 1);
+}
+
+void gap_insert_bytes(struct gapbuf *g, const char *s, int n) {
+    if (n <= 0) return;
+    gap_begin(g);
+    if (g->pins) gap_pins_edit(g, g->gap_start, 0, n);
+    if (g->gap_end - g->gap_start < n) gap_grow(g, n);
+    memcpy(g->buf + g->gap_start, s, n);
+    lines_inserted(g, g->gap_start, n);
+    g->gap_start += n;
+    gap_end(g, g->gap_start - n, 0, n);
+}
+
+void gap_insert_copy(struct gapbuf *g, struct gapbuf *src, int from, int n) {
+    if (n <= 0) return;
+    gap_begin(g);
+    if (g->pins) gap_pins_edit(g, g->gap_start, 0, n);
+    if (g->gap_end - g->gap_start < n) gap_grow(g, n);
+    /* the source spans sit outside the gap, even when src is g */
+    gap_get_range(src, from, n, g->buf + g->gap_start);
+    lines_inserted(g, g->gap_start, n);
+    g->gap_start += n;
+    gap_end(g, g->gap_start - n, 0, n);
 }
 
 int gap_backspace(struct gapbuf *g) {
     if (g->gap_start == 0) return 0;
+    gap_begin(g);
+    if (g->pins) gap_pins_edit(g, g->gap_start - 1, 1, 0);
     g->gap_start--;
+    struct lineIndex *li = &g->lines;
+    if (li->before > 0 && li->nl[li->before - 1] == g->gap_start) li->before--;
+    gap_shrink(g);
+    gap_end(g, g->gap_start, 1, 0);
     return 1;
 }
 
 int gap_delete(struct gapbuf *g) {
     if (g->gap_end == g->cap) return 0;
+    gap_begin(g);
+    if (g->pins) gap_pins_edit(g, g->gap_start, 1, 0);
+    lines_deleted(g, gap_length(g), 1);
     g->gap_end++;
+    gap_shrink(g);
+    gap_end(g, g->gap_start, 1, 0);
     return 1;
 }
 
+int gap_delete_bytes(struct gapbuf *g, int n) {
+    int avail = g->cap - g->gap_end;
+    if (n > avail) n = avail;
+    if (n <= 0) return 0;
+    gap_begin(g);
+    if (g->pins) gap_pins_edit(g, g->gap_start, n, 0);
+    lines_deleted(g, gap_length(g), n);
+    g->gap_end += n;
+    gap_shrink(g);
+    gap_end(g, g->gap_start, n, 0);
+    return n;
+}
+
 int gap_get(struct gapbuf *g, char *out, int outcap) {
     int len = gap_length(g);
     if (outcap < len) return -1;
@@ -72,10 +302,115 @@ int gap_get(struct gapbuf *g, char *out, int outcap) {
     return len;
 }
 
+void gap_get_range(struct gapbuf *g, int from, int len, char *out) {
+    if (from < g->gap_start) {
+        int n = g->gap_start - from;
+        if (n > len) n = len;
+        memcpy(out, g->buf + from, n);
+        out += n;
+        from += n;
+        len -= n;
+    }
+    if (len > 0) memcpy(out, g->buf + g->gap_end + (from - g->gap_start), len);
+}
+
+const char *gap_span(struct gapbuf *g, int pos, int *len) {
+    if (pos < g->gap_start) {
+        *len = g->gap_start - pos;
+        return g->buf + pos;
+    }
+    *len = gap_length(g) - pos;
+    return g->buf + g->gap_end + (pos - g->gap_start);
+}
+
+void gap_batch_begin(struct gapbuf *g) {
+    gap_begin(g);
+    g->batch = 1;
+}
+
+void gap_batch_end(struct gapbuf *g, int pos, int removed, int inserted) {
+    g->batch = 0;
+    gap_end(g, pos, removed, inserted);
+}
+
+void gap_swap(struct gapbuf *g, struct gapbuf *other) {
+    struct gapbuf tmp = *g;
+    int oldlen = gap_length(g);
+
+    gap_begin(g);
+    gap_pins_release(g);
+    gap_pins_release(other);
+    g->buf = other->buf;
+    g->cap = other->cap;
+    g->gap_start = other->gap_start;
+    g->gap_end = other->gap_end;
+    other->buf = tmp.buf;
+    other->cap = tmp.cap;
+    other->gap_start = tmp.gap_start;
+    other->gap_end = tmp.gap_end;
+    g->lines = other->lines;
+    other->lines = tmp.lines;
+    gap_end(g, 0, oldlen, gap_length(g));
+}
+
+void gap_compact(struct gapbuf *g, int slack) {
+    int len = gap_length(g);
+    if (g->cap - len <= slack) return;
+    gap_begin(g);
+    gap_resize(g, len + slack > 0 ? len + slack : 1);
+    gap_end(g, 0, 0, 0);
+}
+
+void gap_trim(struct gapbuf *g) {
+    if (gap_max > 0) gap_compact(g, gap_max);
+}
+
 char gap_char_at(struct gapbuf *g, int pos) {
     if (pos < 0 || pos >= gap_length(g)) return '\0';
     if (pos < g->gap_start) return g->buf[pos];
     return g->buf[g->gap_end + (pos - g->gap_start)];
 }
 
+/* The helpers below walk the two contiguous spans on either side of the
+ * gap with memchr instead of calling gap_char_at per byte. */
 
+int gap_find_char(struct gapbuf *g, char c, int pos) {
+    int len = gap_length(g);
+    if (pos < 0) pos = 0;
+    if (pos < g->gap_start) {
+        char *p = memchr(g->buf + pos, c, g->gap_start - pos);
+        if (p) return p - g->buf;
+        pos = g->gap_start;
+    }
+    if (pos < len) {
+        char *suffix = g->buf + g->gap_end;
+        char *p = memchr(suffix + (pos - g->gap_start), c, len - pos);
+        if (p) return g->gap_start + (p - suffix);
+    }
+    return -1;
+}
+
+int gap_rfind_char(struct gapbuf *g, char c, int before) {
+    int len = gap_length(g);
+    if (before > len) before = len;
+    for (int pos = before - 1; pos >= g->gap_start; pos--) {
+        if (g->buf[g->gap_end + (pos - g->gap_start)] == c) return pos;
+    }
+    for (int pos = (before < g->gap_start ? before : g->gap_start) - 1; pos >= 0; pos--) {
+        if (g->buf[pos] == c) return pos;
+    }
+    return -1;
+}
+
+int gap_count_char(struct gapbuf *g, char c, int from, int to) {
+    int count = 0;
+    int len = gap_length(g);
+    if (to > len) to = len;
+    while (from < to) {
+        int hit = gap_find_char(g, c, from);
+        if (hit < 0 || hit >= to) break;
+        count++;
+        from = hit + 1;
+    }
+    return count;
+}
@@ -2,13 +2,60 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+/* Optional hooks run around every change to the buffer: lock/unlock
+ * bracket each primitive (gap moves included) and changed reports the
+ * logical edit while the lock is still held. */
+struct gapObserver {
+    void (*lock)(void *arg);
+    void (*unlock)(void *arg);
+    void (*changed)(void *arg, int pos, int removed, int inserted);
+    void *arg;
+};
+
+struct gapbuf;
+
+/* A range of text that something outside the buffer refers to instead
+ * of copying it. Edits before the range move start along; before an edit
+ * inside it, or the text going away, the pin is removed and release is
+ * called while the text is still intact. A pin with trim set is kept
+ * instead when the edit leaves some of its start alone: trim is told how
+ * many bytes that is and must cut len to at most that. */
+struct gapPin {
+    int start, len;
+    void (*release)(struct gapPin *pin, struct gapbuf *g);
+    void (*trim)(struct gapPin *pin, struct gapbuf *g, int keep);
+    void *arg;
+    struct gapPin *next;
+};
+
+/* Offsets of the newlines, split at the gap like the text: those before
+ * it are kept as offsets from the start, those after it as distances
+ * from the end, so typing at the gap never has to renumber any of them */
+struct lineIndex {
+    int *nl;
+    int cap;
+    int before;             /* nl[0 .. before) */
+    int after;              /* nl[cap - after .. cap), nearest the gap first */
+};
+
+/* Growth adds half the buffer's size but never more gap than this */
+#define GAP_MAX_DEFAULT (16 * 1024 * 1024)
+
 struct gapbuf {
     char *buf;
     int cap;
     int gap_start;
     int gap_end;
+    struct gapObserver *obs;
+    struct gapPin *pins;
+    int batch;              /* inside gap_batch_begin/gap_batch_end */
+    struct lineIndex lines;
 };
 
+/* Cap the gap that growing adds, and that large deletes leave behind,
+ * at bytes for every buffer; 0 lets the gap grow without bound */
+void gap_set_max(int bytes);
+
 /* Initialize gap buffer */
 void gap_init(struct gapbuf *g, int initial_cap);
 
@@ -24,16 +71,75 @@ void gap_move(struct gapbuf *g, int pos);
 /* Insert character at gap */
 void gap_insert(struct gapbuf *g, char c);
 
+/* Insert a run of n bytes at gap, growing at most once */
+void gap_insert_bytes(struct gapbuf *g, const char *s, int n);
+
+/* Insert a copy of the n bytes at from in src at gap; src may be g */
+void gap_insert_copy(struct gapbuf *g, struct gapbuf *src, int from, int n);
+
 /* Delete character before gap (backspace) */
 int gap_backspace(struct gapbuf *g);
 
 /* Delete character after gap (delete key) */
 int gap_delete(struct gapbuf *g);
 
+/* Delete up to n characters after gap, returns number deleted */
+int gap_delete_bytes(struct gapbuf *g, int n);
+
 /* Get entire buffer contents */
 int gap_get(struct gapbuf *g, char *out, int outcap);
 
+/* Copy len characters starting at from into out */
+void gap_get_range(struct gapbuf *g, int from, int len, char *out);
+
+/* Contiguous text starting at pos; *len is how many bytes follow it
+ * before the gap or the end */
+const char *gap_span(struct gapbuf *g, int pos, int *len);
+
+/* Run the edits up to gap_batch_end as one: observers are locked once
+ * and then told of a single change of removed bytes at pos into inserted */
+void gap_batch_begin(struct gapbuf *g);
+void gap_batch_end(struct gapbuf *g, int pos, int removed, int inserted);
+
+/* Exchange the contents of two buffers; observers of g see it as one
+ * change of the whole text */
+void gap_swap(struct gapbuf *g, struct gapbuf *other);
+
+/* Shrink the gap to at most slack bytes to give memory back */
+void gap_compact(struct gapbuf *g, int slack);
+
+/* Shrink a gap larger than the max down to it, as on an idle tick */
+void gap_trim(struct gapbuf *g);
+
+/* Keep pin's range of text up to date until it is released or unpinned */
+void gap_pin(struct gapbuf *g, struct gapPin *pin);
+void gap_unpin(struct gapbuf *g, struct gapPin *pin);
+
 /* Get character at specific position */
 char gap_char_at(struct gapbuf *g, int pos);
 
+/* Find first c at or after pos, -1 if none */
+int gap_find_char(struct gapbuf *g, char c, int pos);
+
+/* Find last c before the given position, -1 if none */
+int gap_rfind_char(struct gapbuf *g, char c, int before);
+
+/* Count occurrences of c in [from, to) */
+int gap_count_char(struct gapbuf *g, char c, int from, int to);
+
+/* Number of lines; the text after the last newline is one too */
+int gap_line_count(struct gapbuf *g);
+
+/* Offset where line row starts, clamped to the first and last line */
+int gap_line_start(struct gapbuf *g, int row);
+
+/* Offset of the newline ending line row, or the length for the last */
+int gap_line_end(struct gapbuf *g, int row);
+
+/* Line that offset pos is on */
+int gap_line_of(struct gapbuf *g, int pos);
+
+/* Rebuild the line index of text written into buf directly */
+void gap_reindex(struct gapbuf *g);
+
 #endif /* BUFFER_H */
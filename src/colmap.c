@@ -0,0 +1,229 @@
+/* colmap.c - Byte to screen column maps of long lines, cached per line */
+#include "colmap.h"
+#include "memstat.h"
+#include "utf8.h"
+#include <limits.h>
+#include <stdlib.h>
+
+void colmap_init(struct colMap *cm, struct gapbuf *g) {
+    cm->g = g;
+    cm->lines = calloc(COLMAP_LINES, sizeof(struct colLine));
+    cm->clock = 0;
+}
+
+/* Bytes past a checkpoint that the width of the character before it can
+ * depend on; the pin reaches this far past the last one */
+#define COLMAP_SLACK 3
+
+static void colmap_drop(struct colLine *cl) {
+    mem_free(MEM_SCREEN, cl->marks, 2 * cl->cap * sizeof(int));
+    cl->marks = NULL;
+    cl->count = cl->cap = 0;
+    cl->plain = 0;
+    cl->used = 0;
+}
+
+/* The line's text is going away */
+static void colmap_release(struct gapPin *pin, struct gapbuf *g) {
+    (void)g;
+    colmap_drop(pin->arg);
+}
+
+/* Index of the last checkpoint whose byte (key 0) or column (key 1) is
+ * at most v */
+static int colmap_mark(const struct colLine *cl, int key, int v) {
+    int lo = 0, hi = cl->count - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (cl->marks[mid * 2 + key] <= v) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Bytes of the line mapped so far */
+static int colmap_mapped(const struct colLine *cl) {
+    return cl->count ? cl->marks[(cl->count - 1) * 2] : cl->plain;
+}
+
+static void colmap_repin(struct colLine *cl) {
+    cl->pin.len = cl->count ? colmap_mapped(cl) + COLMAP_SLACK : cl->plain;
+}
+
+/* The line is changing keep bytes in: what was mapped before it stays */
+static void colmap_trim(struct gapPin *pin, struct gapbuf *g, int keep) {
+    struct colLine *cl = pin->arg;
+    (void)g;
+    if (cl->plain > keep) cl->plain = keep;
+    if (cl->count && cl->marks[0] + COLMAP_SLACK > keep) cl->count = 0;
+    else if (cl->count) cl->count = colmap_mark(cl, 0, keep - COLMAP_SLACK) + 1;
+    colmap_repin(cl);
+}
+
+void colmap_free(struct colMap *cm) {
+    if (!cm->lines) return;
+    for (int i = 0; i < COLMAP_LINES; i++) {
+        struct colLine *cl = &cm->lines[i];
+        if (cl->used == 0) continue;
+        gap_unpin(cm->g, &cl->pin);
+        colmap_drop(cl);
+    }
+    free(cm->lines);
+    cm->lines = NULL;
+}
+
+/* Walk the len-byte line at start from byte *pos at column *col, a
+ * character at a time, up to byte to or until the next character would
+ * go past column upto. Returns whether every byte walked was plain. */
+static int colmap_walk(struct gapbuf *g, int start, int len, int *pos, int *col, int to, int upto) {
+    int p = *pos, c = *col, plain = 1, stop = 0;
+    char tmp[4];
+    if (to > len) to = len;
+    while (!stop && p < to && c < upto) {
+        int avail;
+        const char *s = gap_span(g, start + p, &avail);
+        if (avail > len - p) avail = len - p;
+        const char *end = s + avail;
+
+        while (p < to && c < upto && s < end) {
+            int n = end - s < to - p ? end - s : to - p;
+            if (n > upto - c) n = upto - c;
+            int run = utf8_plain_run(s, n);
+            s += run;
+            p += run;
+            c += run;
+            if (run == n) continue;
+
+            /* a character that straddles the gap is copied out whole */
+            const char *cs = s;
+            int have = end - s;
+            if (have < 4 && have < len - p) {
+                have = len - p < 4 ? len - p : 4;
+                gap_get_range(g, start + p, have, tmp);
+                cs = tmp;
+            }
+            int bytes, w = utf8_char_cols(cs, have, c, &bytes);
+            if (c + w > upto) {
+                stop = 1;
+                break;
+            }
+            p += bytes;
+            c += w;
+            plain = 0;
+            if (cs == tmp) break;
+            s += bytes;
+        }
+    }
+    *pos = p;
+    *col = c;
+    return plain;
+}
+
+static void colmap_push(struct colLine *cl, int pos, int col) {
+    if (cl->count == cl->cap) {
+        int cap = cl->cap ? 2 * cl->cap : 16;
+        cl->marks = mem_realloc(MEM_SCREEN, cl->marks, 2 * cl->cap * sizeof(int), 2 * cap * sizeof(int));
+        cl->cap = cap;
+    }
+    cl->marks[cl->count * 2] = pos;
+    cl->marks[cl->count * 2 + 1] = col;
+    cl->count++;
+}
+
+/* Map the len-byte line further, a checkpoint every COLMAP_STRIDE bytes,
+ * until the map reaches byte pos or column col. Bytes that are all plain
+ * from the start only move plain along. */
+static void colmap_extend(struct colLine *cl, struct gapbuf *g, int len, int pos, int col) {
+    for (;;) {
+        int p = colmap_mapped(cl);
+        int c = cl->count ? cl->marks[cl->count * 2 - 1] : p;
+        if (p >= len || p >= pos || c >= col) break;
+        int from = p;
+        if (colmap_walk(g, cl->pin.start, len, &p, &c, p + COLMAP_STRIDE, INT_MAX) && cl->count == 0) {
+            cl->plain = p;
+        } else {
+            if (cl->count == 0) colmap_push(cl, from, from);
+            colmap_push(cl, p, c);
+        }
+    }
+    colmap_repin(cl);
+}
+
+/* The map of the line at start, which is longer than COLMAP_STRIDE */
+static struct colLine *colmap_line(struct colMap *cm, int start) {
+    /* a hit, or else a free entry, or else the least recently used */
+    struct colLine *victim = NULL;
+    for (int i = 0; i < COLMAP_LINES; i++) {
+        struct colLine *cl = &cm->lines[i];
+        if (cl->used == 0) {
+            if (!victim || victim->used) victim = cl;
+        } else if (cl->pin.start == start) {
+            cl->used = ++cm->clock;
+            return cl;
+        } else if (!victim || (victim->used && cl->used < victim->used)) {
+            victim = cl;
+        }
+    }
+
+    if (victim->used) {
+        gap_unpin(cm->g, &victim->pin);
+        colmap_drop(victim);
+    }
+    victim->used = ++cm->clock;
+    victim->pin.start = start;
+    victim->pin.len = 0;
+    victim->pin.release = colmap_release;
+    victim->pin.trim = colmap_trim;
+    victim->pin.arg = victim;
+    gap_pin(cm->g, &victim->pin);
+    return victim;
+}
+
+int colmap_col(struct colMap *cm, int start, int len, int pos) {
+    int p = 0, c = 0;
+    if (pos > len) pos = len;
+    if (len > COLMAP_STRIDE) {
+        struct colLine *cl = colmap_line(cm, start);
+        colmap_extend(cl, cm->g, len, pos, INT_MAX);
+        if (pos <= cl->plain) return pos;
+        int m = colmap_mark(cl, 0, pos);
+        p = cl->marks[m * 2];
+        c = cl->marks[m * 2 + 1];
+    }
+    colmap_walk(cm->g, start, len, &p, &c, pos, INT_MAX);
+    return c;
+}
+
+int colmap_pos(struct colMap *cm, int start, int len, int col) {
+    int p = 0, c = 0;
+    if (len > COLMAP_STRIDE) {
+        struct colLine *cl = colmap_line(cm, start);
+        colmap_extend(cl, cm->g, len, INT_MAX, col);
+        if (col < cl->plain || cl->count == 0) return col < len ? col : len;
+        int m = colmap_mark(cl, 1, col);
+        if (cl->marks[m * 2] > len) m = colmap_mark(cl, 0, len);
+        p = cl->marks[m * 2];
+        c = cl->marks[m * 2 + 1];
+    }
+    colmap_walk(cm->g, start, len, &p, &c, len, col);
+    return p;
+}
+
+int colmap_cols(struct gapbuf *g, int from, int to) {
+    int p = 0, c = 0;
+    colmap_walk(g, from, to - from, &p, &c, to - from, INT_MAX);
+    return c;
+}
+
+int colmap_prev_char(struct gapbuf *g, int pos) {
+    if (pos > 0) pos--;
+    while (pos > 0 && utf8_is_cont(gap_char_at(g, pos))) pos--;
+    return pos;
+}
+
+int colmap_next_char(struct gapbuf *g, int pos) {
+    int len = gap_length(g);
+    if (pos < len) pos++;
+    while (pos < len && utf8_is_cont(gap_char_at(g, pos))) pos++;
+    return pos;
+}
@@ -0,0 +1,50 @@
+/* colmap.h - Byte to screen column maps of long lines, cached per line */
+#ifndef COLMAP_H
+#define COLMAP_H
+
+#include "buffer.h"
+
+/* Bytes between the checkpoints of a map; lines no longer than this are
+ * scanned instead of mapped */
+#define COLMAP_STRIDE 256
+
+/* Lines mapped at once */
+#define COLMAP_LINES 64
+
+/* Screen column at a character boundary about every COLMAP_STRIDE bytes
+ * of the start of a line, mapped as far as it has been asked about. The
+ * mapped text is pinned, so an edit only cuts the map back to it. */
+struct colLine {
+    struct gapPin pin;
+    int plain;              /* leading bytes of one column each, no marks kept */
+    int count, cap;
+    int *marks;             /* byte offset and column pairs past them, ascending */
+    unsigned long used;
+};
+
+struct colMap {
+    struct gapbuf *g;
+    struct colLine *lines;
+    unsigned long clock;
+};
+
+void colmap_init(struct colMap *cm, struct gapbuf *g);
+void colmap_free(struct colMap *cm);
+
+/* Screen column byte offset pos of the len-byte line at start is drawn at */
+int colmap_col(struct colMap *cm, int start, int len, int pos);
+
+/* Byte offset of the character of the line that covers screen column col,
+ * or len when the line ends before it */
+int colmap_pos(struct colMap *cm, int start, int len, int col);
+
+/* Start of the character before pos and of the one after it, so moves
+ * and deletes never split a UTF-8 sequence */
+int colmap_prev_char(struct gapbuf *g, int pos);
+int colmap_next_char(struct gapbuf *g, int pos);
+
+/* Columns the text between from and to takes, from column 0; for short
+ * stretches such as a wrapped row, which are never mapped */
+int colmap_cols(struct gapbuf *g, int from, int to);
+
+#endif /* COLMAP_H */
@@ -1,5 +1,6 @@
 /* config.c - Configuration system */
 #include "config.h"
+#include "buffer.h"
 #include <string.h>
 
 void config_default(Config *cfg) {
@@ -12,4 +13,5 @@ void config_default(Config *cfg) {
     cfg->show_welcome = 1;
     cfg->create_backup = 0;
     cfg->auto_save_interval = 0;
+    cfg->max_gap = GAP_MAX_DEFAULT;
 }
@@ -0,0 +1,138 @@
+/* cursors.c - Extra cursors and edits applied at all of them at once */
+#include "cursors.h"
+#include "replace.h"
+#include <stdlib.h>
+#include <string.h>
+
+void cursors_init(struct cursorSet *cs) {
+    cs->pos = NULL;
+    cs->count = cs->cap = 0;
+}
+
+void cursors_free(struct cursorSet *cs) {
+    free(cs->pos);
+    cursors_init(cs);
+}
+
+void cursors_clear(struct cursorSet *cs) {
+    cs->count = 0;
+}
+
+int cursors_find(struct cursorSet *cs, int pos) {
+    int lo = 0, hi = cs->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (cs->pos[mid] < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int cursors_add(struct cursorSet *cs, int pos) {
+    int i = cursors_find(cs, pos);
+    if (i < cs->count && cs->pos[i] == pos) return 0;
+    if (cs->count == cs->cap) {
+        cs->cap = cs->cap ? cs->cap * 2 : 16;
+        cs->pos = realloc(cs->pos, cs->cap * sizeof(int));
+    }
+    memmove(cs->pos + i + 1, cs->pos + i, (cs->count - i) * sizeof(int));
+    cs->pos[i] = pos;
+    cs->count++;
+    return 1;
+}
+
+void cursors_remove(struct cursorSet *cs, int pos) {
+    int i = cursors_find(cs, pos);
+    if (i == cs->count || cs->pos[i] != pos) return;
+    memmove(cs->pos + i, cs->pos + i + 1, (cs->count - i - 1) * sizeof(int));
+    cs->count--;
+}
+
+/* Moves and edits keep the order but can bring cursors together */
+static void cursors_merge(struct cursorSet *cs) {
+    int n = 0;
+    for (int i = 0; i < cs->count; i++) {
+        if (n == 0 || cs->pos[i] != cs->pos[n - 1]) cs->pos[n++] = cs->pos[i];
+    }
+    cs->count = n;
+}
+
+void cursors_clamp(struct cursorSet *cs, int len) {
+    while (cs->count > 0 && cs->pos[cs->count - 1] > len) cs->count--;
+}
+
+/* -------- movement -------- */
+/* The character of row to that covers the screen column p is drawn at
+ * on row from */
+static int same_column(struct colMap *cm, int from, int p, int to) {
+    struct gapbuf *g = cm->g;
+    int start = gap_line_start(g, from);
+    int col = colmap_col(cm, start, gap_line_end(g, from) - start, p - start);
+    start = gap_line_start(g, to);
+    return start + colmap_pos(cm, start, gap_line_end(g, to) - start, col);
+}
+
+static int cursor_moved(struct colMap *cm, int p, enum cursorMove m) {
+    struct gapbuf *g = cm->g;
+    switch (m) {
+        case CURSOR_LEFT:
+            return colmap_prev_char(g, p);
+        case CURSOR_RIGHT:
+            return colmap_next_char(g, p);
+        case CURSOR_HOME:
+            return gap_line_start(g, gap_line_of(g, p));
+        case CURSOR_END:
+            return gap_line_end(g, gap_line_of(g, p));
+        case CURSOR_UP: {
+            int row = gap_line_of(g, p);
+            return row == 0 ? p : same_column(cm, row, p, row - 1);
+        }
+        case CURSOR_DOWN: {
+            int row = gap_line_of(g, p);
+            return row == gap_line_count(g) - 1 ? p : same_column(cm, row, p, row + 1);
+        }
+    }
+    return p;
+}
+
+void cursors_move(struct cursorSet *cs, struct colMap *cm, enum cursorMove m) {
+    for (int i = 0; i < cs->count; i++) cs->pos[i] = cursor_moved(cm, cs->pos[i], m);
+    cursors_merge(cs);
+}
+
+/* -------- editing -------- */
+void cursors_edit(struct cursorSet *cs, struct gapbuf *g, struct editHistory *h, int *primary,
+                  int before, int after, const char *text, int len) {
+    cursors_add(cs, *primary);
+    int p = cursors_find(cs, *primary);
+    int n = cs->count, doclen = gap_length(g);
+
+    /* the spans to replace, cut back where neighbours would overlap */
+    int *starts = malloc(2 * n * sizeof(int));
+    int *lens = starts + n;
+    int prev_end = 0, removing = 0;
+    for (int i = 0; i < n; i++) {
+        int s = cs->pos[i], e = cs->pos[i];
+        for (int k = 0; k < before && s > prev_end; k++) s = colmap_prev_char(g, s);
+        for (int k = 0; k < after && e < doclen; k++) e = colmap_next_char(g, e);
+        if (s < prev_end) s = prev_end;
+        if (e < s) e = s;
+        starts[i] = s;
+        lens[i] = e - s;
+        removing |= lens[i];
+        prev_end = e;
+    }
+
+    if (removing || len > 0) {
+        history_push_replace(h, replace_spans(g, starts, lens, n, text, NULL, len));
+        for (int i = 0, shift = 0; i < n; i++) {
+            cs->pos[i] = starts[i] + shift + len;
+            shift += len - lens[i];
+        }
+    }
+    *primary = cs->pos[p];
+    free(starts);
+
+    cursors_merge(cs);
+    cursors_remove(cs, *primary);
+}
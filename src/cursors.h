@@ -0,0 +1,49 @@
+/* cursors.h - Extra cursors and edits applied at all of them at once */
+#ifndef CURSORS_H
+#define CURSORS_H
+
+#include "buffer.h"
+#include "history.h"
+#include "colmap.h"
+
+/* The cursors besides the primary one, as buffer offsets */
+struct cursorSet {
+    int *pos;           /* ascending, no duplicates */
+    int count, cap;
+};
+
+enum cursorMove {
+    CURSOR_LEFT,
+    CURSOR_RIGHT,
+    CURSOR_UP,
+    CURSOR_DOWN,
+    CURSOR_HOME,
+    CURSOR_END
+};
+
+void cursors_init(struct cursorSet *cs);
+void cursors_free(struct cursorSet *cs);
+void cursors_clear(struct cursorSet *cs);
+
+/* Add a cursor at pos; returns 0 if there already was one */
+int cursors_add(struct cursorSet *cs, int pos);
+
+/* Drop the cursor at pos, if there is one */
+void cursors_remove(struct cursorSet *cs, int pos);
+
+/* Index of the first cursor at or after pos */
+int cursors_find(struct cursorSet *cs, int pos);
+
+/* Drop cursors past len, for text that shrank elsewhere */
+void cursors_clamp(struct cursorSet *cs, int len);
+
+/* Move every cursor, keeping its screen column on up and down */
+void cursors_move(struct cursorSet *cs, struct colMap *cm, enum cursorMove m);
+
+/* At every cursor and at *primary, replace the `before` characters before
+ * it and the `after` characters after it with text, as one pass from the back
+ * and one undo record. Cursors end up after the text, *primary too. */
+void cursors_edit(struct cursorSet *cs, struct gapbuf *g, struct editHistory *h, int *primary,
+                  int before, int after, const char *text, int len);
+
+#endif /* CURSORS_H */
@@ -0,0 +1,239 @@
+/* document.c - Open documents and switching between them */
+#define _POSIX_C_SOURCE 200809L
+
+#include "document.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void document_free(struct document *d) {
+    search_index_free(&d->search_index);
+    history_free(&d->history);
+    gap_free(&d->g);
+    wrap_free(&d->wrap);
+    colmap_free(&d->cols);
+    free(d->filename);
+    free(d);
+}
+
+static void document_stat(struct document *d, struct stat *st) {
+    d->mtime = st->st_mtim;
+    d->size = st->st_size;
+}
+
+/* Whether the file still looks like what was last read or written */
+static int document_unchanged(struct document *d, struct timespec mtime, off_t size) {
+    return d->mtime.tv_sec == mtime.tv_sec && d->mtime.tv_nsec == mtime.tv_nsec &&
+           d->size == size;
+}
+
+/* Only clean documents that came from disk can be read back later */
+static int document_evictable(struct document *d) {
+    return !d->dirty && !d->evicted && d->filename && d->mtime.tv_sec != 0 &&
+           gap_length(&d->g) > 0;
+}
+
+static void document_evict(struct document *d) {
+    struct gapbuf empty;
+    gap_init(&empty, 1);
+    search_index_clear(&d->search_index);
+    gap_swap(&d->g, &empty);
+    gap_free(&empty);
+    d->evicted = 1;
+}
+
+/* Drop the wrap layouts and column maps; they are rebuilt as lines are drawn */
+static void document_drop_layout(struct document *d) {
+    wrap_free(&d->wrap);
+    wrap_init(&d->wrap, &d->g);
+    colmap_free(&d->cols);
+    colmap_init(&d->cols, &d->g);
+}
+
+/* -------- document list -------- */
+void doclist_init(struct documentList *dl, long long budget) {
+    memset(dl, 0, sizeof(*dl));
+    dl->budget = budget;
+    doclist_add(dl, NULL);
+    dl->docs[0]->last_used = ++dl->clock;
+}
+
+void doclist_free(struct documentList *dl) {
+    for (int i = 0; i < dl->count; i++) document_free(dl->docs[i]);
+    free(dl->docs);
+    memset(dl, 0, sizeof(*dl));
+}
+
+struct document *doclist_add(struct documentList *dl, const char *filename) {
+    struct document *d = calloc(1, sizeof(struct document));
+    gap_init(&d->g, 1024);
+    history_init(&d->history);
+    selection_clear(&d->sel);
+    search_index_init(&d->search_index, &d->g);
+    wrap_init(&d->wrap, &d->g);
+    colmap_init(&d->cols, &d->g);
+    d->filename = filename ? strdup(filename) : NULL;
+
+    if (dl->count == dl->cap) {
+        dl->cap = dl->cap ? dl->cap * 2 : 8;
+        dl->docs = realloc(dl->docs, dl->cap * sizeof(struct document *));
+    }
+    dl->docs[dl->count++] = d;
+    return d;
+}
+
+int doclist_find(struct documentList *dl, const char *filename) {
+    for (int i = 0; i < dl->count; i++) {
+        if (dl->docs[i]->filename && strcmp(dl->docs[i]->filename, filename) == 0) return i;
+    }
+    return -1;
+}
+
+int doclist_index(struct documentList *dl, struct document *d) {
+    for (int i = 0; i < dl->count; i++) {
+        if (dl->docs[i] == d) return i;
+    }
+    return -1;
+}
+
+struct document *doclist_switch(struct documentList *dl, int idx) {
+    struct document *left = dl->docs[dl->current];
+    struct document *d = dl->docs[idx];
+    dl->current = idx;
+    d->last_used = ++dl->clock;
+
+    if (d->evicted) {
+        struct timespec mtime = d->mtime;
+        off_t size = d->size;
+        /* the history only applies to the text it was recorded on */
+        if (document_load(d) == -1 || !document_unchanged(d, mtime, size)) {
+            history_free(&d->history);
+            history_init(&d->history);
+            selection_clear(&d->sel);
+            d->cx = d->cy = 0;
+            d->rowoff = d->coloff = 0;
+        }
+        d->evicted = 0;
+    }
+    if (left != d) doclist_trim(dl);
+    return d;
+}
+
+void doclist_close(struct documentList *dl, int idx) {
+    document_free(dl->docs[idx]);
+    memmove(dl->docs + idx, dl->docs + idx + 1, (dl->count - idx - 1) * sizeof(struct document *));
+    dl->count--;
+    if (dl->count == 0) doclist_add(dl, NULL);
+    if (dl->current > idx || dl->current == dl->count) dl->current--;
+    if (dl->current < 0) dl->current = 0;
+}
+
+static int by_last_used(const void *a, const void *b) {
+    const struct document *x = *(struct document * const *)a;
+    const struct document *y = *(struct document * const *)b;
+    return x->last_used < y->last_used ? -1 : x->last_used > y->last_used;
+}
+
+void doclist_trim(struct documentList *dl) {
+    struct document **lru = malloc(dl->count * sizeof(struct document *));
+    long long total = 0;
+    int n = 0;
+    for (int i = 0; i < dl->count; i++) {
+        if (i == dl->current || dl->docs[i]->windows > 0) continue;
+        lru[n++] = dl->docs[i];
+        total += document_memory(dl->docs[i]);
+    }
+    qsort(lru, n, sizeof(struct document *), by_last_used);
+
+    /* shrinking gaps and dropping matches and layouts costs nothing to undo ... */
+    for (int i = 0; i < n && total > dl->budget; i++) {
+        long long before = document_memory(lru[i]);
+        search_index_clear(&lru[i]->search_index);
+        document_drop_layout(lru[i]);
+        gap_compact(&lru[i]->g, 0);
+        total -= before - document_memory(lru[i]);
+    }
+    /* ... dropping the text costs a read on the next switch */
+    for (int i = 0; i < n && total > dl->budget; i++) {
+        if (!document_evictable(lru[i])) continue;
+        long long before = document_memory(lru[i]);
+        document_evict(lru[i]);
+        total -= before - document_memory(lru[i]);
+    }
+    free(lru);
+}
+
+/* -------- documents -------- */
+long long document_memory(struct document *d) {
+    int matches = search_index_count(&d->search_index, NULL);
+    return d->g.cap + (long long)d->g.lines.cap * sizeof(int) +
+           (long long)matches * 2 * sizeof(int);
+}
+
+void document_clear(struct document *d) {
+    search_index_clear(&d->search_index);
+    gap_move(&d->g, 0);
+    gap_delete_bytes(&d->g, gap_length(&d->g));
+    history_free(&d->history);
+    history_init(&d->history);
+    selection_clear(&d->sel);
+    d->dirty = 0;
+    d->cx = d->cy = 0;
+    d->rowoff = d->coloff = 0;
+}
+
+int document_load(struct document *d) {
+    int fd = open(d->filename, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size > INT_MAX - DOC_LOAD_SLACK) {
+        close(fd);
+        return -1;
+    }
+
+    /* read straight into a buffer sized for the file, so a freshly
+     * opened document is already compact */
+    struct gapbuf fresh;
+    int size = st.st_size, n = 0;
+    gap_init(&fresh, size + DOC_LOAD_SLACK);
+    while (n < size) {
+        ssize_t r = read(fd, fresh.buf + n, size - n);
+        if (r <= 0) break;
+        n += r;
+    }
+    close(fd);
+    fresh.gap_start = n;
+    gap_reindex(&fresh);
+
+    gap_swap(&d->g, &fresh);
+    gap_free(&fresh);
+    document_stat(d, &st);
+    d->dirty = 0;
+    return 0;
+}
+
+int document_save(struct document *d) {
+    if (d->filename == NULL) return -1;
+
+    struct gapbuf *g = &d->g;
+    int len = gap_length(g);
+    int prefix = g->gap_start;
+    int suffix = g->cap - g->gap_end;
+
+    int fd = open(d->filename, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) return -1;
+    int ok = ftruncate(fd, len) != -1 &&
+             write(fd, g->buf, prefix) == prefix &&
+             write(fd, g->buf + g->gap_end, suffix) == suffix;
+    struct stat st;
+    if (ok && fstat(fd, &st) == 0) document_stat(d, &st);
+    close(fd);
+    if (!ok) return -1;
+
+    d->dirty = 0;
+    return len;
+}
@@ -0,0 +1,87 @@
+/* document.h - Open documents and switching between them */
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "history.h"
+#include "selection.h"
+#include "searchindex.h"
+#include "wrap.h"
+#include "colmap.h"
+
+/* Bytes inactive documents may hold before they get trimmed */
+#define DOC_INACTIVE_BUDGET (256LL * 1024 * 1024)
+
+/* Free space left after the text when a file is read */
+#define DOC_LOAD_SLACK 4096
+
+/* One open document. Documents are allocated once and never move, since
+ * the search index keeps a pointer to the buffer. */
+struct document {
+    struct gapbuf g;
+    struct editHistory history;
+    struct selection sel;
+    struct searchIndex search_index;
+    struct wrapCache wrap;  /* soft wrap layout of its long lines */
+    struct colMap cols;     /* screen columns along its long lines */
+    char *filename;
+    int dirty;
+    int cx, cy;             /* cursor and scroll, saved while inactive */
+    int rowoff, coloff;
+    int windows;            /* panes showing it; those are never trimmed */
+    int evicted;            /* text dropped, read back from filename on switch */
+    struct timespec mtime;  /* the file as last read or written */
+    off_t size;
+    unsigned long last_used;
+};
+
+struct documentList {
+    struct document **docs;
+    int count, cap;
+    int current;
+    unsigned long clock;
+    long long budget;
+};
+
+/* Start with a single empty document */
+void doclist_init(struct documentList *dl, long long budget);
+
+/* Free every document */
+void doclist_free(struct documentList *dl);
+
+/* Add an empty document after the others and return it */
+struct document *doclist_add(struct documentList *dl, const char *filename);
+
+/* Index of the document open on filename, -1 if none */
+int doclist_find(struct documentList *dl, const char *filename);
+
+/* Index of d in the list */
+int doclist_index(struct documentList *dl, struct document *d);
+
+/* Make idx the current document and return it. Only the document that
+ * is left is touched, unless inactive documents are over budget. */
+struct document *doclist_switch(struct documentList *dl, int idx);
+
+/* Close document idx; an empty one takes its place if it was the last */
+void doclist_close(struct documentList *dl, int idx);
+
+/* Shrink and evict inactive documents, least recently used first,
+ * until they fit the budget */
+void doclist_trim(struct documentList *dl);
+
+/* Bytes held by a document's text, line index and match index */
+long long document_memory(struct document *d);
+
+/* Empty the document and forget its history */
+void document_clear(struct document *d);
+
+/* Read d->filename into the document. Returns -1 if it can't be read. */
+int document_load(struct document *d);
+
+/* Write the document to d->filename. Returns the bytes written or -1. */
+int document_save(struct document *d);
+
+#endif /* DOCUMENT_H */
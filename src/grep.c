@@ -0,0 +1,396 @@
+/* grep.c - Work-stealing directory search implementation */
+#define _GNU_SOURCE     /* memrchr */
+
+#include "grep.h"
+#include "buffer.h"
+#include "regex.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GREP_MAX_OUTPUT (64 * 1024 * 1024)
+#define GREP_LINE_MAX 200
+#define GREP_BINARY_PROBE 8192
+
+/* Larger files are searched a window at a time, so offsets fit an int */
+#define GREP_WINDOW (1 << 30)
+
+struct grepWorker {
+    struct grep *gr;
+    int id;
+    struct regex *re;       /* each worker has its own DFA cache */
+    char *out;
+    int outlen, outcap;
+    int nmatches, nfiles;
+    long long nbytes;
+};
+
+/* -------- work queues -------- */
+static void queue_push(struct grepQueue *q, char *path) {
+    pthread_mutex_lock(&q->lock);
+    if (q->tail == q->cap) {
+        if (q->head > 0) {
+            memmove(q->items, q->items + q->head, (q->tail - q->head) * sizeof(char *));
+            q->tail -= q->head;
+            q->head = 0;
+        } else {
+            q->cap = q->cap ? q->cap * 2 : 64;
+            q->items = realloc(q->items, q->cap * sizeof(char *));
+        }
+    }
+    q->items[q->tail++] = path;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static char *queue_pop(struct grepQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    char *path = q->tail > q->head ? q->items[--q->tail] : NULL;
+    pthread_mutex_unlock(&q->lock);
+    return path;
+}
+
+static char *queue_steal(struct grepQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    char *path = q->tail > q->head ? q->items[q->head++] : NULL;
+    pthread_mutex_unlock(&q->lock);
+    return path;
+}
+
+static void grep_push(struct grepWorker *w, char *path) {
+    struct grep *gr = w->gr;
+    queue_push(&gr->queues[w->id], path);
+    pthread_mutex_lock(&gr->lock);
+    gr->pending++;
+    gr->pushes++;
+    if (gr->idle) pthread_cond_signal(&gr->wake);
+    pthread_mutex_unlock(&gr->lock);
+}
+
+/* -------- searching -------- */
+static void grep_dir(struct grepWorker *w, const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+
+    size_t dlen = strlen(dir);
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        /* skips . and .. as well as .git and other hidden trees */
+        if (de->d_name[0] == '.') continue;
+
+        size_t nlen = strlen(de->d_name);
+        char *path = malloc(dlen + nlen + 2);
+        memcpy(path, dir, dlen);
+        memcpy(path + dlen, de->d_name, nlen + 1);
+
+        int type = de->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(path, &st) == 0) {
+                if (S_ISDIR(st.st_mode)) type = DT_DIR;
+                else if (S_ISREG(st.st_mode)) type = DT_REG;
+            }
+        }
+
+        if (type == DT_DIR) {
+            path[dlen + nlen] = '/';
+            path[dlen + nlen + 1] = '\0';
+            grep_push(w, path);
+        } else if (type == DT_REG) {
+            grep_push(w, path);
+        } else {
+            free(path);
+        }
+    }
+    closedir(d);
+}
+
+static void append(struct grepWorker *w, const char *s, int n) {
+    if (w->outlen + n > w->outcap) {
+        w->outcap = w->outcap * 2 > w->outlen + n ? w->outcap * 2 : w->outlen + n + 4096;
+        w->out = realloc(w->out, w->outcap);
+    }
+    memcpy(w->out + w->outlen, s, n);
+    w->outlen += n;
+}
+
+static void add_hit(struct grepWorker *w, const char *path, long long line, int col,
+                    const char *text, int len) {
+    char head[64];
+    if (strncmp(path, "./", 2) == 0) path += 2;
+    while (len > 0 && text[len - 1] == '\r') len--;
+    if (len > GREP_LINE_MAX) len = GREP_LINE_MAX;
+
+    append(w, path, strlen(path));
+    append(w, head, snprintf(head, sizeof(head), ":%lld:%d: ", line, col));
+    append(w, text, len);
+    append(w, "\n", 1);
+    w->nmatches++;
+}
+
+/* Report the first match on every matching line, counting lines with
+ * memchr as the scan moves forward from line number line. With rest set
+ * the lines after the last match are counted too; returns the number of
+ * the line the scan ended on. */
+static long long grep_scan(struct grepWorker *w, const char *path, const char *map, int size,
+                           long long line, int rest) {
+    struct grep *gr = w->gr;
+    struct gapbuf view;     /* read-only view so the regex engine can scan the map */
+    view.buf = (char *)map;
+    view.cap = size;
+    view.gap_start = size;
+    view.gap_end = size;
+    view.obs = NULL;
+    view.pins = NULL;
+    view.batch = 0;
+    view.lines = (struct lineIndex){ NULL, 0, 0, 0 };
+
+    int pos = 0, counted = 0, line_start = 0;
+    while (pos < size) {
+        int hit, len;
+        if (w->re) {
+            hit = regex_search_forward(w->re, &view, pos, &len);
+        } else {
+            int r = search_span(map + pos, size - pos, &gr->sp);
+            hit = r < 0 ? -1 : pos + r;
+        }
+        if (hit < 0 || hit >= size) break;
+
+        while (counted < hit) {
+            const char *nl = memchr(map + counted, '\n', hit - counted);
+            if (!nl) break;
+            line++;
+            counted = nl - map + 1;
+            line_start = counted;
+        }
+        counted = hit;
+
+        const char *nl = memchr(map + hit, '\n', size - hit);
+        int line_end = nl ? nl - map : size;
+        add_hit(w, path, line, hit - line_start + 1, map + line_start, line_end - line_start);
+        pos = line_end + 1;
+    }
+
+    const char *nl;
+    while (rest && counted < size && (nl = memchr(map + counted, '\n', size - counted)) != NULL) {
+        line++;
+        counted = nl - map + 1;
+    }
+    return line;
+}
+
+static void grep_file(struct grepWorker *w, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    long long size = st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    /* like grep, treat a NUL near the start as a binary file */
+    int probe = size < GREP_BINARY_PROBE ? size : GREP_BINARY_PROBE;
+    if (!memchr(map, '\0', probe)) {
+        w->nfiles++;
+        w->nbytes += size;
+
+        /* a window ends after its last newline, so lines are not split
+         * between two unless one is longer than a whole window */
+        long long base = 0, line = 1;
+        while (base < size) {
+            long long end = size - base > GREP_WINDOW ? base + GREP_WINDOW : size;
+            if (end < size) {
+                const char *nl = memrchr(map + base, '\n', end - base);
+                if (nl) end = nl - map + 1;
+            }
+            line = grep_scan(w, path, map + base, end - base, line, end < size);
+            base = end;
+        }
+    }
+    munmap(map, size);
+}
+
+/* Hand this worker's results to the shared output in one piece, so the
+ * lines of a file stay together */
+static void grep_flush(struct grepWorker *w) {
+    struct grep *gr = w->gr;
+    pthread_mutex_lock(&gr->lock);
+    if (gr->outlen + w->outlen > GREP_MAX_OUTPUT) {
+        gr->truncated = 1;
+        gr->cancel = 1;
+    } else if (w->outlen) {
+        if (gr->outlen + w->outlen > gr->outcap) {
+            gr->outcap = gr->outlen + w->outlen + gr->outcap;
+            gr->out = realloc(gr->out, gr->outcap);
+        }
+        memcpy(gr->out + gr->outlen, w->out, w->outlen);
+        gr->outlen += w->outlen;
+        gr->nmatches += w->nmatches;
+    }
+    gr->nfiles += w->nfiles;
+    gr->nbytes += w->nbytes;
+    pthread_mutex_unlock(&gr->lock);
+
+    w->outlen = 0;
+    w->nmatches = w->nfiles = 0;
+    w->nbytes = 0;
+}
+
+static void *grep_worker(void *arg) {
+    struct grepWorker *w = arg;
+    struct grep *gr = w->gr;
+
+    for (;;) {
+        pthread_mutex_lock(&gr->lock);
+        int seen = gr->pushes;
+        int stop = gr->cancel || gr->pending == 0;
+        pthread_mutex_unlock(&gr->lock);
+        if (stop) break;
+
+        /* own work newest first, then steal the oldest from the others */
+        char *path = queue_pop(&gr->queues[w->id]);
+        for (int i = 1; !path && i < gr->nthreads; i++) {
+            path = queue_steal(&gr->queues[(w->id + i) % gr->nthreads]);
+        }
+
+        if (!path) {
+            pthread_mutex_lock(&gr->lock);
+            if (gr->pushes == seen && gr->pending > 0 && !gr->cancel) {
+                gr->idle++;
+                pthread_cond_wait(&gr->wake, &gr->lock);
+                gr->idle--;
+            }
+            pthread_mutex_unlock(&gr->lock);
+            continue;
+        }
+
+        if (path[strlen(path) - 1] == '/') grep_dir(w, path);
+        else grep_file(w, path);
+        free(path);
+        grep_flush(w);
+
+        pthread_mutex_lock(&gr->lock);
+        if (--gr->pending == 0) pthread_cond_broadcast(&gr->wake);
+        pthread_mutex_unlock(&gr->lock);
+    }
+
+    pthread_mutex_lock(&gr->lock);
+    gr->exited++;
+    pthread_mutex_unlock(&gr->lock);
+    return NULL;
+}
+
+/* -------- public interface -------- */
+int grep_start(struct grep *gr, const char *root, const char *query, int len,
+               int regex, int nthreads) {
+    memset(gr, 0, sizeof(*gr));
+    if (len <= 0) return -1;
+    if (regex) {
+        struct regex *re = regex_compile(query, len, NULL);
+        if (!re) return -1;
+        regex_free(re);
+    }
+    if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = 1;
+
+    gr->query = malloc(len);
+    memcpy(gr->query, query, len);
+    gr->qlen = len;
+    gr->regex = regex;
+    search_compile(&gr->sp, gr->query, len);
+    pthread_mutex_init(&gr->lock, NULL);
+    pthread_cond_init(&gr->wake, NULL);
+
+    gr->nthreads = nthreads;
+    gr->queues = calloc(nthreads, sizeof(struct grepQueue));
+    gr->workers = calloc(nthreads, sizeof(struct grepWorker));
+    gr->threads = calloc(nthreads, sizeof(pthread_t));
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&gr->queues[i].lock, NULL);
+        gr->workers[i].gr = gr;
+        gr->workers[i].id = i;
+        if (regex) gr->workers[i].re = regex_compile(query, len, NULL);
+    }
+
+    size_t rlen = strlen(root);
+    char *path = malloc(rlen + 2);
+    memcpy(path, root, rlen + 1);
+    if (rlen == 0 || path[rlen - 1] != '/') strcat(path, "/");
+    queue_push(&gr->queues[0], path);
+    gr->pending = 1;
+
+    /* carry on with however many workers could be started; they steal
+     * from every queue, so the root is picked up either way */
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&gr->threads[i], NULL, grep_worker, &gr->workers[i]) != 0) break;
+        gr->started++;
+    }
+    return 0;
+}
+
+int grep_take(struct grep *gr, char **out, int *len) {
+    *out = NULL;
+    *len = 0;
+    if (!gr->threads) return 0;
+
+    pthread_mutex_lock(&gr->lock);
+    *out = gr->out;
+    *len = gr->outlen;
+    gr->out = NULL;
+    gr->outlen = gr->outcap = 0;
+    int running = gr->exited < gr->started;
+    pthread_mutex_unlock(&gr->lock);
+    return running || *len > 0;
+}
+
+void grep_stats(struct grep *gr, int *nmatches, int *nfiles, long long *nbytes) {
+    *nmatches = *nfiles = 0;
+    *nbytes = 0;
+    if (!gr->threads) return;
+
+    pthread_mutex_lock(&gr->lock);
+    *nmatches = gr->nmatches;
+    *nfiles = gr->nfiles;
+    *nbytes = gr->nbytes;
+    pthread_mutex_unlock(&gr->lock);
+}
+
+void grep_stop(struct grep *gr) {
+    if (!gr->threads) return;
+
+    pthread_mutex_lock(&gr->lock);
+    gr->cancel = 1;
+    pthread_cond_broadcast(&gr->wake);
+    pthread_mutex_unlock(&gr->lock);
+    for (int i = 0; i < gr->started; i++) {
+        pthread_join(gr->threads[i], NULL);
+    }
+
+    for (int i = 0; i < gr->nthreads; i++) {
+        struct grepQueue *q = &gr->queues[i];
+        for (int j = q->head; j < q->tail; j++) free(q->items[j]);
+        free(q->items);
+        pthread_mutex_destroy(&q->lock);
+        regex_free(gr->workers[i].re);
+        free(gr->workers[i].out);
+    }
+    pthread_mutex_destroy(&gr->lock);
+    pthread_cond_destroy(&gr->wake);
+    free(gr->threads);
+    free(gr->workers);
+    free(gr->queues);
+    free(gr->query);
+    free(gr->out);
+    memset(gr, 0, sizeof(*gr));
+}
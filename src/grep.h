@@ -0,0 +1,61 @@
+/* grep.h - Parallel search across a directory tree */
+#ifndef GREP_H
+#define GREP_H
+
+#include <pthread.h>
+
+#include "search.h"
+
+struct grepWorker;
+
+/* Paths waiting to be searched by one worker. The owner takes from the
+ * back, idle workers steal from the front. */
+struct grepQueue {
+    pthread_mutex_t lock;
+    char **items;           /* directories end in '/' */
+    int head, tail, cap;
+};
+
+struct grep {
+    pthread_mutex_t lock;   /* guards everything below and the idle wait */
+    pthread_cond_t wake;
+    pthread_t *threads;
+    struct grepWorker *workers;
+    struct grepQueue *queues;
+    int nthreads;
+    int started;
+    int pending;            /* paths queued or being searched */
+    int pushes;             /* bumped on every push so idle workers don't miss one */
+    int idle;
+    int exited;
+    int cancel;
+
+    char *query;
+    int qlen;
+    int regex;
+    struct searchPattern sp;
+
+    char *out;              /* result lines not taken yet */
+    int outlen, outcap;
+    int truncated;
+    int nmatches;
+    int nfiles;
+    long long nbytes;
+};
+
+/* Start searching every file under root with nthreads workers, one per
+ * CPU if nthreads is 0. Returns -1 if the query does not compile. */
+int grep_start(struct grep *gr, const char *root, const char *query, int len,
+               int regex, int nthreads);
+
+/* Take the "path:line: text" lines found since the last call; *out is
+ * malloc'd or NULL. Returns 0 once the search is over and drained. */
+int grep_take(struct grep *gr, char **out, int *len);
+
+/* Matches reported and files searched so far */
+void grep_stats(struct grep *gr, int *nmatches, int *nfiles, long long *nbytes);
+
+/* Cancel the search if it is still running and release everything */
+void grep_stop(struct grep *gr);
+
+#endif /* GREP_H */
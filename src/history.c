@@ -1,7 +1,10 @@
 /* history.c - Undo/redo implementation */
 #include "history.h"
 #include "buffer.h"
+#include "replace.h"
+#include "memstat.h"
 #include <stdlib.h>
+#include <string.h>
 
 void history_init(struct editHistory *h) {
     h->undoStack = NULL;
@@ -12,7 +15,9 @@ void history_init(struct editHistory *h) {
 static void history_free_stack(struct edit *stack) {
     while (stack) {
         struct edit *next = stack->next;
-        free(stack);
+        mem_free(MEM_HISTORY, stack->text, stack->len);
+        replace_free(stack->rep);
+        mem_free(MEM_HISTORY, stack, sizeof(struct edit));
         stack = next;
     }
 }
@@ -22,11 +27,7 @@ void history_free(struct editHistory *h) {
     history_free_stack(h->redoStack);
 }
 
-void history_push(struct editHistory *h, enum editType type, int pos, char ch) {
-    struct edit *e = malloc(sizeof(struct edit));
-    e->type = type;
-    e->pos = pos;
-    e->ch = ch;
+static void history_link(struct editHistory *h, struct edit *e) {
     e->next = h->undoStack;
     e->prev = NULL;
     if (h->undoStack) h->undoStack->prev = e;
@@ -36,6 +37,41 @@ void history_push(struct editHistory *h, enum editType type, int pos, char ch) {
     h->redoStack = NULL;
 }
 
+void history_push(struct editHistory *h, enum editType type, int pos, char ch) {
+    struct edit *e = mem_alloc(MEM_HISTORY, sizeof(struct edit));
+    e->type = type;
+    e->pos = pos;
+    e->ch = ch;
+    e->text = NULL;
+    e->len = 0;
+    e->rep = NULL;
+    history_link(h, e);
+}
+
+void history_push_text(struct editHistory *h, enum editType type, int pos, const char *text, int len) {
+    if (len <= 0) return;
+    struct edit *e = mem_alloc(MEM_HISTORY, sizeof(struct edit));
+    e->type = type;
+    e->pos = pos;
+    e->ch = '\0';
+    e->text = mem_alloc(MEM_HISTORY, len);
+    memcpy(e->text, text, len);
+    e->len = len;
+    e->rep = NULL;
+    history_link(h, e);
+}
+
+void history_push_replace(struct editHistory *h, struct replaceSet *rs) {
+    struct edit *e = mem_alloc(MEM_HISTORY, sizeof(struct edit));
+    e->type = EDIT_REPLACE_ALL;
+    e->pos = rs->starts[0];
+    e->ch = '\0';
+    e->text = NULL;
+    e->len = 0;
+    e->rep = rs;
+    history_link(h, e);
+}
+
 int history_undo(struct editHistory *h, struct gapbuf *g) {  // ✅ Added parameter
     if (!h->undoStack) return 0;
     
@@ -58,6 +94,15 @@ int history_undo(struct editHistory *h, struct gapbuf *g) {  // ✅ Added parame
         case EDIT_DELETE_NEWLINE:
             gap_insert(g, e->ch);
             break;
+        case EDIT_INSERT_TEXT:
+            gap_delete_bytes(g, e->len);
+            break;
+        case EDIT_DELETE_TEXT:
+            gap_insert_bytes(g, e->text, e->len);
+            break;
+        case EDIT_REPLACE_ALL:
+            replace_apply(g, e->rep, 1);
+            break;
     }
     
     return 1;
@@ -85,6 +130,15 @@ int history_redo(struct editHistory *h, struct gapbuf *g) {  // ✅ Added parame
         case EDIT_DELETE_NEWLINE:
             gap_delete(g);
             break;
+        case EDIT_INSERT_TEXT:
+            gap_insert_bytes(g, e->text, e->len);
+            break;
+        case EDIT_DELETE_TEXT:
+            gap_delete_bytes(g, e->len);
+            break;
+        case EDIT_REPLACE_ALL:
+            replace_apply(g, e->rep, 0);
+            break;
     }
     
     return 1;
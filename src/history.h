@@ -8,13 +8,21 @@ enum editType {
     EDIT_INSERT,
     EDIT_DELETE,
     EDIT_INSERT_NEWLINE,
-    EDIT_DELETE_NEWLINE
+    EDIT_DELETE_NEWLINE,
+    EDIT_INSERT_TEXT,
+    EDIT_DELETE_TEXT,
+    EDIT_REPLACE_ALL
 };
 
+struct replaceSet;
+
 struct edit {
     enum editType type;
     int pos;
     char ch;
+    char *text;     /* run payload for EDIT_*_TEXT, NULL otherwise */
+    int len;
+    struct replaceSet *rep;     /* EDIT_REPLACE_ALL only */
     struct edit *next;
     struct edit *prev;
 };
@@ -34,6 +42,12 @@ void history_free(struct editHistory *h);
 /* Push new edit to undo stack */
 void history_push(struct editHistory *h, enum editType type, int pos, char ch);
 
+/* Push a whole run of text as a single edit */
+void history_push_text(struct editHistory *h, enum editType type, int pos, const char *text, int len);
+
+/* Push a finished replace-all; the history takes ownership of rs */
+void history_push_replace(struct editHistory *h, struct replaceSet *rs);
+
 /* Undo last edit */
 int history_undo(struct editHistory *h, struct gapbuf *g);
 
@@ -10,15 +10,35 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/socket.h>
 
 #include "buffer.h"
 #include "history.h"
 #include "selection.h"
 #include "syntax.h"
 #include "config.h"
+#include "search.h"
+#include "searchindex.h"
+#include "regex.h"
+#include "replace.h"
+#include "grep.h"
+#include "document.h"
+#include "window.h"
+#include "cursors.h"
+#include "wrap.h"
+#include "utf8.h"
+#include "colmap.h"
+#include "view.h"
+#include "server.h"
+#include "trace.h"
+#include "memstat.h"
 
 #define ABUF_SIZE 32768
-#define TAB_STOP 4
 
 /* -------- key definitions -------- */
 enum editorKey {
@@ -30,33 +50,74 @@ enum editorKey {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    PASTE_START,
+    PASTE_END,
+    RESIZE_EVENT,
+    REFRESH_EVENT
 };
 
 /* -------- editor state -------- */
 struct editorConfig {
     int cx, cy;
+    int goal_col;           /* screen column up and down aim for, -1 if cx's */
     int rowoff, coloff;
+    int rowsub;             /* visual row of line rowoff at the top, when wrapping */
     int screenrows, screencols;
-    struct termios orig_termios;
-    char *filename;
-    int dirty;
     char statusmsg[80];
-    struct editHistory history;
+    struct document *doc;   /* the document in the focused pane */
+    struct window *windows; /* root of the pane tree */
+    struct window *win;     /* focused pane; its view lives in cx..sel */
     struct selection sel;
+    struct cursorSet cursors;   /* extra cursors in the focused pane */
     struct clipboard clip;
     char *search_query;
+    int search_regex;
     int search_direction;
     int search_match_pos;
+    int search_drawn_count;
+    int search_drawn_complete;
     int show_welcome;
+    struct fileView *view;  /* the file of editor --view, shown instead of documents */
+    const char *view_path;
+    long long view_top;     /* where the line at the top of the viewer starts */
+    long long view_drawn;   /* bytes the line count had reached when last drawn */
+    int full_redraw;
+    struct grep grep;
+    struct document *grep_doc;  /* read-only grep results, if any */
+    struct document *close_confirmed;
+
+    int in_fd, out_fd;      /* the terminal, or a client's socket for both */
+    int remote;             /* a client session of editor --server */
+    int term_rows, term_cols;   /* size of a terminal ioctl cannot reach */
+    const char *replay;     /* keystrokes of editor --replay */
+    int replay_len, replay_pos;
+    long long bytes_out;
+    struct trace trace;
+    int show_trace;         /* frame timings over the top right corner */
+    const char *trace_path; /* Chrome trace written when the session ends */
+    int resize_pending;
+    int quit;
+    int keyed;              /* handled a keypress others have not seen */
+    unsigned long drawn_generation;
+    struct editorConfig *next_session;
 };
 
-static struct editorConfig E;
-static struct gapbuf g;
+/* Every session edits the same documents. A session holds editor_lock
+ * except while it waits for input, so sessions take turns a keypress at
+ * a time and never see a half-made edit. */
+static struct documentList documents;
+static pthread_mutex_t editor_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct editorConfig *sessions;
+static unsigned long edit_generation;
+
+static __thread struct editorConfig E;
+static struct termios orig_termios;
+static volatile sig_atomic_t winch_pending = 0;
 
 /* -------- append buffer -------- */
-static char abuf[ABUF_SIZE];
-static int abuf_len = 0;
+static __thread char abuf[ABUF_SIZE];
+static __thread int abuf_len = 0;
 
 void abufAppend(const char *s, int len) { 
     if (abuf_len + len < ABUF_SIZE) {
@@ -66,19 +127,73 @@ void abufAppend(const char *s, int len) {
 }
 
 void abufFlush(void) { 
-    write(STDOUT_FILENO, abuf, abuf_len); 
+    double t = trace_now();
+    write(E.out_fd, abuf, abuf_len); 
+    trace_span(&E.trace, SPAN_FLUSH, t);
+    E.bytes_out += abuf_len;
     abuf_len = 0; 
 }
 
+/* -------- damage tracking -------- */
+static unsigned int hashBytes(const char *s, int len) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Lay the panes out again and repaint everything on the next refresh.
+ * The panes take all rows but the message bar. */
+void editorInvalidateScreen(void) {
+    if (E.windows) window_layout(E.windows, 0, 0, E.screenrows - 1, E.screencols);
+    E.full_redraw = 1;
+}
+
+/* Position the cursor at the start of a pane row; returns the abuf mark */
+static int editorBeginRow(struct window *w, int row) {
+    char buf[24];
+    int start = abuf_len;
+    int l = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", w->top + row + 1, w->left + 1);
+    abufAppend(buf, l);
+    return start;
+}
+
+/* Finish a pane row after `drawn` visible columns: clear the rest of it
+ * without touching the pane to the right, then drop the row's bytes if
+ * the terminal already shows them, or has no room for them */
+static void editorEndRow(struct window *w, int row, int start, int drawn) {
+    if (row < 0 || row >= w->rows || w->top + row >= E.screenrows - 1 ||
+        w->left >= E.screencols) {
+        abuf_len = start;
+        return;
+    }
+    if (w->left + w->cols >= E.screencols) {
+        abufAppend("\x1b[K", 3);
+    } else if (drawn < w->cols) {
+        char buf[16];
+        int l = snprintf(buf, sizeof(buf), "\x1b[%dX", w->cols - drawn);
+        abufAppend(buf, l);
+    }
+    unsigned int h = hashBytes(abuf + start, abuf_len - start);
+    if (!E.full_redraw && w->row_hash[row] == h) {
+        abuf_len = start;
+    } else {
+        w->row_hash[row] = h;
+    }
+}
+
 /* -------- raw mode -------- */
 void disableRawMode(void) { 
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios); 
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios); 
 }
 
 void enableRawMode(void) {
-    if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) exit(1);
+    if (tcgetattr(STDIN_FILENO, &orig_termios) == -1) exit(1);
     atexit(disableRawMode);
-    struct termios raw = E.orig_termios;
+    struct termios raw = orig_termios;
     raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
     raw.c_oflag &= ~(OPOST);
     raw.c_cflag |= (CS8);
@@ -86,40 +201,84 @@ void enableRawMode(void) {
     raw.c_cc[VMIN] = 0; 
     raw.c_cc[VTIME] = 1;
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);  // bracketed paste
 }
 
 /* -------- terminal size -------- */
+/* Sizes a client or --replay asks for are taken within these */
+#define SCREEN_MAX_ROWS 1000
+#define SCREEN_MAX_COLS 4000
+
 int getWindowSize(int *rows, int *cols) {
-    struct winsize ws;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1) return -1;
-    *cols = ws.ws_col; 
-    *rows = ws.ws_row; 
+    if (E.remote || E.replay) {
+        *rows = E.term_rows;
+        *cols = E.term_cols;
+    } else {
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1) return -1;
+        *cols = ws.ws_col; 
+        *rows = ws.ws_row; 
+    }
+    if (*rows < 1) *rows = 1;
+    if (*rows > SCREEN_MAX_ROWS) *rows = SCREEN_MAX_ROWS;
+    if (*cols < 1) *cols = 1;
+    if (*cols > SCREEN_MAX_COLS) *cols = SCREEN_MAX_COLS;
     return 0;
 }
 
+static void handleSigwinch(int sig) {
+    (void)sig;
+    winch_pending = 1;
+}
+
+void installResizeHandler(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSigwinch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);   /* no SA_RESTART: let read() wake up */
+}
+
+void editorScroll(void);
+int editorTextRows(void);
+
+/* Re-read the terminal size and repaint. Only geometry is touched here:
+ * the scroll offsets are clamped so the cursor stays visible, the buffer
+ * and history are left alone. */
+void editorHandleResize(void) {
+    winch_pending = 0;
+    E.resize_pending = 0;
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1) return;
+    E.screenrows = rows - 2;
+    E.screencols = cols;
+    editorInvalidateScreen();
+    if (E.view) return;
+    if (E.rowoff > E.cy) E.rowoff = E.cy;
+    if (E.coloff > E.cx) E.coloff = E.cx;
+    editorScroll();
+}
+
+/* Text rows in the focused pane, its status line aside */
+int editorTextRows(void) {
+    return E.win->rows > 2 ? E.win->rows - 1 : 1;
+}
+
 /* -------- position helpers -------- */
+/* Row and column come straight from the line index, so none of these
+ * scan the text */
 int get_line_length(int row) {
-    int pos = rowcol_to_pos(&g, row, 0);
-    int len = gap_length(&g);
-    int line_len = 0;
-    
-    while (pos < len) {
-        char c = gap_char_at(&g, pos);
-        if (c == '\n') break;
-        line_len++;
-        pos++;
-    }
-    
-    return line_len;
+    if (row >= gap_line_count(&E.doc->g)) return 0;
+    return gap_line_end(&E.doc->g, row) - gap_line_start(&E.doc->g, row);
 }
 
 int get_line_indent(int row) {
-    int pos = rowcol_to_pos(&g, row, 0);
-    int len = gap_length(&g);
+    int pos = rowcol_to_pos(&E.doc->g, row, 0);
+    int len = gap_length(&E.doc->g);
     int indent = 0;
     
     while (pos < len) {
-        char c = gap_char_at(&g, pos);
+        char c = gap_char_at(&E.doc->g, pos);
         if (c == ' ') indent++;
         else if (c == '\t') indent += TAB_STOP;
         else break;
@@ -130,78 +289,193 @@ int get_line_indent(int row) {
 }
 
 int count_rows(void) {
-    int len = gap_length(&g);
-    int rows = 1;
-    for (int i = 0; i < len; i++) {
-        if (gap_char_at(&g, i) == '\n') rows++;
+    return gap_line_count(&E.doc->g);
+}
+
+/* Screen column of byte column cx on row, with tabs and wide characters.
+ * Long lines keep a column map, so this is a lookup, not a rescan. */
+int editorCxToRx(int row, int cx) {
+    struct gapbuf *g = &E.doc->g;
+    int start = gap_line_start(g, row);
+    return colmap_col(&E.doc->cols, start, gap_line_end(g, row) - start, cx);
+}
+
+/* Byte column of the character on row that covers screen column rx */
+int editorRxToCx(int row, int rx) {
+    struct gapbuf *g = &E.doc->g;
+    int start = gap_line_start(g, row);
+    return colmap_pos(&E.doc->cols, start, gap_line_end(g, row) - start, rx);
+}
+
+/* Byte column of the character before or after byte column cx on row, so
+ * moves and deletes never split a UTF-8 sequence */
+static int editorPrevCx(int row, int cx) {
+    int start = gap_line_start(&E.doc->g, row);
+    if (cx > 0) cx--;
+    while (cx > 0 && utf8_is_cont(gap_char_at(&E.doc->g, start + cx))) cx--;
+    return cx;
+}
+
+static int editorNextCx(int row, int cx) {
+    int start = gap_line_start(&E.doc->g, row);
+    int len = get_line_length(row);
+    if (cx < len) cx++;
+    while (cx < len && utf8_is_cont(gap_char_at(&E.doc->g, start + cx))) cx++;
+    return cx;
+}
+
+/* The cursor as a byte offset, which is what every edit works on */
+int editorCursorPos(void) {
+    return rowcol_to_pos(&E.doc->g, E.cy, E.cx);
+}
+
+/* Put the cursor at offset pos, usually where the gap was left */
+void editorSetCursorPos(int pos) {
+    pos_to_rowcol(&E.doc->g, pos, &E.cy, &E.cx);
+}
+
+/* Pull the cursor back inside text that may have shrunk under it */
+void editorClampCursor(void) {
+    int rows = count_rows();
+    if (E.cy >= rows) E.cy = rows - 1;
+    if (E.cx > get_line_length(E.cy)) E.cx = get_line_length(E.cy);
+}
+
+/* Catch up with edits other sessions made since this one last looked */
+static void editorSyncGeneration(void) {
+    if (E.drawn_generation != edit_generation) {
+        editorClampCursor();
+        cursors_clamp(&E.cursors, gap_length(&E.doc->g));
     }
-    return rows;
+    E.drawn_generation = edit_generation;
+}
+
+/* -------- documents -------- */
+const char *editorDocName(struct document *d) {
+    if (d->filename) return d->filename;
+    return d == E.grep_doc ? "[grep]" : "[No Name]";
+}
+
+/* Pick up the view the current document was last left with */
+static void editorRestoreView(void) {
+    E.cx = E.doc->cx;
+    E.cy = E.doc->cy;
+    E.rowoff = E.doc->rowoff;
+    E.coloff = E.doc->coloff;
+    E.rowsub = 0;
+    E.sel = E.doc->sel;
+    E.goal_col = -1;
+    cursors_clear(&E.cursors);
+    E.search_drawn_count = -1;
+}
+
+/* Show document idx in the focused pane; the one left keeps its view */
+void editorSwitchTo(int idx) {
+    E.doc->cx = E.cx;
+    E.doc->cy = E.cy;
+    E.doc->rowoff = E.rowoff;
+    E.doc->coloff = E.coloff;
+    E.doc->sel = E.sel;
+    window_show(E.win, documents.docs[idx]);
+    E.doc = doclist_switch(&documents, idx);
+    editorRestoreView();
 }
 
-/* -------- file I/O -------- */
+/* Switch to the document open on filename, reading it first if needed */
 void editorOpen(char *filename) {
-    E.filename = strdup(filename);
-    
-    FILE *fp = fopen(filename, "r");
-    if (!fp) return;
-    
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        for (ssize_t i = 0; i < linelen; i++) {
-            gap_insert(&g, line[i]);
+    int idx = doclist_find(&documents, filename);
+    if (idx == -1) {
+        /* the untouched document the editor starts with is reused */
+        struct document *d = E.doc;
+        if (d->filename || d->dirty || gap_length(&d->g) > 0 || d == E.grep_doc ||
+            d->windows > 1) {
+            d = doclist_add(&documents, filename);
+        } else {
+            d->filename = strdup(filename);
         }
+        document_load(d);
+        idx = doclist_index(&documents, d);
     }
-    
-    free(line);
-    fclose(fp);
-    E.dirty = 0;
+    editorSwitchTo(idx);
 }
 
 void editorSave(void) {
-    if (E.filename == NULL) {
+    if (E.doc->filename == NULL) {
         snprintf(E.statusmsg, sizeof(E.statusmsg), "No filename!");
         return;
     }
     
-    char tmp[65536];
-    int len = gap_get(&g, tmp, sizeof(tmp));
-    
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, tmp, len) == len) {
-                close(fd);
-                E.dirty = 0;
-                snprintf(E.statusmsg, sizeof(E.statusmsg), "Saved! %d bytes", len);
-                return;
-            }
-        }
-        close(fd);
+    int len = document_save(E.doc);
+    if (len == -1) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "Save failed!");
+    } else {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "Saved! %d bytes", len);
     }
-    snprintf(E.statusmsg, sizeof(E.statusmsg), "Save failed!");
 }
 
 /* -------- status bar -------- */
-void editorDrawStatusBar(void) {
-    abufAppend("\x1b[7m", 4);
+/* Format n with thousands separators, e.g. 12,408 */
+void formatCount(char *buf, int bufsize, long long n) {
+    char digits[24];
+    int nd = snprintf(digits, sizeof(digits), "%lld", n);
+    int out = 0;
+    for (int i = 0; i < nd && out < bufsize - 1; i++) {
+        if (i > 0 && (nd - i) % 3 == 0 && out < bufsize - 2) buf[out++] = ',';
+        buf[out++] = digits[i];
+    }
+    buf[out] = '\0';
+}
+
+/* The status line at the bottom of a pane */
+void editorDrawStatusBar(struct window *w) {
+    struct document *d = w->doc;
+    int row = w->rows - 1;
+    int start = editorBeginRow(w, row);
+    if (w == E.win) {
+        abufAppend("\x1b[7m", 4);
+    } else {
+        abufAppend("\x1b[2;7m", 6);
+    }
     
     char status[80];
     char rstatus[80];
-    int len = snprintf(status, sizeof(status), " %.20s - %d lines %s",
-        E.filename ? E.filename : "[No Name]",
-        count_rows(),
-        E.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%d,%d ", E.cy + 1, E.cx + 1);
+    char which[24] = "";
+    if (documents.count > 1) {
+        snprintf(which, sizeof(which), "[%d/%d] ", doclist_index(&documents, d) + 1, documents.count);
+    }
+    int len = snprintf(status, sizeof(status), " %s%.20s - %d lines %s",
+        which, editorDocName(d),
+        gap_line_count(&d->g),
+        d->dirty ? "(modified)" : "");
     
-    if (len > E.screencols) len = E.screencols;
+    char matches[64] = "";
+    int complete;
+    int nmatches = search_index_count(&d->search_index, &complete);
+    if (nmatches > 0 || complete) {
+        char total[24];
+        formatCount(total, sizeof(total), nmatches);
+        int ord = search_index_ordinal(&d->search_index, rowcol_to_pos(&d->g, w->cy, w->cx));
+        if (ord > 0) {
+            char cur[24];
+            formatCount(cur, sizeof(cur), ord);
+            snprintf(matches, sizeof(matches), "match %s of %s%s | ", cur, total, complete ? "" : "+");
+        } else {
+            snprintf(matches, sizeof(matches), "%s matches%s | ", total, complete ? "" : "+");
+        }
+    }
+    if (w == E.win) {
+        E.search_drawn_count = nmatches;
+        E.search_drawn_complete = complete;
+    }
+    int rlen = snprintf(rstatus, sizeof(rstatus), "%s%d,%d ", matches, w->cy + 1, w->cx + 1);
+    
+    if (len > w->cols) len = w->cols;
     abufAppend(status, len);
     
-    while (len < E.screencols) {
-        if (E.screencols - len == rlen) {
+    while (len < w->cols) {
+        if (w->cols - len == rlen) {
             abufAppend(rstatus, rlen);
+            len += rlen;
             break;
         } else {
             abufAppend(" ", 1);
@@ -210,8 +484,13 @@ void editorDrawStatusBar(void) {
     }
     
     abufAppend("\x1b[m", 3);
-    abufAppend("\r\n", 2);
-    
+    editorEndRow(w, row, start, len);
+}
+
+void editorDrawMessageBar(void) {
+    char buf[16];
+    int l = snprintf(buf, sizeof(buf), "\x1b[%d;1H", E.screenrows);
+    abufAppend(buf, l);
     abufAppend("\x1b[K", 3);
     int msglen = strlen(E.statusmsg);
     if (msglen > E.screencols) msglen = E.screencols;
@@ -249,7 +528,21 @@ const char* welcome_lines[] = {
     "  |  ================          ================                      |",
     "  |  Ctrl-S ......... Save     Ctrl-Z ......... Undo                |",
     "  |  Ctrl-Q ......... Quit     Ctrl-Y ......... Redo                |",
-    "  |  ./editor file .. Open     Ctrl-F ......... Find (soon!)        |",
+    "  |  ./editor file .. Open     Ctrl-F ......... Find                |",
+    "  |                            Ctrl-R ......... Replace all         |",
+    "  |                            Ctrl-G ......... Grep files          |",
+    "  |                            Ctrl-T ......... Frame timings       |",
+    "  |                            Ctrl-E ......... Memory use          |",
+    "  |                            Ctrl-D ......... Cursor at next word |",
+    "  |                            Ctrl-L ......... Cursor on next line |",
+    "  |                            Ctrl-U ......... Block selection     |",
+    "  |                                                                  |",
+    "  |  BUFFERS                                                         |",
+    "  |  =======                                                         |",
+    "  |  Ctrl-O ......... Open     Ctrl-N/Ctrl-P .. Next/previous       |",
+    "  |  Ctrl-B ......... List     Ctrl-W ......... Close               |",
+    "  |  Ctrl-K s/v ..... Split    Ctrl-K o/q ..... Other/close pane    |",
+    "  |  Ctrl-K w ....... Wrap                                          |",
     "  |                                                                  |",
     "  |  FEATURES                                                        |",
     "  |  ========                                                        |",
@@ -352,133 +645,645 @@ void drawWelcomeScreen(void) {
 }
 
 /* -------- screen refresh -------- */
+/* Width of a pane's line numbers, without the space after them */
+static int editorNumWidth(struct window *w) {
+    return snprintf(NULL, 0, "%d", gap_line_count(&w->doc->g)) + 1;
+}
+
+/* Columns a wrapping pane breaks lines at; one stays free for the cursor
+ * at the end of a full row */
+static int editorWrapWidth(struct window *w) {
+    return w->cols - editorNumWidth(w) - 2;
+}
+
+/* Layout of line row in a wrapping pane */
+static const struct wrapLine *editorWrapLine(struct window *w, int row) {
+    struct gapbuf *g = &w->doc->g;
+    int start = gap_line_start(g, row);
+    return wrap_line(&w->doc->wrap, start, gap_line_end(g, row) - start, editorWrapWidth(w));
+}
+
+/* With soft wrap the top of the pane is a line and a visual row in it.
+ * Only the rows between the top and the cursor are laid out, so a long
+ * file costs no more than a short one. */
+static void editorScrollWrapped(int rows) {
+    E.coloff = 0;
+    const struct wrapLine *wl = editorWrapLine(E.win, E.rowoff);
+    if (E.rowsub >= wl->rows) E.rowsub = wl->rows - 1;
+
+    int sub = wrap_row_of(editorWrapLine(E.win, E.cy), E.cx);
+    if (E.cy < E.rowoff || (E.cy == E.rowoff && sub < E.rowsub)) {
+        E.rowoff = E.cy;
+        E.rowsub = sub;
+        return;
+    }
+
+    /* back from the cursor to the lowest top that still shows it, unless
+     * the top is passed on the way */
+    int r = E.cy, s = sub;
+    for (int n = rows - 1; n > 0; n--) {
+        if (r == E.rowoff && s == E.rowsub) return;
+        if (s > 0) {
+            s--;
+        } else if (r > 0) {
+            r--;
+            s = editorWrapLine(E.win, r)->rows - 1;
+        } else {
+            return;
+        }
+    }
+    E.rowoff = r;
+    E.rowsub = s;
+}
+
 void editorScroll(void) {
+    int rows = editorTextRows();
+    if (E.win->wrap) {
+        editorScrollWrapped(rows);
+        return;
+    }
     if (E.cy < E.rowoff) {
         E.rowoff = E.cy;
     }
-    if (E.cy >= E.rowoff + E.screenrows - 2) {
-        E.rowoff = E.cy - E.screenrows + 3;
+    if (E.cy >= E.rowoff + rows) {
+        E.rowoff = E.cy - rows + 1;
     }
     
-    if (E.cx < E.coloff) {
-        E.coloff = E.cx;
+    int rx = editorCxToRx(E.cy, E.cx);
+    if (rx < E.coloff) {
+        E.coloff = rx;
     }
-    if (E.cx >= E.coloff + E.screencols - 5) {
-        E.coloff = E.cx - E.screencols + 6;
+    if (rx >= E.coloff + E.win->cols - 5) {
+        E.coloff = rx - E.win->cols + 6;
     }
 }
 
-void editorRefreshScreen(void) {
-    if (E.show_welcome) {
-        drawWelcomeScreen();
+/* One character at the cursor: tabs as spaces, what the terminal should
+ * not be sent as '?', and a wide character the pane edge cuts as spaces */
+static void editorDrawChar(const char *s, int bytes, int width, int shown) {
+    if (shown < width || *s == '\t') {
+        for (int k = 0; k < shown; k++) abufAppend(" ", 1);
+    } else if (utf8_printable(s, bytes)) {
+        abufAppend(s, bytes);
+    } else {
+        abufAppend("?", 1);
+    }
+}
+
+/* Where a screen row of a pane starts in its line, and how far it may go:
+ * a wrapped row ends where the next one starts, an unwrapped row at the
+ * character under the right edge. Long lines jump to the left edge
+ * through their column map instead of being walked from the start. */
+static void editorRowSpan(struct window *w, const struct wrapLine *wl, int sub, int line, int len,
+                          int text_cols, int *from, int *to, int *vcol) {
+    if (w->wrap) {
+        *from = wl->starts[sub];
+        *to = sub + 1 < wl->rows ? wl->starts[sub + 1] : len;
+        *vcol = 0;
         return;
     }
+    struct colMap *cm = &w->doc->cols;
+    *from = colmap_pos(cm, line, len, w->coloff);
+    *vcol = colmap_col(cm, line, len, *from);
+    /* the character cut by the right edge is drawn in part, so all of it is read */
+    int right = colmap_pos(cm, line, len, w->coloff + text_cols) + 4;
+    *to = right < len ? right : len;
+}
+
+/* Draw a pane from its document; returns the width of its line numbers */
+static int editorDrawPane(struct window *w) {
+    struct gapbuf *g = &w->doc->g;
+    int text_rows = w->rows - 1;
+    int lines = gap_line_count(g);
+    int num_width = editorNumWidth(w);
+    int text_cols = w->cols - num_width - 1;
+    int left_col = w->wrap ? 0 : w->coloff;     /* screen column at the left edge */
     
-    editorScroll();
+    int row = w->rowoff, sub = 0;   /* line and visual row in it being drawn */
+    const struct wrapLine *wl = NULL;
+    if (w->wrap) {
+        wl = editorWrapLine(w, row);
+        if (w->rowsub >= wl->rows) w->rowsub = wl->rows - 1;
+        sub = w->rowsub;
+    }
     
-    abuf_len = 0;
-    abufAppend("\x1b[?25l", 6);
-    abufAppend("\x1b[H", 3);
-
-    char tmp[65536];
-    int len = gap_get(&g, tmp, sizeof(tmp));
+    /* Matches come from the search index, the text is never rescanned.
+     * A row reads at most a few bytes a column. */
+    int hit_cap = 4 * w->cols + 16;
+    int *hits = malloc(2 * hit_cap * sizeof(int));
+    int *hit_lens = hits + hit_cap;
+    int match_end = 0;
     
-    int row = 0, col = 0;
-    int screen_row = 0;
+    /* extra cursors only show in the pane that has them */
+    int ncursors = w == E.win ? E.cursors.count : 0;
     
-    int num_width = snprintf(NULL, 0, "%d", count_rows()) + 1;
+    /* the selection is put in order once and turned into a column range
+     * per row, and reverse video is switched only where a run starts or
+     * ends */
+    struct selectionBounds sb;
+    selection_bounds(&w->sel, &sb);
     
     char linenum[16];
-    int ln_len = snprintf(linenum, sizeof(linenum), "%*d ", num_width, row + 1);
-    abufAppend("\x1b[36m", 5);
-    abufAppend(linenum, ln_len);
-    abufAppend("\x1b[0m", 4);
-    
-    enum editorHighlight prev_hl = HL_NORMAL;
+    int screen_row = 0;
     
-    for (int i = 0; i < len && screen_row < E.screenrows - 2; i++) {
-        if (row < E.rowoff) {
-            if (tmp[i] == '\n') row++;
-            continue;
+    for (; screen_row < text_rows && row < lines; screen_row++) {
+        /* Only the bytes that can show on the row are looked at. They are
+         * read in place unless they straddle the gap, so panes on the same
+         * document draw from the same text. */
+        double t = trace_now();
+        int line = gap_line_start(g, row);
+        int line_len = gap_line_end(g, row) - line;
+        if (w->wrap && sub == 0) wl = editorWrapLine(w, row);
+        int from, to, vcol;
+        editorRowSpan(w, wl, sub, line, line_len, text_cols, &from, &to, &vcol);
+        int len = to - from;
+        int avail;
+        const char *tmp = gap_span(g, line + from, &avail);
+        char *copy = NULL;
+        if (avail < len) {
+            copy = malloc(len);
+            gap_get_range(g, line + from, len, copy);
+            tmp = copy;
         }
+        trace_accum(&E.trace, SPAN_LINE_LOOKUP, t);
         
-        if (tmp[i] == '\n') {
-            abufAppend("\x1b[K\r\n", 5);
-            row++;
-            col = 0;
-            screen_row++;
-            
-            if (screen_row < E.screenrows - 2) {
-                ln_len = snprintf(linenum, sizeof(linenum), "%*d ", num_width, row + 1);
-                abufAppend("\x1b[36m", 5);
-                abufAppend(linenum, ln_len);
-                abufAppend("\x1b[0m", 4);
+        int nhits = search_index_collect(&w->doc->search_index, line + from, line + to,
+                                         hits, hit_lens, hit_cap);
+        int hit = 0, match_drawn = 0;
+        int cursor = ncursors ? cursors_find(&E.cursors, line + from) : 0;
+        int sel_from, sel_to, rev_drawn = 0;
+        selection_row(&sb, row, &sel_from, &sel_to);
+        /* a block is in screen columns of the whole line, and wrapped rows
+         * count theirs from where they start */
+        int sel_vcol = sb.block && w->wrap && sel_from < sel_to ?
+                       colmap_col(&w->doc->cols, line, line_len, from) : 0;
+        
+        int row_start = editorBeginRow(w, screen_row);
+        int ln_len = sub > 0 ? snprintf(linenum, sizeof(linenum), "%*s ", num_width, "")
+                             : snprintf(linenum, sizeof(linenum), "%*d ", num_width, row + 1);
+        if (ln_len > w->cols) ln_len = w->cols;
+        abufAppend("\x1b[36m", 5);
+        abufAppend(linenum, ln_len);
+        abufAppend("\x1b[0m", 4);
+        int drawn = ln_len;
+        int prev_hl = HL_NORMAL;
+        
+        int i = 0;
+        while (i < len && vcol < left_col + text_cols) {
+            int pos = line + from + i, col = from + i;
+            while (cursor < ncursors && E.cursors.pos[cursor] < pos) cursor++;
+            int at_cursor = cursor < ncursors && E.cursors.pos[cursor] == pos;
+            while (hit < nhits && hits[hit] <= pos) {
+                if (hits[hit] + hit_lens[hit] > match_end) match_end = hits[hit] + hit_lens[hit];
+                hit++;
             }
-        } else {
-            if (col >= E.coloff && col < E.coloff + E.screencols - num_width - 1) {
-                if (selection_contains(&E.sel, row, col)) {
-                    abufAppend("\x1b[7m", 4);
-                    abufAppend(&tmp[i], 1);
-                    abufAppend("\x1b[27m", 5);
-                } else {
-                    enum editorHighlight hl = get_highlight(tmp, len, i, E.filename);
-                    if (hl != prev_hl) {
+            
+            int bytes, width = utf8_char_cols(tmp + i, len - i, vcol, &bytes);
+            if (vcol + width > left_col) {
+                int in_match = pos < match_end;
+                if (in_match != match_drawn) {
+                    abufAppend(in_match ? "\x1b[43m" : "\x1b[49m", 5);
+                    match_drawn = in_match;
+                }
+                int at = sb.block ? sel_vcol + vcol : col;
+                int rev = at_cursor || (at >= sel_from && at < sel_to);
+                if (rev != rev_drawn) {
+                    abufAppend(rev ? "\x1b[7m" : "\x1b[27m", rev ? 4 : 5);
+                    rev_drawn = rev;
+                }
+                if (!rev) {
+                    if (E.trace.enabled) t = trace_now();
+                    enum editorHighlight hl = get_highlight(tmp, len, i, w->doc->filename);
+                    trace_accum(&E.trace, SPAN_HIGHLIGHT, t);
+                    if ((int)hl != prev_hl) {
                         abufAppend(highlight_to_color(hl), 5);
                         prev_hl = hl;
                     }
-                    abufAppend(&tmp[i], 1);
                 }
+                int shown_from = vcol > left_col ? vcol : left_col;
+                int shown_to = vcol + width < left_col + text_cols ? vcol + width
+                                                                   : left_col + text_cols;
+                editorDrawChar(&tmp[i], bytes, width, shown_to - shown_from);
+                drawn += shown_to - shown_from;
             }
-            col++;
+            vcol += width;
+            i += bytes;
+        }
+        
+        /* an extra cursor at the end of the line shows as a block */
+        int line_end = from + i == line_len && (!w->wrap || sub + 1 == wl->rows);
+        while (cursor < ncursors && E.cursors.pos[cursor] < line + line_len) cursor++;
+        if (line_end && cursor < ncursors && E.cursors.pos[cursor] == line + line_len &&
+            vcol >= left_col && vcol < left_col + text_cols) {
+            abufAppend("\x1b[0m\x1b[7m \x1b[27m", 14);
+            drawn++;
+        }
+        abufAppend("\x1b[0m", 4);
+        editorEndRow(w, screen_row, row_start, drawn);
+        free(copy);
+        
+        if (w->wrap && sub + 1 < wl->rows) {
+            sub++;
+        } else {
+            row++;
+            sub = 0;
         }
     }
+    free(hits);
     
-    abufAppend("\x1b[0m", 4);
-    
-    while (screen_row < E.screenrows - 2) {
+    while (screen_row < text_rows) {
+        int row_start = editorBeginRow(w, screen_row);
         abufAppend("~", 1);
-        abufAppend("\x1b[K\r\n", 5);
+        editorEndRow(w, screen_row, row_start, 1);
         screen_row++;
     }
     
-    editorDrawStatusBar();
+    editorDrawStatusBar(w);
+    return num_width;
+}
+
+/* Draw every pane under w, and the separators when repainting from
+ * scratch; returns the line number width of the focused pane */
+static int editorDrawWindows(struct window *w) {
+    if (!w->child[0]) {
+        int num_width = editorDrawPane(w);
+        return w == E.win ? num_width : 0;
+    }
+    int num_width = editorDrawWindows(w->child[0]) + editorDrawWindows(w->child[1]);
+    if (w->vertical && E.full_redraw) {
+        char buf[24];
+        for (int r = 0; r < w->rows; r++) {
+            int l = snprintf(buf, sizeof(buf), "\x1b[%d;%dH|", w->top + r + 1,
+                             w->child[1]->left);
+            abufAppend(buf, l);
+        }
+    }
+    return num_width;
+}
+
+/* Put the focused view back into its pane so every pane draws alike */
+static void editorSaveView(void) {
+    E.win->cx = E.cx;
+    E.win->cy = E.cy;
+    E.win->rowoff = E.rowoff;
+    E.win->coloff = E.coloff;
+    E.win->rowsub = E.rowsub;
+    E.win->sel = E.sel;
+}
+
+/* Frame timings and memory over the top right corner of the screen */
+static void editorDrawTraceOverlay(void) {
+    double p50, p99, bytes;
+    int frames = trace_stats(&E.trace, &p50, &p99, &bytes);
+    long long mem = 0;
+    for (int i = 0; i < documents.count; i++) mem += document_memory(documents.docs[i]);
+    
+    char text[128], pos[24];
+    int len = snprintf(text, sizeof(text), " %d frames  p50 %.2f ms  p99 %.2f ms  %.1f KB/frame  "
+                       "buffers %.1f MB ", frames, p50 * 1e3, p99 * 1e3, bytes / 1024.0,
+                       mem / (1024.0 * 1024.0));
+    if (len > E.screencols) len = E.screencols;
+    int l = snprintf(pos, sizeof(pos), "\x1b[1;%dH\x1b[7m", E.screencols - len + 1);
+    abufAppend(pos, l);
+    abufAppend(text, len);
+    abufAppend("\x1b[m", 3);
+}
+
+void editorToggleTraceOverlay(void) {
+    E.show_trace = !E.show_trace;
+    E.trace.enabled = E.show_trace || E.trace_path;
+    editorInvalidateScreen();
+}
+
+/* -------- file viewer -------- */
+/* One line of the viewer, the columns from coloff on that fit in cols;
+ * returns the columns drawn */
+static int editorDrawViewLine(const char *s, int len, int cols) {
+    /* plain text is passed over to the left edge in one step */
+    int i = utf8_plain_run(s, len < E.coloff ? len : E.coloff);
+    int vcol = i, drawn = 0;
+    while (i < len && vcol < E.coloff + cols) {
+        int bytes, width = utf8_char_cols(s + i, len - i, vcol, &bytes);
+        if (vcol + width > E.coloff) {
+            int from = vcol > E.coloff ? vcol : E.coloff;
+            int to = vcol + width < E.coloff + cols ? vcol + width : E.coloff + cols;
+            editorDrawChar(s + i, bytes, width, to - from);
+            drawn += to - from;
+        }
+        vcol += width;
+        i += bytes;
+    }
+    return drawn;
+}
+
+/* The viewer's status line: how far the line count has got, and where
+ * the top of the screen is in the file */
+static void editorDrawViewStatus(struct window *w) {
+    struct fileView *v = E.view;
+    int row = w->rows - 1;
+    int start = editorBeginRow(w, row);
+    abufAppend("\x1b[7m", 4);
+    
+    long long lines, bytes;
+    view_progress(v, &lines, &bytes);
+    E.view_drawn = bytes;
+    char count[32], status[96], rstatus[64];
+    int len;
+    if (bytes == v->size) {
+        if (v->size > 0 && v->data[v->size - 1] != '\n') lines++;
+        formatCount(count, sizeof(count), lines);
+        len = snprintf(status, sizeof(status), " %.20s - %s lines (read-only) ",
+                       E.view_path, count);
+    } else {
+        formatCount(count, sizeof(count), lines);
+        len = snprintf(status, sizeof(status), " %.20s - %s+ lines (counting %d%%) ",
+                       E.view_path, count, (int)(bytes * 100 / v->size));
+    }
+    
+    int pct = v->size ? (int)(E.view_top * 100 / v->size) : 100;
+    long long line = view_line_of(v, E.view_top);
+    int rlen;
+    if (line >= 0) {
+        formatCount(count, sizeof(count), line + 1);
+        rlen = snprintf(rstatus, sizeof(rstatus), "line %s  %d%% ", count, pct);
+    } else {
+        rlen = snprintf(rstatus, sizeof(rstatus), "%d%% ", pct);
+    }
+    
+    if (len > w->cols) len = w->cols;
+    abufAppend(status, len);
+    while (len < w->cols) {
+        if (w->cols - len == rlen) {
+            abufAppend(rstatus, rlen);
+            len += rlen;
+            break;
+        } else {
+            abufAppend(" ", 1);
+            len++;
+        }
+    }
+    
+    abufAppend("\x1b[m", 3);
+    editorEndRow(w, row, start, len);
+}
+
+/* editor --view draws straight from the mapped file, a line at a time
+ * from the top; no document is made of it */
+static void editorDrawView(void) {
+    struct fileView *v = E.view;
+    struct window *w = E.win;
+    double t = trace_now();
+    abuf_len = 0;
+    abufAppend("\x1b[?25l", 6);
+    if (E.full_redraw) abufAppend("\x1b[2J", 4);
+    
+    long long pos = E.view_top;
+    for (int row = 0; row < w->rows - 1; row++) {
+        int start = editorBeginRow(w, row);
+        int drawn = 1;
+        if (pos < v->size) {
+            long long next = view_line_next(v, pos);
+            int len = next - pos;
+            if (v->data[next - 1] == '\n') len--;
+            drawn = editorDrawViewLine(v->data + pos, len, w->cols);
+            pos = next;
+        } else {
+            abufAppend("~", 1);
+        }
+        editorEndRow(w, row, start, drawn);
+    }
+    editorDrawViewStatus(w);
+    editorDrawMessageBar();
+    E.full_redraw = 0;
+    
+    /* the cursor waits at the end of the message bar, for prompts */
+    char buf[32];
+    int msglen = strlen(E.statusmsg);
+    int l = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.screenrows,
+                     (msglen < E.screencols ? msglen : E.screencols - 1) + 1);
+    abufAppend(buf, l);
+    abufAppend("\x1b[?25h", 6);
+    trace_span(&E.trace, SPAN_RENDER, t);
+    abufFlush();
+}
+
+/* -------- memory -------- */
+static int stats_at_exit = 0;   /* --stats */
+
+/* Bytes allocated to gaps rather than text, over all documents */
+static long long editorGapSlack(void) {
+    long long slack = 0;
+    for (int i = 0; i < documents.count; i++) {
+        struct gapbuf *g = &documents.docs[i]->g;
+        slack += g->gap_end - g->gap_start;
+    }
+    return slack;
+}
+
+/* n bytes in at most five characters: 512, 36K, 3.2M, 1.0G */
+static void editorFormatBytes(char *buf, int size, long long n) {
+    if (n < 1024) snprintf(buf, size, "%lld", n);
+    else if (n < 1024 * 1024) snprintf(buf, size, "%lldK", n / 1024);
+    else if (n < 1024LL * 1024 * 1024) snprintf(buf, size, "%.1fM", n / (1024.0 * 1024.0));
+    else snprintf(buf, size, "%.1fG", n / (1024.0 * 1024.0 * 1024.0));
+}
+
+/* What each subsystem holds now, on the status line */
+void editorMemoryStatus(void) {
+    static const char *labels[MEM_KINDS] = { "buf", "hist", "clip", "idx", "screen" };
+    char num[16];
+    int len = snprintf(E.statusmsg, sizeof(E.statusmsg), "mem:");
+    for (int k = 0; k < MEM_KINDS && len < (int)sizeof(E.statusmsg); k++) {
+        struct memStats st;
+        mem_stats(k, &st);
+        editorFormatBytes(num, sizeof(num), st.bytes);
+        len += snprintf(E.statusmsg + len, sizeof(E.statusmsg) - len, " %s %s", labels[k], num);
+        if (k == MEM_BUFFER && len < (int)sizeof(E.statusmsg)) {
+            editorFormatBytes(num, sizeof(num), editorGapSlack());
+            len += snprintf(E.statusmsg + len, sizeof(E.statusmsg) - len, " (gap %s)", num);
+        }
+    }
+}
+
+/* The --stats table, written to stderr once the editor is done */
+static void editorDumpStats(void) {
+    fflush(stdout);
+    fprintf(stderr, "%-10s %14s %14s %10s\n", "memory", "bytes", "peak", "allocs");
+    for (int k = 0; k < MEM_KINDS; k++) {
+        struct memStats st;
+        mem_stats(k, &st);
+        fprintf(stderr, "%-10s %14lld %14lld %10lld\n", mem_name(k), st.bytes, st.peak, st.allocs);
+    }
+    fprintf(stderr, "%-10s %14lld\n", "gap", editorGapSlack());
+}
+
+void editorRefreshScreen(void) {
+    if (E.view) {
+        editorDrawView();
+        trace_frame_end(&E.trace, E.bytes_out);
+        return;
+    }
+    editorSyncGeneration();
+    if (E.show_welcome) {
+        drawWelcomeScreen();
+        trace_frame_end(&E.trace, E.bytes_out);
+        return;
+    }
+    
+    double t = trace_now();
+    editorScroll();
+    editorSaveView();
+    
+    abuf_len = 0;
+    abufAppend("\x1b[?25l", 6);
+    if (E.full_redraw) abufAppend("\x1b[2J", 4);
+    
+    int num_width = editorDrawWindows(E.windows);
+    editorDrawMessageBar();
+    if (E.show_trace) editorDrawTraceOverlay();
+    E.full_redraw = 0;
+    
+    int y = E.cy - E.rowoff, x;
+    if (E.win->wrap) {
+        const struct wrapLine *wl = editorWrapLine(E.win, E.cy);
+        int sub = wrap_row_of(wl, E.cx);
+        int line = gap_line_start(&E.doc->g, E.cy);
+        x = colmap_cols(&E.doc->g, line + wl->starts[sub], line + E.cx);
+        y = sub - E.rowsub;
+        for (int r = E.rowoff; r < E.cy; r++) y += editorWrapLine(E.win, r)->rows;
+    } else {
+        x = editorCxToRx(E.cy, E.cx) - E.coloff;
+    }
     
     char buf[32];
     int l = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", 
-                     (E.cy - E.rowoff) + 1, 
-                     (E.cx - E.coloff) + 1 + num_width + 1);
+                     E.win->top + y + 1, 
+                     E.win->left + x + 1 + num_width + 1);
     abufAppend(buf, l);
     abufAppend("\x1b[?25h", 6);
+    trace_span(&E.trace, SPAN_RENDER, t);
     
     abufFlush();
+    trace_frame_end(&E.trace, E.bytes_out);
+}
+
+int editorGrepPoll(void);
+
+/* Whether something running in the background changed what is on screen */
+int editorIdleChanged(void) {
+    if (E.view) {
+        long long lines, bytes;
+        view_progress(E.view, &lines, &bytes);
+        return bytes != E.view_drawn;
+    }
+    if (editorGrepPoll()) return 1;
+    if (E.drawn_generation != edit_generation) return 1;
+    int complete;
+    int count = search_index_count(&E.doc->search_index, &complete);
+    return count != E.search_drawn_count || complete != E.search_drawn_complete;
+}
+
+/* Nothing to do until the next key: give back gaps that deletes left
+ * larger than the max, in every document */
+static void editorIdleTrim(void) {
+    for (int i = 0; i < documents.count; i++) gap_trim(&documents.docs[i]->g);
 }
 
 /* -------- input -------- */
+static __thread char inbuf[MSG_INPUT_MAX + 1];
+static __thread int inbuf_len = 0;
+static __thread int inbuf_pos = 0;
+
+/* Wait up to the read timeout for input with editor_lock released, so
+ * other sessions get their turn. Returns the bytes read, or 0. */
+static int editorReadInput(char *buf, int cap) {
+    int nread = 0;
+    pthread_mutex_unlock(&editor_lock);
+    if (E.replay) {
+        nread = E.replay_len - E.replay_pos < cap ? E.replay_len - E.replay_pos : cap;
+        memcpy(buf, E.replay + E.replay_pos, nread);
+        E.replay_pos += nread;
+        if (nread == 0) E.quit = 1;
+    } else if (!E.remote) {
+        nread = read(E.in_fd, buf, cap);
+        if (nread == -1 && errno != EAGAIN && errno != EINTR) exit(1);
+    } else {
+        struct pollfd pfd = { E.in_fd, POLLIN, 0 };
+        char type;
+        if (poll(&pfd, 1, 100) > 0) {
+            nread = msg_recv(E.in_fd, &type, buf, cap);
+            if (nread == -1) {
+                E.quit = 1;     /* the client went away */
+            } else if (type == MSG_RESIZE) {
+                sscanf(buf, "%d %d", &E.term_rows, &E.term_cols);
+                E.resize_pending = 1;
+                nread = 0;
+            } else if (type != MSG_INPUT) {
+                nread = 0;
+            }
+        }
+    }
+    pthread_mutex_lock(&editor_lock);
+    return nread;
+}
+
+/* Read one byte, returns 0 if nothing arrived before the read timeout */
+int editorReadByte(char *c) {
+    if (inbuf_pos == inbuf_len) {
+        int nread = E.quit ? 0 : editorReadInput(inbuf, sizeof(inbuf));
+        if (nread <= 0) return 0;
+        inbuf_len = nread;
+        inbuf_pos = 0;
+    }
+    *c = inbuf[inbuf_pos++];
+    return 1;
+}
+
+/* The rest of the UTF-8 character that starts with lead, as far as it
+ * has arrived; only continuation bytes are taken. Returns its length. */
+static int editorReadUtf8(int lead, char *ch) {
+    int n = 0;
+    ch[n++] = lead;
+    while (n < 4 && inbuf_pos < inbuf_len && utf8_is_cont(inbuf[inbuf_pos])) {
+        ch[n++] = inbuf[inbuf_pos++];
+    }
+    return n;
+}
+
 int editorReadKey(void) {
-    int nread;
     char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) exit(1);
+    while (!editorReadByte(&c)) {
+        if (E.quit) return '\x1b';     /* backs out of any prompt */
+        editorIdleTrim();
+        if (winch_pending || E.resize_pending) return RESIZE_EVENT;
+        if (editorIdleChanged()) return REFRESH_EVENT;
     }
     
     if (c == '\x1b') {
         char seq[3];
         
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+        if (!editorReadByte(&seq[0])) return '\x1b';
+        if (!editorReadByte(&seq[1])) return '\x1b';
         
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+                int param = seq[1] - '0';
+                if (!editorReadByte(&seq[2])) return '\x1b';
+                while (seq[2] >= '0' && seq[2] <= '9' && param < 1000) {
+                    param = param * 10 + (seq[2] - '0');
+                    if (!editorReadByte(&seq[2])) return '\x1b';
+                }
                 if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
+                    switch (param) {
+                        case 1: return HOME_KEY;
+                        case 3: return DEL_KEY;
+                        case 4: return END_KEY;
+                        case 5: return PAGE_UP;
+                        case 6: return PAGE_DOWN;
+                        case 7: return HOME_KEY;
+                        case 8: return END_KEY;
+                        case 200: return PASTE_START;
+                        case 201: return PASTE_END;
                     }
                 }
                 else if (seq[2] == 'A') return ARROW_UP | 0x1000;
@@ -505,25 +1310,81 @@ int editorReadKey(void) {
         return '\x1b';
     }
     
-    return c;
-}
-
-int is_shift_arrow(int key) {
-    return key & 0x1000;
-}
-
-int get_base_key(int key) {
-    return key & 0xFFF;
+    return (unsigned char)c;
+}
+
+/* Collect a bracketed paste payload up to the ESC[201~ terminator.
+ * Carriage returns are turned into newlines. Returns a malloc'd buffer. */
+char *editorReadPaste(int *outlen) {
+    static const char term[] = "\x1b[201~";
+    int cap = 4096, len = 0, matched = 0, idle = 0, prev_cr = 0;
+    char *buf = malloc(cap);
+    char c;
+    
+    while (term[matched] != '\0') {
+        if (!editorReadByte(&c)) {
+            if (++idle > 10) break;
+            continue;
+        }
+        idle = 0;
+        if (c == term[matched]) {
+            matched++;
+            continue;
+        }
+        if (len + matched + 1 > cap) {
+            cap = cap * 2 + matched + 1;
+            buf = realloc(buf, cap);
+        }
+        if (matched) {
+            memcpy(buf + len, term, matched);
+            len += matched;
+            matched = 0;
+            prev_cr = 0;
+            if (c == term[0]) {
+                matched = 1;
+                continue;
+            }
+        }
+        if (c == '\n' && prev_cr) {
+            prev_cr = 0;
+            continue;
+        }
+        prev_cr = (c == '\r');
+        buf[len++] = prev_cr ? '\n' : c;
+    }
+    
+    *outlen = len;
+    return buf;
+}
+
+int is_shift_arrow(int key) {
+    return key & 0x1000;
+}
+
+int get_base_key(int key) {
+    return key & 0xFFF;
+}
+
+/* -------- cursor movement -------- */
+/* Put the cursor on row, as near the goal column as the line allows.
+ * Rows and their lengths come from the line index, so a move costs the
+ * same anywhere in the file. */
+static void editorMoveToRow(int row) {
+    int total_rows = count_rows();
+    if (row > total_rows - 1) row = total_rows - 1;
+    if (row < 0) row = 0;
+    if (E.goal_col < 0) E.goal_col = editorCxToRx(E.cy, E.cx);
+    E.cy = row;
+    E.cx = editorRxToCx(row, E.goal_col);
 }
 
-/* -------- cursor movement -------- */
 void editorMoveCursor(int key) {
     int total_rows = count_rows();
     
     switch (key) {
         case ARROW_LEFT:
             if (E.cx > 0) {
-                E.cx--;
+                E.cx = editorPrevCx(E.cy, E.cx);
             } else if (E.cy > 0) {
                 E.cy--;
                 E.cx = get_line_length(E.cy);
@@ -533,7 +1394,7 @@ void editorMoveCursor(int key) {
         case ARROW_RIGHT: {
             int line_len = get_line_length(E.cy);
             if (E.cx < line_len) {
-                E.cx++;
+                E.cx = editorNextCx(E.cy, E.cx);
             } else if (E.cy < total_rows - 1) {
                 E.cy++;
                 E.cx = 0;
@@ -542,19 +1403,11 @@ void editorMoveCursor(int key) {
         }
         
         case ARROW_UP:
-            if (E.cy > 0) {
-                E.cy--;
-                int line_len = get_line_length(E.cy);
-                if (E.cx > line_len) E.cx = line_len;
-            }
+            editorMoveToRow(E.cy - 1);
             break;
             
         case ARROW_DOWN:
-            if (E.cy < total_rows - 1) {
-                E.cy++;
-                int line_len = get_line_length(E.cy);
-                if (E.cx > line_len) E.cx = line_len;
-            }
+            editorMoveToRow(E.cy + 1);
             break;
             
         case HOME_KEY:
@@ -566,91 +1419,1000 @@ void editorMoveCursor(int key) {
             break;
             
         case PAGE_UP:
-            E.cy = E.rowoff;
-            for (int i = 0; i < E.screenrows - 2; i++) {
-                if (E.cy > 0) E.cy--;
-            }
+            editorMoveToRow(E.rowoff - editorTextRows());
             break;
             
         case PAGE_DOWN:
-            E.cy = E.rowoff + E.screenrows - 2;
-            if (E.cy > total_rows - 1) E.cy = total_rows - 1;
-            for (int i = 0; i < E.screenrows - 2; i++) {
-                if (E.cy < total_rows - 1) E.cy++;
-            }
+            editorMoveToRow(E.rowoff + 2 * editorTextRows());
             break;
     }
 }
 
 /* -------- editor operations -------- */
 void editorInsertChar(char c) {
-    int pos = rowcol_to_pos(&g, E.cy, E.cx);
-    gap_move(&g, pos);
-    gap_insert(&g, c);
-    history_push(&E.history, EDIT_INSERT, pos, c);
+    int pos = editorCursorPos();
+    gap_move(&E.doc->g, pos);
+    gap_insert(&E.doc->g, c);
+    history_push(&E.doc->history, EDIT_INSERT, pos, c);
     E.cx++;
-    E.dirty = 1;
+    E.doc->dirty = 1;
+}
+
+/* Insert a run of text as one buffer operation and one undo record */
+void editorInsertText(const char *text, int len) {
+    if (len <= 0) return;
+    int pos = editorCursorPos();
+    gap_move(&E.doc->g, pos);
+    gap_insert_bytes(&E.doc->g, text, len);
+    history_push_text(&E.doc->history, EDIT_INSERT_TEXT, pos, text, len);
+    editorSetCursorPos(pos + len);
+    E.doc->dirty = 1;
+}
+
+/* Delete the selected text; the cursor goes where it was */
+void editorDeleteSelection(void) {
+    selection_delete(&E.sel, &E.doc->cols, &E.doc->history);
+    editorSetCursorPos(E.doc->g.gap_start);
+    E.doc->dirty = 1;
+}
+
+/* Put text in place of the selection, or at the cursor if there is none,
+ * as one edit and one undo record */
+static void editorReplaceSelection(const char *text, int len) {
+    if (E.sel.active && !E.sel.block) {
+        selection_replace(&E.sel, &E.doc->g, &E.doc->history, text, len);
+        editorSetCursorPos(E.doc->g.gap_start);
+        E.doc->dirty = 1;
+    } else {
+        if (E.sel.active) editorDeleteSelection();
+        editorInsertText(text, len);
+    }
+}
+
+void editorPaste(void) {
+    int len;
+    char *text = editorReadPaste(&len);
+    editorReplaceSelection(text, len);
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "Pasted %d bytes", len);
+    free(text);
 }
 
 void editorInsertNewline(void) {
-    int pos = rowcol_to_pos(&g, E.cy, E.cx);
-    gap_move(&g, pos);
-    gap_insert(&g, '\n');
-    history_push(&E.history, EDIT_INSERT_NEWLINE, pos, '\n');
+    int pos = editorCursorPos();
+    gap_move(&E.doc->g, pos);
+    gap_insert(&E.doc->g, '\n');
+    history_push(&E.doc->history, EDIT_INSERT_NEWLINE, pos, '\n');
     
     int prev_indent = get_line_indent(E.cy);
     E.cy++;
     E.cx = 0;
     
     for (int i = 0; i < prev_indent; i++) {
-        gap_insert(&g, ' ');
-        history_push(&E.history, EDIT_INSERT, pos + 1 + i, ' ');
+        gap_insert(&E.doc->g, ' ');
+        history_push(&E.doc->history, EDIT_INSERT, pos + 1 + i, ' ');
         E.cx++;
     }
     
-    E.dirty = 1;
+    E.doc->dirty = 1;
+}
+
+/* Delete the n-byte character at pos as one edit and one undo record */
+static void editorDelBytes(int pos, int n) {
+    char text[4];
+    gap_get_range(&E.doc->g, pos, n, text);
+    gap_move(&E.doc->g, pos);
+    gap_delete_bytes(&E.doc->g, n);
+    history_push_text(&E.doc->history, EDIT_DELETE_TEXT, pos, text, n);
+    E.doc->dirty = 1;
 }
 
 void editorDelChar(void) {
-    if (E.cx > 0) {
-        int pos = rowcol_to_pos(&g, E.cy, E.cx);
-        gap_move(&g, pos);
-        char ch = gap_char_at(&g, pos - 1);
-        if (gap_backspace(&g)) {
-            history_push(&E.history, EDIT_DELETE, pos - 1, ch);
+    int n = E.cx - editorPrevCx(E.cy, E.cx);
+    if (n > 1) {
+        E.cx -= n;
+        editorDelBytes(editorCursorPos(), n);
+    } else if (E.cx > 0) {
+        int pos = editorCursorPos();
+        gap_move(&E.doc->g, pos);
+        char ch = gap_char_at(&E.doc->g, pos - 1);
+        if (gap_backspace(&E.doc->g)) {
+            history_push(&E.doc->history, EDIT_DELETE, pos - 1, ch);
             E.cx--;
-            E.dirty = 1;
+            E.doc->dirty = 1;
         }
     } else if (E.cy > 0) {
-        int prev_line_len = get_line_length(E.cy - 1);
-        int pos = rowcol_to_pos(&g, E.cy, 0);
-        gap_move(&g, pos);
-        if (gap_backspace(&g)) {
-            history_push(&E.history, EDIT_DELETE_NEWLINE, pos - 1, '\n');
-            E.cy--;
-            E.cx = prev_line_len;
-            E.dirty = 1;
+        int pos = editorCursorPos();
+        gap_move(&E.doc->g, pos);
+        if (gap_backspace(&E.doc->g)) {
+            history_push(&E.doc->history, EDIT_DELETE_NEWLINE, pos - 1, '\n');
+            editorSetCursorPos(pos - 1);
+            E.doc->dirty = 1;
         }
     }
 }
 
-void editorProcessKeypress(void) {
-    int c = editorReadKey();
+/* -------- multiple cursors -------- */
+static int editorIsWordChar(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/* Replace the characters around the primary and every extra cursor with text,
+ * all in one edit; see cursors_edit */
+static void editorMultiEdit(int before, int after, const char *text, int len) {
+    int pos = editorCursorPos();
+    selection_clear(&E.sel);
+    cursors_edit(&E.cursors, &E.doc->g, &E.doc->history, &pos, before, after, text, len);
+    editorSetCursorPos(pos);
+    E.doc->dirty = 1;
+}
+
+static void editorCursorCount(void) {
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "%d cursors", E.cursors.count + 1);
+}
+
+/* Ctrl-D: a cursor at the next whole-word occurrence of the word under
+ * the primary cursor, as far into it as the primary cursor is */
+void editorAddCursorAtMatch(void) {
+    struct gapbuf *g = &E.doc->g;
+    int len = gap_length(g);
+    int pos = editorCursorPos();
+    int start = pos, end = pos;
+    while (start > 0 && editorIsWordChar(gap_char_at(g, start - 1))) start--;
+    while (end < len && editorIsWordChar(gap_char_at(g, end))) end++;
+    if (start == end) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "No word under the cursor");
+        return;
+    }
+    
+    int wlen = end - start, into = pos - start;
+    char *word = malloc(wlen);
+    gap_get_range(g, start, wlen, word);
+    struct searchPattern sp;
+    search_compile(&sp, word, wlen);
+    
+    /* search on from the occurrence of the furthest cursor, then wrap */
+    int last = E.cursors.count && E.cursors.pos[E.cursors.count - 1] > pos ?
+               E.cursors.pos[E.cursors.count - 1] : pos;
+    int from = last - into + 1, hit = -1;
+    for (int wrapped = 0; wrapped < 2 && hit < 0; wrapped++) {
+        for (hit = search_forward(g, &sp, from); hit >= 0; hit = search_forward(g, &sp, hit + 1)) {
+            int bounded = (hit == 0 || !editorIsWordChar(gap_char_at(g, hit - 1))) &&
+                          !editorIsWordChar(gap_char_at(g, hit + wlen));
+            if (bounded) break;
+        }
+        from = 0;
+    }
+    free(word);
+    
+    if (hit < 0 || hit == start || !cursors_add(&E.cursors, hit + into)) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "No more matches (%d cursors)",
+                 E.cursors.count + 1);
+        return;
+    }
+    editorCursorCount();
+}
+
+/* Ctrl-L: a cursor on the line below the lowest one, in the primary
+ * cursor's column or at the end of a shorter line */
+void editorAddCursorBelow(void) {
+    struct gapbuf *g = &E.doc->g;
+    int pos = editorCursorPos();
+    int last = E.cursors.count && E.cursors.pos[E.cursors.count - 1] > pos ?
+               E.cursors.pos[E.cursors.count - 1] : pos;
+    int row = gap_line_of(g, last) + 1;
+    if (row >= count_rows()) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "No line below");
+        return;
+    }
+    cursors_add(&E.cursors, gap_line_start(g, row) + editorRxToCx(row, editorCxToRx(E.cy, E.cx)));
+    editorCursorCount();
+}
+
+/* Keys while there are extra cursors: edits and moves apply at every
+ * cursor. Returns 0 for keys to handle as usual; those that would move
+ * the primary cursor elsewhere drop the extra ones first. */
+static int editorMultiKey(int key, int shift) {
+    enum cursorMove m;
+    switch (key) {
+        case '\x04':
+        case '\x0c':
+        case '\x05':
+        case '\x13':
+        case '\x14':
+        case '\x11':
+            return 0;
+        case '\r':
+            editorMultiEdit(0, 0, "\n", 1);
+            return 1;
+        case '\t':
+            editorMultiEdit(0, 0, "    ", TAB_STOP);
+            return 1;
+        case 127:
+        case '\x08':
+            editorMultiEdit(1, 0, NULL, 0);
+            return 1;
+        case DEL_KEY:
+            editorMultiEdit(0, 1, NULL, 0);
+            return 1;
+        case PASTE_START: {
+            int len;
+            char *text = editorReadPaste(&len);
+            editorMultiEdit(0, 0, text, len);
+            free(text);
+            return 1;
+        }
+        case ARROW_LEFT: m = CURSOR_LEFT; break;
+        case ARROW_RIGHT: m = CURSOR_RIGHT; break;
+        case ARROW_UP: m = CURSOR_UP; break;
+        case ARROW_DOWN: m = CURSOR_DOWN; break;
+        case HOME_KEY: m = CURSOR_HOME; break;
+        case END_KEY: m = CURSOR_END; break;
+        default:
+            if (key >= 32 && key < 127) {
+                char c = key;
+                editorMultiEdit(0, 0, &c, 1);
+                return 1;
+            } else if (key >= 0xC0 && key < 0x100) {
+                char ch[4];
+                editorMultiEdit(0, 0, ch, editorReadUtf8(key, ch));
+                return 1;
+            }
+            cursors_clear(&E.cursors);
+            return 0;
+    }
+    if (shift) {
+        cursors_clear(&E.cursors);
+        return 0;
+    }
+    selection_clear(&E.sel);
+    editorMoveCursor(key);
+    cursors_move(&E.cursors, &E.doc->cols, m);
+    cursors_remove(&E.cursors, editorCursorPos());
+    return 1;
+}
+
+/* -------- block selection -------- */
+/* Ctrl-U: turn the selection into a block or back, or start a block at
+ * the cursor */
+static void editorToggleBlock(void) {
+    if (!E.sel.active) {
+        selection_start(&E.sel, E.cy, E.cx);
+    } else if (E.sel.block) {
+        E.sel.start_col = editorRxToCx(E.sel.start_row, E.sel.start_col);
+        E.sel.end_col = editorRxToCx(E.sel.end_row, E.sel.end_col);
+        E.sel.block = 0;
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "Line selection");
+        return;
+    }
+    /* a block's corners are kept as screen columns */
+    E.sel.start_col = editorCxToRx(E.sel.start_row, E.sel.start_col);
+    E.sel.end_col = editorCxToRx(E.sel.end_row, E.sel.end_col);
+    E.sel.block = 1;
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "Block selection");
+}
+
+/* Move the end of the selection to the cursor */
+static void editorSelectToCursor(void) {
+    selection_update(&E.sel, E.cy, E.sel.block ? editorCxToRx(E.cy, E.cx) : E.cx);
+}
+
+/* Put the cursor on the character of row at screen column col */
+static void editorSetCursor(int row, int col) {
+    E.cy = row;
+    E.cx = editorRxToCx(row, col);
+}
+
+/* Edit every row of the block; see selection_block_edit */
+static void editorBlockEdit(int before, int after, const char *text, int len) {
+    selection_block_edit(&E.sel, &E.doc->cols, &E.doc->history, before, after, text, len);
+    editorSetCursor(E.sel.end_row, E.sel.end_col);
+    E.doc->dirty = 1;
+}
+
+/* Delete the block and put the cursor at its top left corner */
+static void editorBlockDelete(void) {
+    int top = E.sel.start_row < E.sel.end_row ? E.sel.start_row : E.sel.end_row;
+    int left = E.sel.start_col < E.sel.end_col ? E.sel.start_col : E.sel.end_col;
+    if (E.sel.start_col != E.sel.end_col) E.doc->dirty = 1;
+    selection_delete(&E.sel, &E.doc->cols, &E.doc->history);
+    editorSetCursor(top, left);
+}
+
+/* Keys while a block is selected: typing, Tab and deleting apply on
+ * every row it covers, and copies keep its rows apart. Returns 0 for
+ * keys to handle as usual. */
+static int editorBlockKey(int key) {
+    switch (key) {
+        case '\t':
+            editorBlockEdit(0, 0, "    ", TAB_STOP);
+            return 1;
+        case 127:
+        case '\x08':
+            editorBlockEdit(1, 0, NULL, 0);
+            return 1;
+        case DEL_KEY:
+            editorBlockEdit(0, 1, NULL, 0);
+            return 1;
+        case '\x03':
+            clipboard_copy(&E.clip, &E.sel, &E.doc->cols);
+            snprintf(E.statusmsg, sizeof(E.statusmsg), "Copied %d bytes as a block", E.clip.len);
+            selection_clear(&E.sel);
+            return 1;
+        case '\x18':
+            clipboard_copy(&E.clip, &E.sel, &E.doc->cols);
+            editorBlockDelete();
+            snprintf(E.statusmsg, sizeof(E.statusmsg), "Cut %d bytes as a block", E.clip.len);
+            return 1;
+        case '\x16':
+            editorBlockDelete();
+            return 0;
+        case '\r':
+            selection_clear(&E.sel);
+            return 0;
+        case PASTE_START: {
+            int len;
+            char *text = editorReadPaste(&len);
+            if (memchr(text, '\n', len)) {
+                editorBlockDelete();
+                editorInsertText(text, len);
+            } else {
+                editorBlockEdit(0, 0, text, len);
+            }
+            free(text);
+            return 1;
+        }
+        default:
+            if (key >= 32 && key < 127) {
+                char c = key;
+                editorBlockEdit(0, 0, &c, 1);
+                return 1;
+            }
+            return 0;
+    }
+}
+
+/* -------- prompt -------- */
+/* Read a line of input in the message bar. The callback sees every key
+ * after the input has been updated and may append to the message.
+ * Enter on an empty line is ignored unless allow_empty is set.
+ * Returns a malloc'd string, or NULL if the prompt was cancelled. */
+char *editorPrompt(const char *prompt, void (*callback)(char *, int), int allow_empty) {
+    size_t bufsize = 128;
+    char *buf = malloc(bufsize);
+    size_t buflen = 0;
+    buf[0] = '\0';
+    
+    snprintf(E.statusmsg, sizeof(E.statusmsg), prompt, buf);
+    for (;;) {
+        editorRefreshScreen();
+        int c = editorReadKey();
+        
+        if (c == RESIZE_EVENT) {
+            editorHandleResize();
+            continue;
+        } else if (c == REFRESH_EVENT) {
+            continue;
+        } else if (c == DEL_KEY || c == '\x08' || c == 127) {
+            if (buflen != 0) buf[--buflen] = '\0';
+        } else if (c == '\x1b') {
+            snprintf(E.statusmsg, sizeof(E.statusmsg), prompt, buf);
+            if (callback) callback(buf, c);
+            E.statusmsg[0] = '\0';
+            free(buf);
+            return NULL;
+        } else if (c == '\r') {
+            if (buflen != 0 || allow_empty) {
+                E.statusmsg[0] = '\0';
+                if (callback) callback(buf, c);
+                return buf;
+            }
+        } else if (c == PASTE_START) {
+            int plen;
+            char *text = editorReadPaste(&plen);
+            for (int i = 0; i < plen; i++) {
+                if (text[i] == '\n') continue;
+                if (buflen == bufsize - 1) {
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                }
+                buf[buflen++] = text[i];
+            }
+            buf[buflen] = '\0';
+            free(text);
+        } else if (!iscntrl(c) && c < 128) {
+            if (buflen == bufsize - 1) {
+                bufsize *= 2;
+                buf = realloc(buf, bufsize);
+            }
+            buf[buflen++] = c;
+            buf[buflen] = '\0';
+        }
+        
+        snprintf(E.statusmsg, sizeof(E.statusmsg), prompt, buf);
+        if (callback) callback(buf, c);
+    }
+}
+
+/* -------- search -------- */
+static __thread int find_saved_cx, find_saved_cy;
+static __thread int find_saved_rowoff, find_saved_coloff;
+static __thread int find_match_len;
+static __thread struct searchPattern find_sp;
+static __thread struct regex *find_re;
+static __thread const char *find_error;
+
+/* Scan the buffer directly, for when the index can't answer yet */
+static int editorFindScan(int from, int direction, int *mlen) {
+    if (find_re) {
+        if (direction == 1) return regex_search_forward(find_re, &E.doc->g, from, mlen);
+        return regex_search_backward(find_re, &E.doc->g, from, mlen);
+    }
+    *mlen = find_sp.len;
+    if (direction == 1) return search_forward(&E.doc->g, &find_sp, from);
+    return search_backward(&E.doc->g, &find_sp, from);
+}
+
+/* Incremental search step: jump to the match for the current query.
+ * Typing restarts from where the search began, arrows step through
+ * matches and wrap around the ends of the buffer. Ctrl-R switches
+ * between literal and regular expression queries. */
+void editorFindCallback(char *query, int key) {
+    selection_clear(&E.sel);
+    
+    int qlen = strlen(query);
+    
+    if (key == '\r' || key == '\x1b') {
+        if (key == '\x1b') search_index_clear(&E.doc->search_index);
+        regex_free(find_re);
+        find_re = NULL;
+        E.search_match_pos = -1;
+        E.search_direction = 1;
+        return;
+    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+        E.search_direction = 1;
+    } else if (key == ARROW_LEFT || key == ARROW_UP) {
+        E.search_direction = -1;
+    } else {
+        if (key == '\x12') E.search_regex = !E.search_regex;
+        E.search_match_pos = -1;
+        E.search_direction = 1;
+        regex_free(find_re);
+        find_re = NULL;
+        find_error = NULL;
+        if (E.search_regex && qlen > 0) find_re = regex_compile(query, qlen, &find_error);
+        search_compile(&find_sp, query, qlen);
+        search_index_set_query(&E.doc->search_index, query, qlen, E.search_regex);
+    }
+    
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "%s: %s (ESC/Arrows/Enter, ^R regex)",
+             E.search_regex ? "Regex" : "Search", query);
+    if (qlen == 0) return;
+    if (E.search_regex && !find_re) {
+        int mlen = strlen(E.statusmsg);
+        snprintf(E.statusmsg + mlen, sizeof(E.statusmsg) - mlen, " (%s)", find_error);
+        return;
+    }
+    
+    /* Stepping uses the index when it already covers the answer and
+     * falls back to scanning the buffer while it is still being built.
+     * Regex matches don't overlap, so the next one starts past this one. */
+    int match, len = 0;
+    if (E.search_match_pos == -1) {
+        int origin = rowcol_to_pos(&E.doc->g, find_saved_cy, find_saved_cx);
+        match = editorFindScan(origin, 1, &len);
+        if (match == -1) match = editorFindScan(0, 1, &len);
+    } else if (E.search_direction == 1) {
+        int from = E.search_match_pos + (find_re && find_match_len > 0 ? find_match_len : 1);
+        match = search_index_next(&E.doc->search_index, from, &len);
+        if (match == -1) match = search_index_next(&E.doc->search_index, 0, &len);
+        if (match == -2) {
+            match = editorFindScan(from, 1, &len);
+            if (match == -1) match = editorFindScan(0, 1, &len);
+        }
+    } else {
+        match = search_index_prev(&E.doc->search_index, E.search_match_pos, &len);
+        if (match == -1) match = search_index_prev(&E.doc->search_index, gap_length(&E.doc->g) + 1, &len);
+        if (match == -2) {
+            match = editorFindScan(E.search_match_pos, -1, &len);
+            if (match == -1) match = editorFindScan(gap_length(&E.doc->g) + 1, -1, &len);
+        }
+    }
+    
+    if (match == -1) {
+        int mlen = strlen(E.statusmsg);
+        snprintf(E.statusmsg + mlen, sizeof(E.statusmsg) - mlen, " (no match)");
+        return;
+    }
+    
+    int end_row, end_col;
+    E.search_match_pos = match;
+    find_match_len = len;
+    editorSetCursorPos(match);
+    pos_to_rowcol(&E.doc->g, match + len, &end_row, &end_col);
+    selection_start(&E.sel, E.cy, E.cx);
+    selection_update(&E.sel, end_row, end_col);
+}
+
+void editorFind(void) {
+    find_saved_cx = E.cx;
+    find_saved_cy = E.cy;
+    find_saved_rowoff = E.rowoff;
+    find_saved_coloff = E.coloff;
+    E.search_match_pos = -1;
+    E.search_direction = 1;
+    selection_clear(&E.sel);
+    
+    char *query = editorPrompt(E.search_regex ? "Regex: %s (ESC/Arrows/Enter, ^R regex)"
+                                              : "Search: %s (ESC/Arrows/Enter, ^R regex)",
+                               editorFindCallback, 0);
+    
+    if (query) {
+        free(E.search_query);
+        E.search_query = query;
+    } else {
+        E.cx = find_saved_cx;
+        E.cy = find_saved_cy;
+        E.rowoff = find_saved_rowoff;
+        E.coloff = find_saved_coloff;
+    }
+}
+
+/* Replace every match in one pass over the buffer; a single undo
+ * step takes it all back. Uses the mode of the last search. */
+void editorReplaceAll(void) {
+    char *query = editorPrompt(E.search_regex ? "Replace regex: %s (ESC to cancel)"
+                                              : "Replace: %s (ESC to cancel)", NULL, 0);
+    if (!query) return;
+    char *with = editorPrompt("Replace with: %s (ESC to cancel)", NULL, 1);
+    if (!with) {
+        free(query);
+        return;
+    }
+
+    struct searchPattern sp;
+    struct regex *re = NULL;
+    const char *error = NULL;
+    search_compile(&sp, query, strlen(query));
+    if (E.search_regex) re = regex_compile(query, strlen(query), &error);
+
+    if (E.search_regex && !re) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "Bad regex: %s", error);
+    } else {
+        double t0 = trace_now();
+        struct replaceSet *rs = replace_all(&E.doc->g, &sp, re, with, strlen(with));
+        double ms = (trace_now() - t0) * 1e3;
+
+        if (rs) {
+            char count[32];
+            formatCount(count, sizeof(count), rs->count);
+            history_push_replace(&E.doc->history, rs);
+            editorSetCursorPos(E.doc->g.gap_start);
+            E.doc->dirty = 1;
+            snprintf(E.statusmsg, sizeof(E.statusmsg), "Replaced %s occurrence%s in %.1f ms",
+                     count, rs->count == 1 ? "" : "s", ms);
+        } else {
+            snprintf(E.statusmsg, sizeof(E.statusmsg), "No matches (%.1f ms)", ms);
+        }
+    }
+
+    selection_clear(&E.sel);
+    regex_free(re);
+    free(query);
+    free(with);
+}
+
+/* -------- grep -------- */
+static __thread double grep_t0;
+
+/* Search every file under the working directory. Results go to their
+ * own read-only document; Enter on one opens the file there. */
+void editorGrep(void) {
+    char *query = editorPrompt(E.search_regex ? "Grep regex: %s (ESC to cancel)"
+                                              : "Grep: %s (ESC to cancel)", NULL, 0);
+    if (!query) return;
+
+    grep_stop(&E.grep);
+    if (grep_start(&E.grep, ".", query, strlen(query), E.search_regex, 0) == -1) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "Bad regex");
+        free(query);
+        return;
+    }
+    grep_t0 = trace_now();
+
+    if (!E.grep_doc) E.grep_doc = doclist_add(&documents, NULL);
+    document_clear(E.grep_doc);
+    editorSwitchTo(doclist_index(&documents, E.grep_doc));
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "grep: searching...");
+    free(query);
+}
+
+/* Append whatever the workers found since the last poll to the results */
+int editorGrepPoll(void) {
+    if (!E.grep.threads) return 0;
+
+    char *out;
+    int len;
+    int more = grep_take(&E.grep, &out, &len);
+    if (len > 0) {
+        gap_move(&E.grep_doc->g, gap_length(&E.grep_doc->g));
+        gap_insert_bytes(&E.grep_doc->g, out, len);
+        free(out);
+    }
+
+    int nmatches, nfiles;
+    long long nbytes;
+    char matches[16], files[16];
+    grep_stats(&E.grep, &nmatches, &nfiles, &nbytes);
+    formatCount(matches, sizeof(matches), nmatches);
+    formatCount(files, sizeof(files), nfiles);
+
+    if (more) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "grep: %s matches in %s files, searching...",
+                 matches, files);
+    } else {
+        double secs = trace_now() - grep_t0;
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "grep: %s matches in %s files (%.0f MB, %.2f s)%s",
+                 matches, files, nbytes / (1024.0 * 1024.0), secs,
+                 E.grep.truncated ? ", truncated" : "");
+        grep_stop(&E.grep);
+    }
+    return len > 0 || !more;
+}
+
+/* Open the file of the "path:line:col: text" result under the cursor */
+void editorGrepOpen(void) {
+    int len = get_line_length(E.cy);
+    char *line = malloc(len + 1);
+    gap_get_range(&E.doc->g, rowcol_to_pos(&E.doc->g, E.cy, 0), len, line);
+    line[len] = '\0';
+
+    /* paths may hold ':' themselves, so look for the first ":line:col:" */
+    int row = 0, col = 0, n = 0;
+    char *p;
+    for (p = strchr(line, ':'); p; p = strchr(p + 1, ':')) {
+        if (sscanf(p, ":%d:%d:%n", &row, &col, &n) == 2 && n > 0) break;
+    }
+    if (!p || p == line) {
+        free(line);
+        return;
+    }
+    *p = '\0';
+
+    editorOpen(line);
+
+    int rows = count_rows();
+    E.cy = row > rows ? rows - 1 : row - 1;
+    E.cx = col - 1;
+    if (E.cx > get_line_length(E.cy)) E.cx = get_line_length(E.cy);
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "%.60s:%d", line, row);
+    free(line);
+}
+
+/* Keys that would edit the results list are refused; Enter opens one */
+static int editorGrepKey(int key) {
+    if (key == '\r') {
+        editorGrepOpen();
+        return 1;
+    }
+    if (key == PASTE_START) {
+        int len;
+        free(editorReadPaste(&len));
+    } else if (key != '\x1a' && key != '\x19' && key != '\x16' && key != '\x18' &&
+               key != '\x12' && key != 127 && key != '\x08' && key != DEL_KEY &&
+               key != '\t' && !(key >= 32 && key < 127)) {
+        return 0;
+    }
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "grep results are read-only, Enter opens one");
+    return 1;
+}
+
+/* -------- buffers -------- */
+void editorNextBuffer(int step) {
+    int idx = (doclist_index(&documents, E.doc) + step + documents.count) % documents.count;
+    editorSwitchTo(idx);
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "[%d/%d] %.60s", idx + 1, documents.count,
+             editorDocName(E.doc));
+}
+
+void editorOpenPrompt(void) {
+    char *filename = editorPrompt("Open: %s (ESC to cancel)", NULL, 0);
+    if (!filename) return;
+    editorOpen(filename);
+    free(filename);
+}
+
+/* Document for a buffer prompt answer: a 1-based number or part of a name */
+static int editorFindBuffer(const char *query) {
+    char *end;
+    long n = strtol(query, &end, 10);
+    if (*query && *end == '\0') return n >= 1 && n <= documents.count ? n - 1 : -1;
+    for (int i = 0; i < documents.count; i++) {
+        if (strstr(editorDocName(documents.docs[i]), query)) return i;
+    }
+    return -1;
+}
+
+/* List the buffers the answer so far would pick from */
+static void editorBufferCallback(char *query, int key) {
+    (void)key;
+    int len = strlen(E.statusmsg);
+    for (int i = 0; i < documents.count && len < (int)sizeof(E.statusmsg) - 1; i++) {
+        struct document *d = documents.docs[i];
+        if (!strstr(editorDocName(d), query) && editorFindBuffer(query) != i) continue;
+        len += snprintf(E.statusmsg + len, sizeof(E.statusmsg) - len, " %d:%s%s",
+                        i + 1, editorDocName(d), d->dirty ? "*" : "");
+    }
+}
+
+void editorBufferList(void) {
+    char *query = editorPrompt("Buffer: %s |", editorBufferCallback, 0);
+    if (!query) return;
+    int idx = editorFindBuffer(query);
+    if (idx == -1) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "No buffer matches '%.40s'", query);
+    } else {
+        editorSwitchTo(idx);
+    }
+    free(query);
+}
+
+/* Let go of a document about to be closed: panes on it in session s are
+ * left empty for editorAttachDoc to fill */
+static void editorDetachDoc(struct editorConfig *s, struct document *closing) {
+    if (s->grep_doc == closing) {
+        grep_stop(&s->grep);
+        s->grep_doc = NULL;
+    }
+    if (s->close_confirmed == closing) s->close_confirmed = NULL;
+
+    struct window *first = window_first(s->windows), *w = first;
+    do {
+        if (w->doc == closing) window_show(w, NULL);
+        w = window_next(w);
+    } while (w != first);
+}
+
+/* Show d in the panes of session s that editorDetachDoc emptied */
+static void editorAttachDoc(struct editorConfig *s, struct document *d) {
+    struct window *first = window_first(s->windows), *w = first;
+    do {
+        if (!w->doc) {
+            window_show(w, d);
+            w->cx = w->cy = 0;
+            w->rowoff = w->coloff = 0;
+            selection_clear(&w->sel);
+        }
+        w = window_next(w);
+    } while (w != first);
+
+    /* the focused pane picks up the view the document was left with */
+    if (s->doc != s->win->doc) {
+        s->doc = d;
+        s->cx = d->cx;
+        s->cy = d->cy;
+        s->rowoff = d->rowoff;
+        s->coloff = d->coloff;
+        s->sel = d->sel;
+        s->search_drawn_count = -1;
+    }
+}
+
+/* Close the current document; unsaved changes need a second Ctrl-W.
+ * Panes on it in every session move to the one that takes its place. */
+void editorCloseBuffer(void) {
+    if (E.doc->dirty && E.close_confirmed != E.doc) {
+        E.close_confirmed = E.doc;
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "Unsaved changes! Ctrl-W again to close anyway");
+        return;
+    }
+    E.close_confirmed = NULL;
+
+    struct document *closing = E.doc;
+    int idx = doclist_index(&documents, closing);
+    for (struct editorConfig *s = sessions; s; s = s->next_session) editorDetachDoc(s, closing);
+    doclist_close(&documents, idx);
+    if (idx == documents.count) idx--;
+    struct document *d = doclist_switch(&documents, idx);
+    for (struct editorConfig *s = sessions; s; s = s->next_session) editorAttachDoc(s, d);
+
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "[%d/%d] %.60s", idx + 1,
+             documents.count, editorDocName(E.doc));
+}
+
+/* -------- panes -------- */
+#define PANE_MIN_ROWS 3
+#define PANE_MIN_COLS 20
+
+/* Take over the view of pane w */
+static void editorLoadPane(struct window *w) {
+    E.win = w;
+    E.doc = doclist_switch(&documents, doclist_index(&documents, w->doc));
+    E.cx = w->cx;
+    E.cy = w->cy;
+    E.rowoff = w->rowoff;
+    E.coloff = w->coloff;
+    E.rowsub = w->rowsub;
+    E.sel = w->sel;
+    E.goal_col = -1;
+    cursors_clear(&E.cursors);
+    E.search_drawn_count = -1;
+
+    /* the text may have changed under a pane that did not have the focus */
+    editorClampCursor();
+}
+
+/* Move the focus to pane w; the pane left keeps its view */
+void editorFocus(struct window *w) {
+    editorSaveView();
+    editorLoadPane(w);
+}
+
+/* Split the focused pane; the new half shows the same view and gets the focus */
+void editorSplit(int vertical) {
+    if (vertical ? E.win->cols < 2 * PANE_MIN_COLS + 1 : E.win->rows < 2 * PANE_MIN_ROWS) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "Pane too small to split");
+        return;
+    }
+    editorSaveView();
+    E.win = window_split(E.win, vertical);
+    editorInvalidateScreen();
+}
+
+void editorClosePane(void) {
+    struct window *next = window_close(E.win);
+    if (!next) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "Only one pane");
+        return;
+    }
+    editorLoadPane(next);
+    editorInvalidateScreen();
+}
+
+/* Ctrl-K prefix for pane commands */
+void editorPaneCommand(void) {
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "Pane: s=split v=side by side o=other q=close w=wrap");
+    editorRefreshScreen();
+    int c;
+    while ((c = editorReadKey()) == RESIZE_EVENT || c == REFRESH_EVENT) {
+        if (c == RESIZE_EVENT) editorHandleResize();
+        editorRefreshScreen();
+    }
+    E.statusmsg[0] = '\0';
+    
+    switch (c) {
+        case 's':
+        case '-':
+            editorSplit(0);
+            break;
+        case 'v':
+        case '|':
+            editorSplit(1);
+            break;
+        case 'o':
+        case '\x0b':
+            editorFocus(window_next(E.win));
+            break;
+        case 'q':
+        case '0':
+            editorClosePane();
+            break;
+        case 'w':
+            E.win->wrap = !E.win->wrap;
+            E.coloff = E.rowsub = 0;
+            snprintf(E.statusmsg, sizeof(E.statusmsg), "Soft wrap %s", E.win->wrap ? "on" : "off");
+            break;
+    }
+}
+
+/* -------- viewer keys -------- */
+/* Move the top of the viewer n lines down, or up if n is negative; the
+ * last line stays on screen */
+static void editorViewScroll(int n) {
+    struct fileView *v = E.view;
+    for (; n > 0; n--) {
+        long long next = view_line_next(v, E.view_top);
+        if (next >= v->size) break;
+        E.view_top = next;
+    }
+    for (; n < 0 && E.view_top > 0; n++) E.view_top = view_line_begin(v, E.view_top - 1);
+}
+
+/* Ctrl-G: jump to a point given in percent of the file; the line count
+ * does not need to have got there */
+static void editorViewGoto(void) {
+    char *in = editorPrompt("Go to percent: %s", NULL, 0);
+    if (!in) return;
+    char *end;
+    double pct = strtod(in, &end);
+    if (*end == '%') end++;
+    if (end == in || *end || !(pct >= 0 && pct <= 100)) {
+        snprintf(E.statusmsg, sizeof(E.statusmsg), "Not a percentage: %.40s", in);
+        free(in);
+        return;
+    }
+    free(in);
+    long long pos = (long long)(E.view->size * (pct / 100));
+    if (pos >= E.view->size) pos = E.view->size > 0 ? E.view->size - 1 : 0;
+    E.view_top = view_line_begin(E.view, pos);
+}
+
+static void editorViewKey(int c) {
+    int rows = editorTextRows();
+    int half = E.win->cols / 2 > 1 ? E.win->cols / 2 : 1;
+    switch (get_base_key(c)) {
+        case '\x11':
+            E.quit = 1;
+            break;
+        case '\x07':
+            editorViewGoto();
+            break;
+        case ARROW_UP:
+            editorViewScroll(-1);
+            break;
+        case ARROW_DOWN:
+            editorViewScroll(1);
+            break;
+        case PAGE_UP:
+            editorViewScroll(-rows);
+            break;
+        case PAGE_DOWN:
+            editorViewScroll(rows);
+            break;
+        case ARROW_LEFT:
+            E.coloff = E.coloff > half ? E.coloff - half : 0;
+            break;
+        case ARROW_RIGHT:
+            E.coloff += half;
+            break;
+        case HOME_KEY:
+            E.view_top = 0;
+            E.coloff = 0;
+            break;
+        case END_KEY:
+            E.view_top = E.view->size;
+            editorViewScroll(-rows);
+            break;
+    }
+}
+
+static void editorHandleKey(int c) {
+    if (c == RESIZE_EVENT) {
+        editorHandleResize();
+        return;
+    }
+    if (c == REFRESH_EVENT) return;
+    if (E.view) {
+        editorViewKey(c);
+        return;
+    }
+    
+    /* the key acts on the text as it is now, and other sessions
+     * redraw once it is done */
+    editorSyncGeneration();
+    E.keyed = 1;
     
     if (E.show_welcome) {
         E.show_welcome = 0;
         E.statusmsg[0] = '\0';
-        return;
+        editorInvalidateScreen();
+        if (c != PASTE_START) return;
     }
     
     int shift_pressed = is_shift_arrow(c);
     int base_key = get_base_key(c);
     
+    /* anything but moving up or down lets go of the goal column */
+    if (base_key != ARROW_UP && base_key != ARROW_DOWN && base_key != PAGE_UP && base_key != PAGE_DOWN) {
+        E.goal_col = -1;
+    }
+    
+    if (E.doc == E.grep_doc && editorGrepKey(base_key)) return;
+    if (E.cursors.count > 0 && editorMultiKey(base_key, shift_pressed)) return;
+    if (E.sel.active && E.sel.block && editorBlockKey(base_key)) return;
+    
     switch (base_key) {
         case '\x11':
-            write(STDOUT_FILENO, "\x1b[2J", 4);
-            write(STDOUT_FILENO, "\x1b[H", 3);
-            exit(0);
+            E.quit = 1;
             break;
             
         case '\x13':
@@ -658,40 +2420,51 @@ void editorProcessKeypress(void) {
             break;
             
         case '\x1a':
-            if (history_undo(&E.history, &g)) {
-                pos_to_rowcol(&g, g.gap_start, &E.cy, &E.cx);
-                E.dirty = 1;
+            if (history_undo(&E.doc->history, &E.doc->g)) {
+                editorSetCursorPos(E.doc->g.gap_start);
+                E.doc->dirty = 1;
             }
             selection_clear(&E.sel);
             break;
             
         case '\x19':
-            if (history_redo(&E.history, &g)) {
-                pos_to_rowcol(&g, g.gap_start, &E.cy, &E.cx);
-                E.dirty = 1;
+            if (history_redo(&E.doc->history, &E.doc->g)) {
+                editorSetCursorPos(E.doc->g.gap_start);
+                E.doc->dirty = 1;
             }
             selection_clear(&E.sel);
             break;
             
         case '\x03':
             if (E.sel.active) {
-                clipboard_copy(&E.clip, &E.sel, &g);
+                clipboard_copy(&E.clip, &E.sel, &E.doc->cols);
                 snprintf(E.statusmsg, sizeof(E.statusmsg), "Copied %d bytes", E.clip.len);
                 selection_clear(&E.sel);
             }
             break;
             
         case '\x16':
+            if (E.sel.active && !E.clip.block) {
+                char *text = clipboard_text(&E.clip);
+                editorReplaceSelection(text, E.clip.len);
+                free(text);
+                break;
+            }
             if (E.sel.active) {
-                selection_delete(&E.sel, &g, &E.history);
+                editorDeleteSelection();
+            }
+            if (E.clip.block) {
+                clipboard_paste_block(&E.clip, &E.doc->cols, E.cy, editorCxToRx(E.cy, E.cx),
+                                      &E.doc->history);
+            } else {
+                clipboard_paste(&E.clip, &E.doc->g, editorCursorPos(), &E.doc->history);
             }
-            clipboard_paste(&E.clip, &g, rowcol_to_pos(&g, E.cy, E.cx), &E.history);
             break;
             
         case '\x18':
             if (E.sel.active) {
-                clipboard_copy(&E.clip, &E.sel, &g);
-                selection_delete(&E.sel, &g, &E.history);
+                clipboard_copy(&E.clip, &E.sel, &E.doc->cols);
+                editorDeleteSelection();
                 snprintf(E.statusmsg, sizeof(E.statusmsg), "Cut %d bytes", E.clip.len);
             }
             break;
@@ -705,12 +2478,64 @@ void editorProcessKeypress(void) {
             break;
             
         case '\x06':
-            E.statusmsg[0] = '\0';
+            editorFind();
+            break;
+            
+        case '\x12':
+            editorReplaceAll();
+            break;
+            
+        case '\x07':
+            editorGrep();
+            break;
+            
+        case '\x0f':
+            editorOpenPrompt();
+            break;
+            
+        case '\x0e':
+            editorNextBuffer(1);
+            break;
+            
+        case '\x10':
+            editorNextBuffer(-1);
+            break;
+            
+        case '\x02':
+            editorBufferList();
+            break;
+            
+        case '\x17':
+            editorCloseBuffer();
+            break;
+            
+        case '\x0b':
+            editorPaneCommand();
+            break;
+            
+        case '\x14':
+            editorToggleTraceOverlay();
+            break;
+            
+        case '\x05':
+            editorMemoryStatus();
+            break;
+            
+        case '\x04':
+            editorAddCursorAtMatch();
+            break;
+            
+        case '\x0c':
+            editorAddCursorBelow();
+            break;
+            
+        case '\x15':
+            editorToggleBlock();
             break;
             
         case '\r':
             if (E.sel.active) {
-                selection_delete(&E.sel, &g, &E.history);
+                editorDeleteSelection();
             }
             editorInsertNewline();
             break;
@@ -718,7 +2543,7 @@ void editorProcessKeypress(void) {
         case 127:
         case '\x08':
             if (E.sel.active) {
-                selection_delete(&E.sel, &g, &E.history);
+                editorDeleteSelection();
             } else {
                 editorDelChar();
             }
@@ -726,21 +2551,23 @@ void editorProcessKeypress(void) {
             
         case DEL_KEY:
             if (E.sel.active) {
-                selection_delete(&E.sel, &g, &E.history);
+                editorDeleteSelection();
+            } else if (editorNextCx(E.cy, E.cx) - E.cx > 1) {
+                editorDelBytes(editorCursorPos(), editorNextCx(E.cy, E.cx) - E.cx);
             } else {
-                int pos = rowcol_to_pos(&g, E.cy, E.cx);
-                gap_move(&g, pos);
-                char ch = gap_char_at(&g, pos);
-                if (gap_delete(&g)) {
-                    history_push(&E.history, EDIT_DELETE, pos, ch);
-                    E.dirty = 1;
+                int pos = editorCursorPos();
+                gap_move(&E.doc->g, pos);
+                char ch = gap_char_at(&E.doc->g, pos);
+                if (gap_delete(&E.doc->g)) {
+                    history_push(&E.doc->history, EDIT_DELETE, pos, ch);
+                    E.doc->dirty = 1;
                 }
             }
             break;
             
         case '\t':
             if (E.sel.active) {
-                selection_delete(&E.sel, &g, &E.history);
+                editorDeleteSelection();
             }
             for (int i = 0; i < TAB_STOP; i++) {
                 editorInsertChar(' ');
@@ -756,7 +2583,7 @@ void editorProcessKeypress(void) {
                     selection_start(&E.sel, E.cy, E.cx);
                 }
                 editorMoveCursor(base_key);
-                selection_update(&E.sel, E.cy, E.cx);
+                editorSelectToCursor();
             } else {
                 if (E.sel.active) {
                     selection_clear(&E.sel);
@@ -772,7 +2599,7 @@ void editorProcessKeypress(void) {
             }
             editorMoveCursor(base_key);
             if (shift_pressed) {
-                selection_update(&E.sel, E.cy, E.cx);
+                editorSelectToCursor();
             } else {
                 selection_clear(&E.sel);
             }
@@ -785,69 +2612,359 @@ void editorProcessKeypress(void) {
             }
             editorMoveCursor(base_key);
             if (shift_pressed) {
-                selection_update(&E.sel, E.cy, E.cx);
+                editorSelectToCursor();
             } else {
                 selection_clear(&E.sel);
             }
             break;
             
+        case PASTE_START:
+            editorPaste();
+            break;
+            
+        case PASTE_END:
+            break;
+            
         case '\x1b':
+            grep_stop(&E.grep);
             selection_clear(&E.sel);
+            search_index_clear(&E.doc->search_index);
             E.statusmsg[0] = '\0';
             break;
             
         default:
             if (base_key >= 32 && base_key < 127) {
                 if (E.sel.active) {
-                    selection_delete(&E.sel, &g, &E.history);
+                    editorDeleteSelection();
                 }
                 editorInsertChar((char)base_key);
+            } else if (base_key >= 0xC0 && base_key < 0x100) {
+                /* a UTF-8 character goes in whole, so undo never splits it */
+                char ch[4];
+                int n = editorReadUtf8(base_key, ch);
+                if (E.sel.active) {
+                    editorDeleteSelection();
+                }
+                editorInsertText(ch, n);
             }
             break;
     }
 }
 
-/* -------- main -------- */
-int main(int argc, char *argv[]) {
-    enableRawMode();
+void editorProcessKeypress(void) {
+    double t = trace_now();
+    int c = editorReadKey();
+    trace_span(&E.trace, SPAN_READ_KEY, t);
+    trace_frame_begin(&E.trace);
+    
+    t = trace_now();
+    editorHandleKey(c);
+    trace_span(&E.trace, SPAN_PROCESS_KEY, t);
+}
+
+/* -------- sessions -------- */
+/* Start a session on in_fd/out_fd with one pane on doc */
+static void editorInit(int in_fd, int out_fd, struct document *doc) {
+    E.in_fd = in_fd;
+    E.out_fd = out_fd;
     E.cx = E.cy = 0;
-    E.rowoff = E.coloff = 0;
-    E.filename = NULL;
-    E.dirty = 0;
+    E.goal_col = -1;
+    E.rowoff = E.coloff = E.rowsub = 0;
     E.statusmsg[0] = '\0';
     E.search_query = NULL;
+    E.search_regex = 0;
     E.search_direction = 1;
     E.search_match_pos = -1;
     E.show_welcome = 0;
     
-    history_init(&E.history);
+    trace_init(&E.trace, E.trace_path != NULL);
+    E.trace.enabled = E.trace_path != NULL;
+    mem_note(MEM_SCREEN, sizeof(abuf) + sizeof(inbuf));
+    
+    E.doc = doc;
+    E.grep_doc = NULL;
+    E.windows = E.win = window_new(E.doc);
     selection_clear(&E.sel);
+    cursors_init(&E.cursors);
     E.clip.data = NULL;
+    E.clip.src = NULL;
     E.clip.len = 0;
+    E.clip.block = 0;
     
     getWindowSize(&E.screenrows, &E.screencols);
     E.screenrows -= 2;
+    editorInvalidateScreen();
     
-    gap_init(&g, 1024);
+    E.next_session = sessions;
+    sessions = &E;
+}
+
+/* Take down a session that quit; editor_lock held */
+static void editorEnd(void) {
+    struct editorConfig **p = &sessions;
+    while (*p != &E) p = &(*p)->next_session;
+    *p = E.next_session;
     
-    if (argc >= 2) {
-        editorOpen(argv[1]);
-        snprintf(E.statusmsg, sizeof(E.statusmsg), 
-                 "Ctrl-S=save | Ctrl-Q=quit | Shift+Arrows=select | Ctrl-A=all | Esc=clear");
-    } else {
+    grep_stop(&E.grep);
+    window_free(E.windows);
+    cursors_free(&E.cursors);
+    clipboard_free(&E.clip);
+    free(E.search_query);
+    
+    if (E.trace_path && trace_write(&E.trace, E.trace_path) == -1) {
+        fprintf(stderr, "editor: cannot write %s\n", E.trace_path);
+    }
+    trace_free(&E.trace);
+    mem_note(MEM_SCREEN, -(long long)(sizeof(abuf) + sizeof(inbuf)));
+}
+
+/* Open the files a session was started with, or greet it */
+static void editorOpenFiles(int count, char **names) {
+    if (count == 0) {
         E.show_welcome = 1;
+        return;
     }
+    struct document *first = NULL;
+    for (int i = 0; i < count; i++) {
+        editorOpen(names[i]);
+        if (!first) first = E.doc;
+    }
+    editorSwitchTo(doclist_index(&documents, first));
+    snprintf(E.statusmsg, sizeof(E.statusmsg), 
+             "Ctrl-S=save | Ctrl-Q=quit | Shift+Arrows=select | Ctrl-A=all | Esc=clear");
+}
+
+/* Edit until the session quits, then take it down */
+static void editorRun(void) {
+    write(E.out_fd, "\x1b[2J", 4);
+    write(E.out_fd, "\x1b[H", 3);
     
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
+    while (!E.quit) {
+        editorRefreshScreen();
+        editorProcessKeypress();
+        if (E.keyed) {
+            E.keyed = 0;
+            E.drawn_generation = ++edit_generation;
+        }
+    }
+    
+    write(E.out_fd, "\x1b[2J", 4);
+    write(E.out_fd, "\x1b[H", 3);
+    editorEnd();
+}
+
+/* One client of editor --server: a hello, then keys until it leaves */
+static void *editorSession(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    char *hello = malloc(MSG_MAX + 1);
+    char type;
+    int len = msg_recv(fd, &type, hello, MSG_MAX + 1);
+    if (len == -1 || type != MSG_HELLO ||
+        sscanf(hello, "%d %d", &E.term_rows, &E.term_cols) != 2) {
+        free(hello);
+        close(fd);
+        return NULL;
+    }
+    E.remote = 1;
+    
+    char *names[256];
+    int count = 0;
+    for (char *p = hello + strlen(hello) + 1; p < hello + len && count < 256; p += strlen(p) + 1) {
+        names[count++] = p;
+    }
+    
+    pthread_mutex_lock(&editor_lock);
+    editorInit(fd, fd, documents.docs[0]);
+    editorOpenFiles(count, names);
+    editorRun();
+    pthread_mutex_unlock(&editor_lock);
+    
+    free(hello);
+    close(fd);
+    return NULL;
+}
+
+/* editor --server: keep the documents and serve clients until killed.
+ * Nothing is trimmed, files given here are read once up front, and
+ * every client attaching to them later finds them in memory. */
+static int editorServe(int count, char **names) {
+    char path[108];
+    server_socket_path(path, sizeof(path));
+    int fd = server_listen(path);
+    if (fd == -1) {
+        fprintf(stderr, "editor: cannot listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    
+    doclist_init(&documents, LLONG_MAX);
+    for (int i = 0; i < count; i++) {
+        char name[PATH_MAX];
+        server_abspath(names[i], name, sizeof(name));
+        if (doclist_find(&documents, name) != -1) continue;
+        if (document_load(doclist_add(&documents, name)) == -1) {
+            fprintf(stderr, "editor: cannot read %s\n", name);
+        }
+    }
+    if (documents.count > 1) doclist_close(&documents, 0);  /* the empty start document */
+    printf("editor: serving %d documents on %s\n", documents.count, path);
+    fflush(stdout);
     
     for (;;) {
-        editorRefreshScreen();
+        int client = accept(fd, NULL, NULL);
+        if (client == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        pthread_t t;
+        if (pthread_create(&t, NULL, editorSession, (void *)(intptr_t)client) != 0) {
+            close(client);
+            continue;
+        }
+        pthread_detach(t);
+    }
+    close(fd);
+    return 1;
+}
+
+/* editor --client: hand this terminal to the running server */
+static int editorAttach(int count, char **names) {
+    char path[108];
+    server_socket_path(path, sizeof(path));
+    enableRawMode();
+    if (client_run(path, count, names) == -1) {
+        fprintf(stderr, "editor: no server on %s\r\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+/* -------- headless replay -------- */
+/* editor --replay script file [rows cols]: type the bytes of script into
+ * file on a terminal that only counts what it is sent, then report how
+ * long each key took to handle and draw */
+static int editorReplay(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: editor --replay script file [rows cols]\n");
+        return 1;
+    }
+    FILE *fp = fopen(argv[0], "rb");
+    if (!fp) {
+        fprintf(stderr, "editor: cannot read %s\n", argv[0]);
+        return 1;
+    }
+    int cap = 65536, len = 0, n;
+    char *script = malloc(cap);
+    while ((n = fread(script + len, 1, cap - len, fp)) > 0) {
+        len += n;
+        if (len == cap) script = realloc(script, cap *= 2);
+    }
+    fclose(fp);
+    
+    E.replay = script;
+    E.replay_len = len;
+    E.term_rows = argc >= 4 ? atoi(argv[2]) : 24;
+    E.term_cols = argc >= 4 ? atoi(argv[3]) : 80;
+    int out = open("/dev/null", O_WRONLY);
+    
+    doclist_init(&documents, DOC_INACTIVE_BUDGET);
+    pthread_mutex_lock(&editor_lock);
+    editorInit(-1, out, documents.docs[0]);
+    double t0 = trace_now();
+    editorOpenFiles(1, argv + 1);
+    editorRefreshScreen();
+    double load = trace_now() - t0;
+    
+    int nkeys = 0, kcap = 1024;
+    double *lat = malloc(kcap * sizeof(double));
+    for (;;) {
+        double t = trace_now();
         editorProcessKeypress();
+        if (E.quit) break;
+        editorRefreshScreen();
+        if (nkeys == kcap) lat = realloc(lat, (kcap *= 2) * sizeof(double));
+        lat[nkeys++] = (trace_now() - t) * 1e6;
     }
+    editorEnd();
+    pthread_mutex_unlock(&editor_lock);
     
-    history_free(&E.history);
-    clipboard_free(&E.clip);
-    gap_free(&g);
+    qsort(lat, nkeys, sizeof(double), trace_by_double);
+    double total = 0;
+    for (int i = 0; i < nkeys; i++) total += lat[i];
+#define PCT(p) (nkeys ? lat[(int)((nkeys - 1) * (p))] : 0.0)
+    printf("%6d keys  load %8.1f ms  p50 %8.1f us  p90 %8.1f us  p99 %8.1f us  "
+           "max %9.1f us  total %8.1f ms  %7.1f KB out\n",
+           nkeys, load * 1e3, PCT(0.50), PCT(0.90), PCT(0.99), PCT(1.0), total / 1e3,
+           E.bytes_out / 1024.0);
+#undef PCT
+    
+    free(lat);
+    free(script);
+    close(out);
+    if (stats_at_exit) editorDumpStats();
+    doclist_free(&documents);
+    return 0;
+}
+
+/* -------- file viewer -------- */
+/* editor --view file: page through a file of any size read-only. It is
+ * mapped rather than read and its lines are counted in the background,
+ * so the first screen shows at once. */
+static int editorView(const char *path) {
+    struct fileView v;
+    if (view_open(&v, path) == -1) {
+        fprintf(stderr, "editor: cannot read %s\n", path);
+        return 1;
+    }
+    enableRawMode();
+    pthread_mutex_lock(&editor_lock);
+    editorInit(STDIN_FILENO, STDOUT_FILENO, NULL);
+    installResizeHandler();
+    E.view = &v;
+    E.view_path = path;
+    snprintf(E.statusmsg, sizeof(E.statusmsg), "Ctrl-G=go to percent | Ctrl-Q=quit");
+    editorRun();
+    pthread_mutex_unlock(&editor_lock);
+    view_close(&v);
+    if (stats_at_exit) {
+        disableRawMode();
+        editorDumpStats();
+    }
+    return 0;
+}
+
+/* -------- main -------- */
+int main(int argc, char *argv[]) {
+    if (argc >= 3 && strcmp(argv[1], "--trace") == 0) {
+        E.trace_path = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc >= 2 && strcmp(argv[1], "--stats") == 0) {
+        stats_at_exit = 1;
+        argc--;
+        argv++;
+    }
+    Config cfg;
+    config_default(&cfg);
+    gap_set_max(cfg.max_gap);
+    if (argc >= 2 && strcmp(argv[1], "--server") == 0) return editorServe(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "--client") == 0) return editorAttach(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "--replay") == 0) return editorReplay(argc - 2, argv + 2);
+    if (argc >= 3 && strcmp(argv[1], "--view") == 0) return editorView(argv[2]);
+    
+    enableRawMode();
+    doclist_init(&documents, DOC_INACTIVE_BUDGET);
+    pthread_mutex_lock(&editor_lock);
+    editorInit(STDIN_FILENO, STDOUT_FILENO, documents.docs[0]);
+    installResizeHandler();
+    editorOpenFiles(argc - 1, argv + 1);
+    editorRun();
+    pthread_mutex_unlock(&editor_lock);
+    if (stats_at_exit) {
+        disableRawMode();
+        editorDumpStats();
+    }
+    doclist_free(&documents);
     return 0;
 }
@@ -0,0 +1,59 @@
+/* memstat.c - Per-subsystem memory accounting */
+#include "memstat.h"
+#include <stdlib.h>
+
+/* Buffers, histories and indexes are touched from several threads, so
+ * the counters are updated atomically; nothing else is shared. */
+static struct memStats stats[MEM_KINDS];
+
+static const char *names[MEM_KINDS] = {
+    "buffer", "history", "clipboard", "search", "screen"
+};
+
+void mem_note(enum memKind k, long long delta) {
+    long long now = __atomic_add_fetch(&stats[k].bytes, delta, __ATOMIC_RELAXED);
+    long long peak = __atomic_load_n(&stats[k].peak, __ATOMIC_RELAXED);
+    while (now > peak &&
+           !__atomic_compare_exchange_n(&stats[k].peak, &peak, now, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void mem_count(enum memKind k, long long delta) {
+    __atomic_add_fetch(&stats[k].allocs, 1, __ATOMIC_RELAXED);
+    mem_note(k, delta);
+}
+
+void *mem_alloc(enum memKind k, size_t size) {
+    void *p = malloc(size);
+    if (p) mem_count(k, size);
+    return p;
+}
+
+void *mem_calloc(enum memKind k, size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p) mem_count(k, count * size);
+    return p;
+}
+
+void *mem_realloc(enum memKind k, void *p, size_t old, size_t size) {
+    void *q = realloc(p, size);
+    if (q || size == 0) mem_count(k, (long long)size - (p ? (long long)old : 0));
+    return q;
+}
+
+void mem_free(enum memKind k, void *p, size_t size) {
+    if (!p) return;
+    free(p);
+    mem_note(k, -(long long)size);
+}
+
+void mem_stats(enum memKind k, struct memStats *st) {
+    st->bytes = __atomic_load_n(&stats[k].bytes, __ATOMIC_RELAXED);
+    st->peak = __atomic_load_n(&stats[k].peak, __ATOMIC_RELAXED);
+    st->allocs = __atomic_load_n(&stats[k].allocs, __ATOMIC_RELAXED);
+}
+
+const char *mem_name(enum memKind k) {
+    return names[k];
+}
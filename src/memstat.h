@@ -0,0 +1,37 @@
+/* memstat.h - Per-subsystem memory accounting */
+#ifndef MEMSTAT_H
+#define MEMSTAT_H
+
+#include <stddef.h>
+
+enum memKind {
+    MEM_BUFFER,     /* gap buffer storage, the gap included, and line indexes */
+    MEM_HISTORY,    /* undo records and the replace-all sets they own */
+    MEM_CLIPBOARD,
+    MEM_SEARCH,     /* match indexes */
+    MEM_SCREEN,     /* input and output buffers, per-row damage hashes, line layouts */
+    MEM_KINDS
+};
+
+struct memStats {
+    long long bytes;        /* held now */
+    long long peak;
+    long long allocs;       /* allocations made so far */
+};
+
+/* Allocators that count against kind k. The size of a block has to be
+ * given back when it is resized or freed, so nothing is stored with it. */
+void *mem_alloc(enum memKind k, size_t size);
+void *mem_calloc(enum memKind k, size_t count, size_t size);
+void *mem_realloc(enum memKind k, void *p, size_t old, size_t size);
+void mem_free(enum memKind k, void *p, size_t size);
+
+/* Count memory that was not allocated here, like static buffers */
+void mem_note(enum memKind k, long long delta);
+
+void mem_stats(enum memKind k, struct memStats *st);
+
+/* Short lowercase name of kind k */
+const char *mem_name(enum memKind k);
+
+#endif /* MEMSTAT_H */
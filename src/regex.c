@@ -0,0 +1,872 @@
+/* regex.c - Thompson NFA evaluated through a lazily built DFA
+ *
+ * The pattern is parsed into a small syntax tree and compiled twice: once
+ * forward and once reversed. Searching never backtracks. A forward pass
+ * over the text finds where the leftmost-longest match ends, then the
+ * reversed program run backward from that point finds where it starts.
+ * DFA states are built on demand from sets of NFA states and kept in a
+ * bounded cache that is simply flushed when full, so every input byte
+ * costs at most one state construction and the search stays linear.
+ */
+#include "regex.h"
+#include "buffer.h"
+#include "search.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RE_MAX_NODES 8192
+#define RE_MAX_PROG 16384
+#define RE_MAX_EXPANDED (4 * RE_MAX_PROG)
+#define RE_MAX_REPEAT 256
+#define RE_PREFIX_MAX 64
+#define DFA_MAX_STATES 2048
+#define DFA_HASH_SIZE 4096
+#define DFA_END 256
+
+/* -------- syntax tree -------- */
+enum nodeType { N_EMPTY, N_CLASS, N_CAT, N_ALT, N_STAR, N_PLUS, N_QUEST, N_BOL, N_EOL };
+
+struct rnode {
+    enum nodeType type;
+    int a, b;
+    int cls;
+    int size;           /* nodes in the subtree, shared copies counted per use */
+};
+
+/* -------- program -------- */
+enum instOp { I_CLASS, I_SPLIT, I_JMP, I_BOL, I_EOL, I_MATCH };
+
+struct rinst {
+    enum instOp op;
+    int x, y;
+    int cls;
+};
+
+struct rprog {
+    struct rinst *inst;
+    int n, cap;
+};
+
+/* -------- lazy DFA -------- */
+struct dstate {
+    int *key;           /* flags, then NFA pcs per thread group, -1 between groups */
+    int keylen;
+    unsigned int hash;
+    int chain;
+    int dead;
+    int end_match;      /* a match ends here if the input stops, -1 if unknown */
+    int next[256];      /* (state << 2) | DFA_DEAD | DFA_MATCH, -1 if unknown */
+};
+
+#define DFA_BOL 1       /* previous byte was a newline (or start of text) */
+#define DFA_INJECT 2    /* still starting new threads at every position */
+
+#define DFA_MATCH 1     /* transition bit: a match ends before this byte */
+#define DFA_DEAD 2      /* transition bit: no thread survives this byte */
+
+struct dfa {
+    struct rprog *prog;
+    unsigned char (*classes)[32];
+    struct dstate *states;
+    int nstates, cap;
+    int buckets[DFA_HASH_SIZE];
+    unsigned int *mark_out, *mark_ext;
+    unsigned int gen_out, gen_ext;
+    int *stack, *scratch, *ext, *key;
+};
+
+struct regex {
+    struct rnode *nodes;
+    int nnodes;
+    unsigned char (*classes)[32];
+    int nclasses;
+    struct rprog fwd, rev;
+    struct dfa dfa_fwd, dfa_rev;
+    char prefix[RE_PREFIX_MAX];
+    int prefixlen;
+    struct searchPattern prefix_sp;
+    int multiline;
+};
+
+/* -------- parser -------- */
+struct rparser {
+    const char *s;
+    int len, pos;
+    struct regex *re;
+    const char *error;
+};
+
+static int new_node(struct rparser *p, enum nodeType type, int a, int b) {
+    struct regex *re = p->re;
+    if (p->error) return 0;
+    if (re->nnodes == RE_MAX_NODES) {
+        p->error = "pattern too large";
+        return 0;
+    }
+    /* counters share subtrees, and code generation walks each use; an
+     * atom that emits nothing, like (), would never hit RE_MAX_PROG */
+    int size = 1 + (a >= 0 ? re->nodes[a].size : 0) + (b >= 0 ? re->nodes[b].size : 0);
+    if (size > RE_MAX_EXPANDED) {
+        p->error = "pattern too large";
+        return 0;
+    }
+    re->nodes[re->nnodes].type = type;
+    re->nodes[re->nnodes].a = a;
+    re->nodes[re->nnodes].b = b;
+    re->nodes[re->nnodes].cls = -1;
+    re->nodes[re->nnodes].size = size;
+    return re->nnodes++;
+}
+
+static int new_class(struct rparser *p) {
+    struct regex *re = p->re;
+    int n = new_node(p, N_CLASS, -1, -1);
+    if (p->error) return 0;
+    re->classes = realloc(re->classes, (re->nclasses + 1) * sizeof(*re->classes));
+    memset(re->classes[re->nclasses], 0, 32);
+    re->nodes[n].cls = re->nclasses++;
+    return n;
+}
+
+static unsigned char *node_class(struct rparser *p, int n) {
+    return p->re->classes[p->re->nodes[n].cls];
+}
+
+static void class_add(unsigned char *cls, int c) {
+    cls[c >> 3] |= 1 << (c & 7);
+}
+
+static void class_add_range(unsigned char *cls, int lo, int hi) {
+    for (int c = lo; c <= hi; c++) class_add(cls, c);
+}
+
+static void class_invert(unsigned char *cls) {
+    for (int i = 0; i < 32; i++) cls[i] = ~cls[i];
+}
+
+/* \d \w \s and friends; returns 0 if e is not a class escape */
+static int class_escape(unsigned char *cls, int e) {
+    unsigned char tmp[32];
+    memset(tmp, 0, sizeof(tmp));
+    switch (e) {
+        case 'd': case 'D':
+            class_add_range(tmp, '0', '9');
+            break;
+        case 'w': case 'W':
+            class_add_range(tmp, '0', '9');
+            class_add_range(tmp, 'a', 'z');
+            class_add_range(tmp, 'A', 'Z');
+            class_add(tmp, '_');
+            break;
+        case 's': case 'S':
+            class_add(tmp, ' ');
+            class_add_range(tmp, '\t', '\r');
+            break;
+        default:
+            return 0;
+    }
+    if (e == 'D' || e == 'W' || e == 'S') class_invert(tmp);
+    for (int i = 0; i < 32; i++) cls[i] |= tmp[i];
+    return 1;
+}
+
+static int escape_char(int e) {
+    switch (e) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        default:  return e;
+    }
+}
+
+static int parse_alt(struct rparser *p);
+
+static int parse_bracket(struct rparser *p) {
+    int n = new_class(p);
+    if (p->error) return 0;
+    int negate = 0;
+    if (p->pos < p->len && p->s[p->pos] == '^') {
+        negate = 1;
+        p->pos++;
+    }
+
+    int first = 1;
+    while (p->pos < p->len && (p->s[p->pos] != ']' || first)) {
+        int lo = (unsigned char)p->s[p->pos++];
+        first = 0;
+        if (lo == '\\') {
+            if (p->pos == p->len) break;
+            int e = (unsigned char)p->s[p->pos++];
+            if (class_escape(node_class(p, n), e)) continue;
+            lo = escape_char(e);
+        }
+        int hi = lo;
+        if (p->pos + 1 < p->len && p->s[p->pos] == '-' && p->s[p->pos + 1] != ']') {
+            p->pos++;
+            hi = (unsigned char)p->s[p->pos++];
+            if (hi == '\\' && p->pos < p->len) hi = escape_char((unsigned char)p->s[p->pos++]);
+            if (hi < lo) {
+                p->error = "bad character range";
+                return 0;
+            }
+        }
+        class_add_range(node_class(p, n), lo, hi);
+    }
+    if (p->pos == p->len) {
+        p->error = "missing ]";
+        return 0;
+    }
+    p->pos++;
+    if (negate) class_invert(node_class(p, n));
+    return n;
+}
+
+static int parse_atom(struct rparser *p) {
+    int c = (unsigned char)p->s[p->pos++];
+    int n;
+
+    switch (c) {
+        case '(':
+            if (p->pos + 1 < p->len && p->s[p->pos] == '?' && p->s[p->pos + 1] == ':') {
+                p->pos += 2;
+            }
+            n = parse_alt(p);
+            if (p->error) return 0;
+            if (p->pos == p->len || p->s[p->pos] != ')') {
+                p->error = "missing )";
+                return 0;
+            }
+            p->pos++;
+            return n;
+        case '[':
+            return parse_bracket(p);
+        case '.':
+            n = new_class(p);
+            if (p->error) return 0;
+            class_add_range(node_class(p, n), 0, 255);
+            node_class(p, n)['\n' >> 3] &= ~(1 << ('\n' & 7));
+            return n;
+        case '^':
+            return new_node(p, N_BOL, -1, -1);
+        case '$':
+            return new_node(p, N_EOL, -1, -1);
+        case '*': case '+': case '?':
+            p->error = "nothing to repeat";
+            return 0;
+        case '\\':
+            if (p->pos == p->len) {
+                p->error = "trailing backslash";
+                return 0;
+            }
+            c = (unsigned char)p->s[p->pos++];
+            n = new_class(p);
+            if (p->error) return 0;
+            if (!class_escape(node_class(p, n), c)) class_add(node_class(p, n), escape_char(c));
+            return n;
+        default:
+            n = new_class(p);
+            if (p->error) return 0;
+            class_add(node_class(p, n), c);
+            return n;
+    }
+}
+
+/* Parse {m}, {m,} or {m,n}; leaves pos alone if it is not a counter */
+static int parse_counter(struct rparser *p, int *min, int *max) {
+    int i = p->pos + 1;
+    int m = 0, n = -1, digits = 0;
+    while (i < p->len && p->s[i] >= '0' && p->s[i] <= '9') {
+        m = m * 10 + (p->s[i++] - '0');
+        if (m > RE_MAX_REPEAT) m = RE_MAX_REPEAT + 1;
+        digits++;
+    }
+    if (!digits) return 0;
+    if (i < p->len && p->s[i] == '}') {
+        n = m;
+    } else if (i < p->len && p->s[i] == ',') {
+        i++;
+        if (i < p->len && p->s[i] >= '0' && p->s[i] <= '9') {
+            n = 0;
+            while (i < p->len && p->s[i] >= '0' && p->s[i] <= '9') {
+                n = n * 10 + (p->s[i++] - '0');
+                if (n > RE_MAX_REPEAT) n = RE_MAX_REPEAT + 1;
+            }
+        }
+        if (i == p->len || p->s[i] != '}') return 0;
+    } else {
+        return 0;
+    }
+    if (m > RE_MAX_REPEAT || n > RE_MAX_REPEAT || (n != -1 && n < m)) {
+        p->error = "bad repetition count";
+        return 0;
+    }
+    p->pos = i + 1;
+    *min = m;
+    *max = n;
+    return 1;
+}
+
+/* x{m,n} becomes m copies of x followed by n-m nested optional copies.
+ * Copies share the subtree; code generation emits it once per use. */
+static int expand_counter(struct rparser *p, int atom, int min, int max) {
+    int result = -1;
+    for (int i = 0; i < min; i++) {
+        result = result < 0 ? atom : new_node(p, N_CAT, result, atom);
+    }
+    int tail = -1;
+    if (max == -1) {
+        tail = new_node(p, N_STAR, atom, -1);
+    } else {
+        for (int i = min; i < max; i++) {
+            int inner = tail < 0 ? atom : new_node(p, N_CAT, atom, tail);
+            tail = new_node(p, N_QUEST, inner, -1);
+        }
+    }
+    if (tail >= 0) result = result < 0 ? tail : new_node(p, N_CAT, result, tail);
+    return result < 0 ? new_node(p, N_EMPTY, -1, -1) : result;
+}
+
+static int parse_repeat(struct rparser *p) {
+    int n = parse_atom(p);
+    while (!p->error && p->pos < p->len) {
+        int c = p->s[p->pos];
+        int min, max;
+        if (c == '*') n = new_node(p, N_STAR, n, -1);
+        else if (c == '+') n = new_node(p, N_PLUS, n, -1);
+        else if (c == '?') n = new_node(p, N_QUEST, n, -1);
+        else if (c == '{' && parse_counter(p, &min, &max)) {
+            n = expand_counter(p, n, min, max);
+            continue;
+        } else break;
+        p->pos++;
+    }
+    return n;
+}
+
+static int parse_cat(struct rparser *p) {
+    int n = -1;
+    while (!p->error && p->pos < p->len && p->s[p->pos] != '|' && p->s[p->pos] != ')') {
+        int r = parse_repeat(p);
+        n = n < 0 ? r : new_node(p, N_CAT, n, r);
+    }
+    return n < 0 ? new_node(p, N_EMPTY, -1, -1) : n;
+}
+
+static int parse_alt(struct rparser *p) {
+    int n = parse_cat(p);
+    while (!p->error && p->pos < p->len && p->s[p->pos] == '|') {
+        p->pos++;
+        int r = parse_cat(p);
+        n = new_node(p, N_ALT, n, r);
+    }
+    return n;
+}
+
+/* -------- code generation -------- */
+static int emit(struct rprog *pr, enum instOp op, int x, int y, int cls) {
+    if (pr->n == pr->cap) {
+        pr->cap = pr->cap ? pr->cap * 2 : 64;
+        pr->inst = realloc(pr->inst, pr->cap * sizeof(struct rinst));
+    }
+    pr->inst[pr->n].op = op;
+    pr->inst[pr->n].x = x;
+    pr->inst[pr->n].y = y;
+    pr->inst[pr->n].cls = cls;
+    return pr->n++;
+}
+
+/* A reversed program matches the reversed text: concatenations run
+ * backward and ^/$ trade places. */
+static void gen(struct regex *re, struct rprog *pr, int n, int reverse) {
+    struct rnode nd = re->nodes[n];
+    int l, j;
+    if (pr->n > RE_MAX_PROG) return;
+
+    switch (nd.type) {
+        case N_EMPTY:
+            break;
+        case N_CLASS:
+            emit(pr, I_CLASS, 0, 0, nd.cls);
+            break;
+        case N_BOL:
+            emit(pr, reverse ? I_EOL : I_BOL, 0, 0, -1);
+            break;
+        case N_EOL:
+            emit(pr, reverse ? I_BOL : I_EOL, 0, 0, -1);
+            break;
+        case N_CAT:
+            gen(re, pr, reverse ? nd.b : nd.a, reverse);
+            gen(re, pr, reverse ? nd.a : nd.b, reverse);
+            break;
+        case N_ALT:
+            l = emit(pr, I_SPLIT, 0, 0, -1);
+            pr->inst[l].x = pr->n;
+            gen(re, pr, nd.a, reverse);
+            j = emit(pr, I_JMP, 0, 0, -1);
+            pr->inst[l].y = pr->n;
+            gen(re, pr, nd.b, reverse);
+            pr->inst[j].x = pr->n;
+            break;
+        case N_STAR:
+            l = emit(pr, I_SPLIT, 0, 0, -1);
+            pr->inst[l].x = pr->n;
+            gen(re, pr, nd.a, reverse);
+            emit(pr, I_JMP, l, 0, -1);
+            pr->inst[l].y = pr->n;
+            break;
+        case N_PLUS:
+            l = pr->n;
+            gen(re, pr, nd.a, reverse);
+            j = emit(pr, I_SPLIT, l, 0, -1);
+            pr->inst[j].y = pr->n;
+            break;
+        case N_QUEST:
+            l = emit(pr, I_SPLIT, 0, 0, -1);
+            pr->inst[l].x = pr->n;
+            gen(re, pr, nd.a, reverse);
+            pr->inst[l].y = pr->n;
+            break;
+    }
+}
+
+/* Collect the literal bytes every match has to begin with. Returns 1 if
+ * the whole node was literal, so the caller may keep appending. */
+static int literal_prefix(struct regex *re, int n) {
+    struct rnode *nd = &re->nodes[n];
+    int byte = -1;
+
+    switch (nd->type) {
+        case N_EMPTY:
+        case N_BOL:
+            return 1;
+        case N_CLASS:
+            for (int c = 0; c < 256; c++) {
+                if (re->classes[nd->cls][c >> 3] & (1 << (c & 7))) {
+                    if (byte != -1) return 0;
+                    byte = c;
+                }
+            }
+            if (byte == -1 || re->prefixlen == RE_PREFIX_MAX) return 0;
+            re->prefix[re->prefixlen++] = byte;
+            return 1;
+        case N_CAT:
+            return literal_prefix(re, nd->a) && literal_prefix(re, nd->b);
+        case N_PLUS:
+            literal_prefix(re, nd->a);
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+/* -------- lazy DFA -------- */
+static void dfa_init(struct dfa *d, struct rprog *prog, unsigned char (*classes)[32]) {
+    memset(d, 0, sizeof(*d));
+    d->prog = prog;
+    d->classes = classes;
+    for (int i = 0; i < DFA_HASH_SIZE; i++) d->buckets[i] = -1;
+    d->mark_out = calloc(prog->n, sizeof(unsigned int));
+    d->mark_ext = calloc(prog->n, sizeof(unsigned int));
+    d->stack = malloc((2 * prog->n + 2) * sizeof(int));
+    d->scratch = malloc((2 * prog->n + 2) * sizeof(int));
+    d->ext = malloc((prog->n + 1) * sizeof(int));
+    d->key = malloc((2 * prog->n + 2) * sizeof(int));
+}
+
+static void dfa_flush(struct dfa *d) {
+    for (int i = 0; i < d->nstates; i++) free(d->states[i].key);
+    d->nstates = 0;
+    for (int i = 0; i < DFA_HASH_SIZE; i++) d->buckets[i] = -1;
+}
+
+static void dfa_free(struct dfa *d) {
+    dfa_flush(d);
+    free(d->states);
+    free(d->mark_out);
+    free(d->mark_ext);
+    free(d->stack);
+    free(d->scratch);
+    free(d->ext);
+    free(d->key);
+}
+
+/* Add everything reachable from pc without consuming input. EOL stays
+ * in the set as a pending assertion unless eol says the next byte is
+ * known to end the line. */
+static void dfa_closure(struct dfa *d, unsigned int *mark, unsigned int gen, int pc,
+                        int bol, int eol, int *out, int *n) {
+    int sp = 0;
+    d->stack[sp++] = pc;
+    while (sp) {
+        pc = d->stack[--sp];
+        if (mark[pc] == gen) continue;
+        mark[pc] = gen;
+        struct rinst *in = &d->prog->inst[pc];
+        switch (in->op) {
+            case I_JMP:
+                d->stack[sp++] = in->x;
+                break;
+            case I_SPLIT:
+                d->stack[sp++] = in->y;
+                d->stack[sp++] = in->x;
+                break;
+            case I_BOL:
+                if (bol) d->stack[sp++] = pc + 1;
+                break;
+            case I_EOL:
+                if (eol) d->stack[sp++] = pc + 1;
+                else out[(*n)++] = pc;
+                break;
+            default:
+                out[(*n)++] = pc;
+                break;
+        }
+    }
+}
+
+static int cmp_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* Sort the group that started at gstart and terminate it */
+static void close_group(int *out, int *n, int gstart) {
+    if (*n == gstart) return;
+    qsort(out + gstart, *n - gstart, sizeof(int), cmp_int);
+    out[(*n)++] = -1;
+}
+
+static int dfa_lookup(struct dfa *d, const int *key, int keylen, int *flushed) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < keylen; i++) {
+        h ^= (unsigned int)key[i];
+        h *= 16777619u;
+    }
+    int b = h % DFA_HASH_SIZE;
+    for (int i = d->buckets[b]; i != -1; i = d->states[i].chain) {
+        struct dstate *st = &d->states[i];
+        if (st->hash == h && st->keylen == keylen &&
+            memcmp(st->key, key, keylen * sizeof(int)) == 0) {
+            return i;
+        }
+    }
+
+    if (d->nstates == DFA_MAX_STATES) {
+        dfa_flush(d);
+        *flushed = 1;
+    }
+    if (d->nstates == d->cap) {
+        d->cap = d->cap ? d->cap * 2 : 16;
+        d->states = realloc(d->states, d->cap * sizeof(struct dstate));
+    }
+    struct dstate *st = &d->states[d->nstates];
+    st->key = malloc(keylen * sizeof(int));
+    memcpy(st->key, key, keylen * sizeof(int));
+    st->keylen = keylen;
+    st->hash = h;
+    st->dead = keylen == 1 && !(key[0] & DFA_INJECT);
+    st->end_match = -1;
+    for (int c = 0; c < 256; c++) st->next[c] = -1;
+    st->chain = d->buckets[b];
+    d->buckets[b] = d->nstates;
+    return d->nstates++;
+}
+
+/* Compute the transition from state s on byte c (or DFA_END, which only
+ * reports whether a match ends here). Thread groups are kept in order of
+ * their start position. Once one group matches, the later-starting ones
+ * are dropped and no new starts are injected, which gives leftmost-longest
+ * semantics without tracking positions. */
+static int dfa_step(struct dfa *d, int s, int c) {
+    struct dstate *st = &d->states[s];
+    int keylen = st->keylen;
+    int *key = d->key;
+    memcpy(key, st->key, keylen * sizeof(int));
+
+    int bol = key[0] & DFA_BOL;
+    int inject = key[0] & DFA_INJECT;
+    int line_end = c == '\n' || c == DFA_END;
+    int *out = d->scratch;
+    int n = 1;
+    int matched = 0;
+    unsigned int gen_out = ++d->gen_out;
+
+    int i = 1;
+    while (i < keylen && !matched) {
+        int j = i;
+        while (j < keylen && key[j] != -1) j++;
+
+        unsigned int gen_ext = ++d->gen_ext;
+        int ne = 0;
+        for (int k = i; k < j; k++) {
+            d->ext[ne++] = key[k];
+            d->mark_ext[key[k]] = gen_ext;
+        }
+        if (line_end) {
+            for (int k = i; k < j; k++) {
+                if (d->prog->inst[key[k]].op == I_EOL) {
+                    dfa_closure(d, d->mark_ext, gen_ext, key[k] + 1, bol, 1, d->ext, &ne);
+                }
+            }
+        }
+
+        int gstart = n;
+        for (int k = 0; k < ne; k++) {
+            struct rinst *in = &d->prog->inst[d->ext[k]];
+            if (in->op == I_MATCH) matched = 1;
+            if (c != DFA_END && in->op == I_CLASS &&
+                (d->classes[in->cls][c >> 3] & (1 << (c & 7)))) {
+                dfa_closure(d, d->mark_out, gen_out, d->ext[k] + 1, c == '\n', 0, out, &n);
+            }
+        }
+        close_group(out, &n, gstart);
+        i = j + 1;
+    }
+
+    if (c == DFA_END) return matched;
+
+    if (inject && !matched) {
+        int gstart = n;
+        dfa_closure(d, d->mark_out, gen_out, 0, c == '\n', 0, out, &n);
+        close_group(out, &n, gstart);
+    }
+    if (n > 1) n--;     /* drop the trailing separator */
+    out[0] = (c == '\n' ? DFA_BOL : 0) | (inject && !matched ? DFA_INJECT : 0);
+
+    int flushed = 0;
+    int ns = dfa_lookup(d, out, n, &flushed);
+    int t = (ns << 2) | (d->states[ns].dead ? DFA_DEAD : 0) | matched;
+    if (!flushed) d->states[s].next[c] = t;
+    return t;
+}
+
+static int dfa_start(struct dfa *d, int bol, int inject) {
+    int *out = d->scratch;
+    int n = 1;
+    dfa_closure(d, d->mark_out, ++d->gen_out, 0, bol, 0, out, &n);
+    close_group(out, &n, 1);
+    if (n > 1) n--;
+    out[0] = (bol ? DFA_BOL : 0) | (inject ? DFA_INJECT : 0);
+    int flushed = 0;
+    return dfa_lookup(d, out, n, &flushed);
+}
+
+static int dfa_stop_injecting(struct dfa *d, int s) {
+    struct dstate *st = &d->states[s];
+    if (!(st->key[0] & DFA_INJECT)) return s;
+    int keylen = st->keylen;
+    memcpy(d->key, st->key, keylen * sizeof(int));
+    d->key[0] &= ~DFA_INJECT;
+    int flushed = 0;
+    return dfa_lookup(d, d->key, keylen, &flushed);
+}
+
+/* Whether a match ends before byte c (DFA_END for end of text) */
+static int dfa_match_before(struct dfa *d, int s, int c) {
+    if (c == DFA_END) {
+        if (d->states[s].end_match < 0) d->states[s].end_match = dfa_step(d, s, DFA_END);
+        return d->states[s].end_match;
+    }
+    int t = d->states[s].next[c];
+    if (t < 0) t = dfa_step(d, s, c);
+    return t & DFA_MATCH;
+}
+
+/* Run forward from `from`, starting new threads at every position before
+ * inject_until. Returns the end of the leftmost-longest match or -1. */
+static int dfa_forward(struct dfa *d, struct gapbuf *g, int from, int inject_until) {
+    int len = gap_length(g);
+    int bol = from == 0 || gap_char_at(g, from - 1) == '\n';
+    int inject = from < inject_until;
+    int s = dfa_start(d, bol, inject);
+    int last = -1;
+    int pos = from;
+
+    while (pos < len) {
+        if (inject && pos >= inject_until) {
+            s = dfa_stop_injecting(d, s);
+            inject = 0;
+        }
+        if (d->states[s].dead) return last;
+
+        const unsigned char *p;
+        int n;
+        if (pos < g->gap_start) {
+            p = (const unsigned char *)g->buf + pos;
+            n = g->gap_start - pos;
+        } else {
+            p = (const unsigned char *)g->buf + g->gap_end + (pos - g->gap_start);
+            n = len - pos;
+        }
+        if (inject && n > inject_until - pos) n = inject_until - pos;
+
+        const struct dstate *st = &d->states[s];
+        for (int i = 0; i < n; i++) {
+            int t = st->next[p[i]];
+            if (t < 0) {
+                t = dfa_step(d, s, p[i]);
+            } else if (t >> 2 == s) {
+                /* most bytes keep a scanning DFA where it is */
+                while (i + 1 < n && st->next[p[i + 1]] == t) i++;
+            }
+            if (t & DFA_MATCH) last = pos + i;
+            if (t & DFA_DEAD) return last;
+            s = t >> 2;
+            st = &d->states[s];
+        }
+        pos += n;
+    }
+    if (dfa_match_before(d, s, DFA_END)) last = len;
+    return last;
+}
+
+/* Run the reversed program backward from `from` down to `stop`.
+ * Returns the smallest position where a match of it ends, or -1. */
+static int dfa_reverse(struct dfa *d, struct gapbuf *g, int from, int stop) {
+    int len = gap_length(g);
+    int bol = from == len || gap_char_at(g, from) == '\n';
+    int s = dfa_start(d, bol, 0);
+    int last = -1;
+    int pos = from;
+
+    while (pos > stop) {
+        const unsigned char *p;
+        int n;
+        if (pos > g->gap_start) {
+            int lo = stop > g->gap_start ? stop : g->gap_start;
+            p = (const unsigned char *)g->buf + g->gap_end + (lo - g->gap_start);
+            n = pos - lo;
+        } else {
+            p = (const unsigned char *)g->buf + stop;
+            n = pos - stop;
+        }
+
+        const struct dstate *st = &d->states[s];
+        for (int i = n - 1; i >= 0; i--) {
+            int t = st->next[p[i]];
+            if (t < 0) t = dfa_step(d, s, p[i]);
+            if (t & DFA_MATCH) last = pos - n + i + 1;
+            if (t & DFA_DEAD) return last;
+            s = t >> 2;
+            st = &d->states[s];
+        }
+        pos -= n;
+    }
+    int c = stop > 0 ? (unsigned char)gap_char_at(g, stop - 1) : DFA_END;
+    if (dfa_match_before(d, s, c)) last = stop;
+    return last;
+}
+
+/* -------- public interface -------- */
+struct regex *regex_compile(const char *pattern, int len, const char **error) {
+    struct regex *re = calloc(1, sizeof(struct regex));
+    re->nodes = malloc(RE_MAX_NODES * sizeof(struct rnode));
+
+    struct rparser p;
+    p.s = pattern;
+    p.len = len;
+    p.pos = 0;
+    p.re = re;
+    p.error = NULL;
+
+    int root = parse_alt(&p);
+    if (!p.error && p.pos < p.len) p.error = "unmatched )";
+    if (!p.error) {
+        gen(re, &re->fwd, root, 0);
+        emit(&re->fwd, I_MATCH, 0, 0, -1);
+        gen(re, &re->rev, root, 1);
+        emit(&re->rev, I_MATCH, 0, 0, -1);
+        if (re->fwd.n > RE_MAX_PROG) p.error = "pattern too large";
+    }
+    if (p.error) {
+        if (error) *error = p.error;
+        free(re->fwd.inst);
+        free(re->rev.inst);
+        free(re->nodes);
+        free(re->classes);
+        free(re);
+        return NULL;
+    }
+
+    for (int i = 0; i < re->nclasses; i++) {
+        if (re->classes[i]['\n' >> 3] & (1 << ('\n' & 7))) re->multiline = 1;
+    }
+    literal_prefix(re, root);
+    search_compile(&re->prefix_sp, re->prefix, re->prefixlen);
+    dfa_init(&re->dfa_fwd, &re->fwd, re->classes);
+    dfa_init(&re->dfa_rev, &re->rev, re->classes);
+    return re;
+}
+
+void regex_free(struct regex *re) {
+    if (!re) return;
+    dfa_free(&re->dfa_fwd);
+    dfa_free(&re->dfa_rev);
+    free(re->fwd.inst);
+    free(re->rev.inst);
+    free(re->nodes);
+    free(re->classes);
+    free(re);
+}
+
+int regex_multiline(struct regex *re) {
+    return re->multiline;
+}
+
+int regex_search_range(struct regex *re, struct gapbuf *g, int from, int to, int *mlen) {
+    int len = gap_length(g);
+    if (from < 0) from = 0;
+    if (to > len + 1) to = len + 1;
+    if (from >= to) return -1;
+
+    /* Every match begins with the prefix, so nothing before its first
+     * occurrence can start one. Trying each occurrence anchored would
+     * rescan the text after it every time. */
+    if (re->prefixlen > 0) {
+        from = search_range(g, &re->prefix_sp, from, to);
+        if (from < 0) return -1;
+    }
+
+    int e = dfa_forward(&re->dfa_fwd, g, from, to - 1);
+    if (e < 0) return -1;
+    int s = dfa_reverse(&re->dfa_rev, g, e, from);
+    if (s < 0) return -1;
+    *mlen = e - s;
+    return s;
+}
+
+int regex_search_forward(struct regex *re, struct gapbuf *g, int from, int *mlen) {
+    return regex_search_range(re, g, from, gap_length(g) + 1, mlen);
+}
+
+/* Walk back in growing windows and take the last match found by
+ * scanning each window forward. */
+int regex_search_backward(struct regex *re, struct gapbuf *g, int before, int *mlen) {
+    int len = gap_length(g);
+    if (before > len + 1) before = len + 1;
+    int hi = before;
+    int window = 4096;
+
+    while (hi > 0) {
+        int lo = hi - window > 0 ? hi - window : 0;
+        int best = -1, bestlen = 0;
+        int p = lo;
+        for (;;) {
+            int l;
+            int r = regex_search_range(re, g, p, hi, &l);
+            if (r < 0) break;
+            best = r;
+            bestlen = l;
+            p = r + (l > 0 ? l : 1);
+        }
+        if (best >= 0) {
+            *mlen = bestlen;
+            return best;
+        }
+        hi = lo;
+        if (window < (1 << 24)) window *= 2;
+    }
+    return -1;
+}
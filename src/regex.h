@@ -0,0 +1,28 @@
+/* regex.h - Regular expression search with a lazily built DFA */
+#ifndef REGEX_H
+#define REGEX_H
+
+struct gapbuf;
+struct regex;
+
+/* Compile a pattern. Supports . [] [^] * + ? {m,n} | () ^ $ and the
+ * \d \w \s escapes. Returns NULL and sets *error on bad syntax. */
+struct regex *regex_compile(const char *pattern, int len, const char **error);
+
+/* Free a compiled pattern and its DFA caches */
+void regex_free(struct regex *re);
+
+/* Whether a match may contain a newline */
+int regex_multiline(struct regex *re);
+
+/* Leftmost-longest match starting in [from, to); returns its start or -1
+ * and stores the match length in *mlen */
+int regex_search_range(struct regex *re, struct gapbuf *g, int from, int to, int *mlen);
+
+/* Leftmost-longest match starting at or after from, -1 if none */
+int regex_search_forward(struct regex *re, struct gapbuf *g, int from, int *mlen);
+
+/* Last match starting before the given position, -1 if none */
+int regex_search_backward(struct regex *re, struct gapbuf *g, int before, int *mlen);
+
+#endif /* REGEX_H */
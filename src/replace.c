@@ -0,0 +1,162 @@
+/* replace.c - Single pass replace-all implementation */
+#include "replace.h"
+#include "memstat.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int match_len(struct replaceSet *rs, int i) {
+    return rs->lens ? rs->lens[i] : rs->removed_len;
+}
+
+static int with_len(struct replaceSet *rs, int i) {
+    return rs->withlens ? rs->withlens[i] : rs->withlen;
+}
+
+/* A set owning starts and lens (NULL if every match is `removed`) */
+static struct replaceSet *replace_set(int count, int *starts, int *lens,
+                                      const char *with, int withlen) {
+    struct replaceSet *rs = mem_alloc(MEM_HISTORY, sizeof(struct replaceSet));
+    rs->count = count;
+    rs->starts = starts;
+    rs->lens = lens;
+    rs->removed = NULL;
+    rs->removed_len = 0;
+    rs->with = mem_alloc(MEM_HISTORY, withlen + 1);
+    if (withlen) memcpy(rs->with, with, withlen);
+    rs->withlen = withlen;
+    rs->withlens = NULL;
+    return rs;
+}
+
+/* Keep the bytes of every match, concatenated, for undo */
+static void replace_save(struct replaceSet *rs, struct gapbuf *g) {
+    int total = 0;
+    for (int i = 0; i < rs->count; i++) total += rs->lens[i];
+    rs->removed_len = total;
+    rs->removed = mem_alloc(MEM_HISTORY, total + 1);
+    for (int i = 0, off = 0; i < rs->count; i++) {
+        gap_get_range(g, rs->starts[i], rs->lens[i], rs->removed + off);
+        off += rs->lens[i];
+    }
+}
+
+struct replaceSet *replace_all(struct gapbuf *g, const struct searchPattern *sp,
+                               struct regex *re, const char *with, int withlen) {
+    int cap = 0, count = 0;
+    int *starts = NULL, *lens = NULL;
+
+    /* Collect the matches first; the buffer is only rewritten once */
+    int pos = 0;
+    for (;;) {
+        int len = sp->len;
+        int r = re ? regex_search_forward(re, g, pos, &len) : search_forward(g, sp, pos);
+        if (r < 0) break;
+        if (count == cap) {
+            int grown = cap ? cap * 2 : 256;
+            starts = mem_realloc(MEM_HISTORY, starts, cap * sizeof(int), grown * sizeof(int));
+            lens = mem_realloc(MEM_HISTORY, lens, cap * sizeof(int), grown * sizeof(int));
+            cap = grown;
+        }
+        starts[count] = r;
+        lens[count++] = len;
+        pos = r + (len > 0 ? len : 1);
+    }
+    if (count == 0) return NULL;
+
+    /* the set lives on in the undo history, so it keeps no spare room */
+    starts = mem_realloc(MEM_HISTORY, starts, cap * sizeof(int), count * sizeof(int));
+    lens = mem_realloc(MEM_HISTORY, lens, cap * sizeof(int), count * sizeof(int));
+
+    /* A literal removes the same bytes every time; keep just one copy */
+    struct replaceSet *rs;
+    if (!re) {
+        mem_free(MEM_HISTORY, lens, count * sizeof(int));
+        rs = replace_set(count, starts, NULL, with, withlen);
+        rs->removed_len = sp->len;
+        rs->removed = mem_alloc(MEM_HISTORY, sp->len);
+        memcpy(rs->removed, sp->pat, sp->len);
+    } else {
+        rs = replace_set(count, starts, lens, with, withlen);
+        replace_save(rs, g);
+    }
+
+    replace_apply(g, rs, 0);
+    return rs;
+}
+
+struct replaceSet *replace_spans(struct gapbuf *g, const int *starts, const int *lens, int count,
+                                 const char *with, const int *withlens, int withlen) {
+    if (count == 0) return NULL;
+    int *s = mem_alloc(MEM_HISTORY, count * sizeof(int));
+    memcpy(s, starts, count * sizeof(int));
+    int removing = 0;
+    for (int i = 0; i < count; i++) removing |= lens[i];
+
+    /* inserting only: every match is the same zero bytes */
+    struct replaceSet *rs;
+    if (!removing) {
+        rs = replace_set(count, s, NULL, with, withlen);
+    } else {
+        int *l = mem_alloc(MEM_HISTORY, count * sizeof(int));
+        memcpy(l, lens, count * sizeof(int));
+        rs = replace_set(count, s, l, with, withlen);
+        replace_save(rs, g);
+    }
+    if (withlens) {
+        rs->withlens = mem_alloc(MEM_HISTORY, count * sizeof(int));
+        memcpy(rs->withlens, withlens, count * sizeof(int));
+    }
+
+    replace_apply(g, rs, 0);
+    return rs;
+}
+
+/* Edit the buffer in place from the last match back to the first, so the
+ * gap crosses the text between them once and no match moves before it is
+ * reached. Observers see it as one change of that stretch. */
+void replace_apply(struct gapbuf *g, struct replaceSet *rs, int undo) {
+    int n = rs->count;
+    int removed = rs->lens ? rs->removed_len : n * rs->removed_len;
+    int added = rs->withlens ? rs->withlen : n * rs->withlen;
+    int shift = added - removed;
+    int first = rs->starts[0];
+    int span = rs->starts[n - 1] + match_len(rs, n - 1) - first;
+
+    /* the starts are in the original text; in the replaced text each one
+     * has moved by the size change of the matches before it */
+    int before = shift;
+    int off = rs->removed_len, woff = rs->withlen;
+    gap_batch_begin(g);
+    for (int i = n - 1; i >= 0; i--) {
+        int mlen = match_len(rs, i), wlen = with_len(rs, i);
+        before -= wlen - mlen;
+        if (rs->lens) off -= mlen;
+        if (rs->withlens) woff -= wlen;
+        const char *with = rs->with + (rs->withlens ? woff : 0);
+        if (undo) {
+            gap_move(g, rs->starts[i] + before);
+            gap_delete_bytes(g, wlen);
+            gap_insert_bytes(g, rs->removed + (rs->lens ? off : 0), mlen);
+        } else {
+            gap_move(g, rs->starts[i]);
+            gap_delete_bytes(g, mlen);
+            gap_insert_bytes(g, with, wlen);
+        }
+    }
+    if (undo) {
+        gap_batch_end(g, first, span + shift, span);
+    } else {
+        gap_batch_end(g, first, span, span + shift);
+    }
+    gap_move(g, first);
+}
+
+void replace_free(struct replaceSet *rs) {
+    if (!rs) return;
+    mem_free(MEM_HISTORY, rs->starts, rs->count * sizeof(int));
+    mem_free(MEM_HISTORY, rs->lens, rs->count * sizeof(int));
+    mem_free(MEM_HISTORY, rs->removed, rs->lens ? rs->removed_len + 1 : rs->removed_len);
+    mem_free(MEM_HISTORY, rs->with, rs->withlen + 1);
+    mem_free(MEM_HISTORY, rs->withlens, rs->count * sizeof(int));
+    mem_free(MEM_HISTORY, rs, sizeof(struct replaceSet));
+}
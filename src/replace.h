@@ -0,0 +1,39 @@
+/* replace.h - Replace every match in a single pass over the buffer */
+#ifndef REPLACE_H
+#define REPLACE_H
+
+#include "buffer.h"
+#include "search.h"
+#include "regex.h"
+
+/* Everything needed to redo a replace-all or take it back */
+struct replaceSet {
+    int count;
+    int *starts;        /* match starts in the original text */
+    int *lens;          /* match lengths, NULL when every match is `removed` */
+    char *removed;      /* original bytes of the matches, concatenated */
+    int removed_len;
+    char *with;
+    int withlen;
+    int *withlens;      /* each match's share of `with`, NULL when every
+                         * match is replaced by all of it */
+};
+
+/* Replace every non-overlapping match of a literal (re == NULL) or a
+ * regex. Returns NULL and leaves the buffer alone if nothing matched. */
+struct replaceSet *replace_all(struct gapbuf *g, const struct searchPattern *sp,
+                               struct regex *re, const char *with, int withlen);
+
+/* Replace the lens[i] bytes at each of count ascending, non-overlapping
+ * starts with with, or with the next withlens[i] bytes of it, as one
+ * edit. Returns the set for undo. */
+struct replaceSet *replace_spans(struct gapbuf *g, const int *starts, const int *lens, int count,
+                                 const char *with, const int *withlens, int withlen);
+
+/* Put every replacement in place, or take them back if undo is set */
+void replace_apply(struct gapbuf *g, struct replaceSet *rs, int undo);
+
+/* Free a replace set */
+void replace_free(struct replaceSet *rs);
+
+#endif /* REPLACE_H */
@@ -0,0 +1,197 @@
+/* search.c - Literal search implementation */
+#include "search.h"
+#include "buffer.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Matches crossing the gap are checked in a small window copied out of
+ * the buffer; patterns up to this size use a stack window. */
+#define SEARCH_WINDOW 256
+
+void search_compile(struct searchPattern *sp, const char *pat, int len) {
+    sp->pat = pat;
+    sp->len = len;
+    for (int c = 0; c < 256; c++) {
+        sp->skip[c] = len;
+        sp->rskip[c] = len;
+    }
+    for (int i = 0; i < len - 1; i++) {
+        sp->skip[(unsigned char)pat[i]] = len - 1 - i;
+    }
+    for (int i = len - 1; i > 0; i--) {
+        sp->rskip[(unsigned char)pat[i]] = i;
+    }
+}
+
+static int horspool_find(const char *s, int n, int from, const struct searchPattern *sp) {
+    int m = sp->len;
+    unsigned char last = sp->pat[m - 1];
+    int i = from;
+
+    while (i <= n - m) {
+        unsigned char c = s[i + m - 1];
+        if (c == last && memcmp(s + i, sp->pat, m - 1) == 0) return i;
+        i += sp->skip[c];
+    }
+    return -1;
+}
+
+/* memchr on the first byte is vectorized by libc and wins as long as
+ * candidates are rare. When false hits get dense (a common first byte),
+ * fall back to Horspool for the rest of the span. */
+int search_span(const char *s, int n, const struct searchPattern *sp) {
+    int m = sp->len;
+    if (m == 0 || n < m) return -1;
+
+    const char *p = s;
+    const char *end = s + n - m + 1;
+    int misses = 0;
+
+    while (p < end) {
+        p = memchr(p, sp->pat[0], end - p);
+        if (!p) return -1;
+        if (memcmp(p + 1, sp->pat + 1, m - 1) == 0) return p - s;
+        p++;
+        if (++misses > 64 && (p - s) < misses * 32) {
+            return horspool_find(s, n, p - s, sp);
+        }
+    }
+    return -1;
+}
+
+/* There is no memrchr in C99, so scan backward a word at a time and
+ * only drop to bytes once a word is known to hold c. */
+static const char *reverse_memchr(const char *s, unsigned char c, int n) {
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t highs = 0x8080808080808080ull;
+    const uint64_t rep = ones * c;
+    const char *p = s + n;
+
+    while (p > s && ((uintptr_t)p & 7)) {
+        if ((unsigned char)*--p == c) return p;
+    }
+    while (p - s >= 8) {
+        uint64_t w;
+        memcpy(&w, p - 8, 8);
+        w ^= rep;
+        if ((w - ones) & ~w & highs) break;
+        p -= 8;
+    }
+    while (p > s) {
+        if ((unsigned char)*--p == c) return p;
+    }
+    return NULL;
+}
+
+static int horspool_find_reverse(const char *s, int from, const struct searchPattern *sp) {
+    int m = sp->len;
+    unsigned char first = sp->pat[0];
+    int i = from;
+
+    while (i >= 0) {
+        unsigned char c = s[i];
+        if (c == first && memcmp(s + i + 1, sp->pat + 1, m - 1) == 0) return i;
+        i -= sp->rskip[c];
+    }
+    return -1;
+}
+
+/* Mirror image of search_span: latest match in the span */
+static int search_span_reverse(const char *s, int n, const struct searchPattern *sp) {
+    int m = sp->len;
+    if (m == 0 || n < m) return -1;
+
+    int limit = n - m + 1;      /* candidate starts are [0, limit) */
+    int misses = 0;
+
+    while (limit > 0) {
+        const char *p = reverse_memchr(s, sp->pat[0], limit);
+        if (!p) return -1;
+        if (memcmp(p + 1, sp->pat + 1, m - 1) == 0) return p - s;
+        limit = p - s;
+        if (++misses > 64 && (n - limit) < misses * 32) {
+            return horspool_find_reverse(s, limit - 1, sp);
+        }
+    }
+    return -1;
+}
+
+/* Search the logical range [ws, we) around the gap, which only ever
+ * holds matches that straddle it. */
+static int search_window(struct gapbuf *g, const struct searchPattern *sp, int ws, int we, int reverse) {
+    int n = we - ws;
+    if (n < sp->len || ws >= g->gap_start || we <= g->gap_start) return -1;
+
+    char stack[2 * SEARCH_WINDOW];
+    char *win = n <= (int)sizeof(stack) ? stack : malloc(n);
+    int split = g->gap_start - ws;
+    memcpy(win, g->buf + ws, split);
+    memcpy(win + split, g->buf + g->gap_end, n - split);
+
+    int r = reverse ? search_span_reverse(win, n, sp) : search_span(win, n, sp);
+    if (win != stack) free(win);
+    return r >= 0 ? ws + r : -1;
+}
+
+int search_range(struct gapbuf *g, const struct searchPattern *sp, int from, int to) {
+    int m = sp->len;
+    int len = gap_length(g);
+    int gs = g->gap_start;
+    if (m == 0) return -1;
+    if (from < 0) from = 0;
+    if (to > len - m + 1) to = len - m + 1;
+    if (from >= to) return -1;
+
+    int limit = to + m - 1;     /* last byte a match may touch, exclusive */
+
+    if (from < gs) {
+        int n = (limit < gs ? limit : gs) - from;
+        int r = search_span(g->buf + from, n, sp);
+        if (r >= 0) return from + r;
+
+        int ws = gs - (m - 1);
+        int we = gs + (m - 1);
+        if (ws < from) ws = from;
+        if (we > limit) we = limit;
+        r = search_window(g, sp, ws, we, 0);
+        if (r >= 0) return r;
+        from = gs;
+    }
+
+    if (from >= to) return -1;
+    int r = search_span(g->buf + g->gap_end + (from - gs), limit - from, sp);
+    return r >= 0 ? from + r : -1;
+}
+
+int search_forward(struct gapbuf *g, const struct searchPattern *sp, int from) {
+    return search_range(g, sp, from, gap_length(g));
+}
+
+int search_backward(struct gapbuf *g, const struct searchPattern *sp, int before) {
+    int m = sp->len;
+    int len = gap_length(g);
+    int gs = g->gap_start;
+    if (m == 0) return -1;
+    if (before > len - m + 1) before = len - m + 1;
+    if (before <= 0) return -1;
+
+    /* starts in [gs, before) lie entirely after the gap */
+    if (before > gs) {
+        int r = search_span_reverse(g->buf + g->gap_end, before - gs + m - 1, sp);
+        if (r >= 0) return gs + r;
+        before = gs;
+    }
+
+    int ws = gs - (m - 1);
+    int we = before + (m - 1);
+    if (ws < 0) ws = 0;
+    if (we > gs + (m - 1)) we = gs + (m - 1);
+    if (we > len) we = len;
+    int r = search_window(g, sp, ws, we, 1);
+    if (r >= 0) return r;
+
+    int n = before + m - 1;
+    if (n > gs) n = gs;
+    return search_span_reverse(g->buf, n, sp);
+}
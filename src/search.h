@@ -0,0 +1,29 @@
+/* search.h - Literal text search over the gap buffer */
+#ifndef SEARCH_H
+#define SEARCH_H
+
+struct gapbuf;
+
+struct searchPattern {
+    const char *pat;
+    int len;
+    int skip[256];      /* Horspool shifts, scanning forward */
+    int rskip[256];     /* Horspool shifts, scanning backward */
+};
+
+/* Precompute shift tables; pat must stay alive while the pattern is used */
+void search_compile(struct searchPattern *sp, const char *pat, int len);
+
+/* Find first match starting at or after from, -1 if none */
+int search_forward(struct gapbuf *g, const struct searchPattern *sp, int from);
+
+/* Find first match starting in [from, to) without reading past it, -1 if none */
+int search_range(struct gapbuf *g, const struct searchPattern *sp, int from, int to);
+
+/* Find last match starting before the given position, -1 if none */
+int search_backward(struct gapbuf *g, const struct searchPattern *sp, int before);
+
+/* Search a single contiguous span, -1 if none */
+int search_span(const char *s, int n, const struct searchPattern *sp);
+
+#endif /* SEARCH_H */
@@ -0,0 +1,577 @@
+/* searchindex.c - Background match indexing implementation */
+#define _POSIX_C_SOURCE 200809L
+
+#include "searchindex.h"
+#include "memstat.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Bytes scanned between merges, and copied per lock hold */
+#define SCAN_CHUNK (1024 * 1024)
+
+static int lower_bound(const int *a, int n, int pos) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (a[mid] < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* -------- matches -------- */
+/* Where chunk j's offsets count from, in text of length len */
+static int chunk_base(struct searchIndex *si, int j, int len) {
+    return j < si->split ? si->chunks[j].base : len - si->chunks[j].base;
+}
+
+static int chunk_first(struct searchIndex *si, int j, int len) {
+    return chunk_base(si, j, len) + si->chunks[j].off[0];
+}
+
+static int chunk_last(struct searchIndex *si, int j, int len) {
+    return chunk_base(si, j, len) + si->chunks[j].off[si->chunks[j].count - 1];
+}
+
+static int match_len(struct searchIndex *si, int j, int i) {
+    return si->re ? si->chunks[j].lens[i] : si->sp.len;
+}
+
+/* Chunks before k count from the start, the rest from the end */
+static void move_split(struct searchIndex *si, int k, int len) {
+    while (si->split < k) {
+        struct matchChunk *c = &si->chunks[si->split++];
+        c->base = len - c->base;
+    }
+    while (si->split > k) {
+        struct matchChunk *c = &si->chunks[--si->split];
+        c->base = len - c->base;
+    }
+}
+
+/* Number of chunks whose first match, or last if last is set, is before pos */
+static int chunks_before(struct searchIndex *si, int pos, int last, int len) {
+    int lo = 0, hi = si->nchunks;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int p = last ? chunk_last(si, mid, len) : chunk_first(si, mid, len);
+        if (p < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Chunk of the first match at or after pos, nchunks if none, with the
+ * match's index in it in *idx */
+static int seek_match(struct searchIndex *si, int pos, int *idx) {
+    int len = gap_length(si->g);
+    int j = chunks_before(si, pos, 1, len);
+    *idx = 0;
+    if (j < si->nchunks) {
+        struct matchChunk *c = &si->chunks[j];
+        *idx = lower_bound(c->off, c->count, pos - chunk_base(si, j, len));
+    }
+    return j;
+}
+
+/* An empty chunk at j, counting from base */
+static struct matchChunk *insert_chunk(struct searchIndex *si, int j, int base, int len) {
+    if (si->nchunks == si->chunkcap) {
+        int cap = si->chunkcap ? si->chunkcap * 2 : 16;
+        si->chunks = mem_realloc(MEM_SEARCH, si->chunks, si->chunkcap * sizeof(*si->chunks),
+                                 cap * sizeof(*si->chunks));
+        si->chunkcap = cap;
+    }
+    memmove(si->chunks + j + 1, si->chunks + j, (si->nchunks - j) * sizeof(*si->chunks));
+    si->nchunks++;
+    if (j < si->split) si->split++;
+    struct matchChunk *c = &si->chunks[j];
+    c->base = j < si->split ? base : len - base;
+    c->count = 0;
+    c->off = mem_alloc(MEM_SEARCH, MATCH_CHUNK * sizeof(int));
+    c->lens = si->re ? mem_alloc(MEM_SEARCH, MATCH_CHUNK * sizeof(int)) : NULL;
+    return c;
+}
+
+static void free_chunk(struct matchChunk *c) {
+    mem_free(MEM_SEARCH, c->off, MATCH_CHUNK * sizeof(int));
+    mem_free(MEM_SEARCH, c->lens, MATCH_CHUNK * sizeof(int));
+}
+
+static void remove_chunk(struct searchIndex *si, int j) {
+    free_chunk(&si->chunks[j]);
+    memmove(si->chunks + j, si->chunks + j + 1, (si->nchunks - j - 1) * sizeof(*si->chunks));
+    si->nchunks--;
+    if (j < si->split) si->split--;
+}
+
+/* Move the top half of full chunk j into a new chunk after it */
+static void split_chunk(struct searchIndex *si, int j, int len) {
+    struct matchChunk *c = insert_chunk(si, j + 1, chunk_base(si, j, len), len);
+    struct matchChunk *full = &si->chunks[j];
+    int half = MATCH_CHUNK / 2;
+    memcpy(c->off, full->off + half, half * sizeof(int));
+    if (si->re) memcpy(c->lens, full->lens + half, half * sizeof(int));
+    c->count = full->count = half;
+}
+
+static int add_match(struct searchIndex *si, int pos, int len) {
+    int textlen = gap_length(si->g);
+    int j = chunks_before(si, pos + 1, 0, textlen) - 1;
+    if (j < 0) j = 0;
+    struct matchChunk *c = j < si->nchunks ? &si->chunks[j] : NULL;
+    int i = 0;
+    if (c) {
+        i = lower_bound(c->off, c->count, pos - chunk_base(si, j, textlen));
+        if (i < c->count && chunk_base(si, j, textlen) + c->off[i] == pos) return 1;
+    }
+    if (si->count == SEARCH_INDEX_MAX) {
+        si->truncated = 1;
+        return 0;
+    }
+    if (!c || (c->count == MATCH_CHUNK && i == MATCH_CHUNK)) {
+        /* past the end of a full chunk, as when scanning on: start another */
+        j = c ? j + 1 : 0;
+        c = insert_chunk(si, j, pos, textlen);
+        i = 0;
+    } else if (c->count == MATCH_CHUNK) {
+        split_chunk(si, j, textlen);
+        if (i > MATCH_CHUNK / 2) {
+            j++;
+            i -= MATCH_CHUNK / 2;
+        }
+        c = &si->chunks[j];
+    }
+    memmove(c->off + i + 1, c->off + i, (c->count - i) * sizeof(int));
+    c->off[i] = pos - chunk_base(si, j, textlen);
+    if (si->re) {
+        memmove(c->lens + i + 1, c->lens + i, (c->count - i) * sizeof(int));
+        c->lens[i] = len;
+    }
+    c->count++;
+    if (len > si->maxlen) si->maxlen = len;
+    si->count++;
+    return 1;
+}
+
+/* Drop the matches starting in [lo_pos, hi_pos) of the text before an
+ * edit that changed its length by delta, and shift later ones */
+static void drop_matches(struct searchIndex *si, int lo_pos, int hi_pos, int delta) {
+    int len = gap_length(si->g) - delta;
+    /* chunks from k on move along with the end of the text */
+    int k = chunks_before(si, hi_pos, 0, len);
+    move_split(si, k, len);
+    for (int j = k - 1; j >= 0 && chunk_last(si, j, len) >= lo_pos; j--) {
+        struct matchChunk *c = &si->chunks[j];
+        int lo = lower_bound(c->off, c->count, lo_pos - c->base);
+        int hi = lower_bound(c->off, c->count, hi_pos - c->base);
+        memmove(c->off + lo, c->off + hi, (c->count - hi) * sizeof(int));
+        if (si->re) memmove(c->lens + lo, c->lens + hi, (c->count - hi) * sizeof(int));
+        c->count -= hi - lo;
+        si->count -= hi - lo;
+        for (int i = lo; i < c->count; i++) {
+            c->off[i] += delta;
+        }
+        if (c->count == 0) remove_chunk(si, j);
+    }
+}
+
+/* Give back every chunk */
+static void drop_chunks(struct searchIndex *si) {
+    for (int j = 0; j < si->nchunks; j++) {
+        free_chunk(&si->chunks[j]);
+    }
+    si->nchunks = si->split = si->count = 0;
+}
+
+static void add_dirty(struct searchIndex *si, int start, int end) {
+    if (start >= end) return;
+    if (si->ndirty == si->dirtycap) {
+        int cap = si->dirtycap ? si->dirtycap * 2 : 16;
+        si->dirty = mem_realloc(MEM_SEARCH, si->dirty, si->dirtycap * sizeof(*si->dirty),
+                                cap * sizeof(*si->dirty));
+        si->dirtycap = cap;
+    }
+    si->dirty[si->ndirty].start = start;
+    si->dirty[si->ndirty].end = end;
+    si->ndirty++;
+}
+
+/* -------- scanning -------- */
+static void add_found(struct searchIndex *si, int pos, int len) {
+    if (si->nfound == si->found_cap) {
+        int cap = si->found_cap ? si->found_cap * 2 : 1024;
+        si->found = mem_realloc(MEM_SEARCH, si->found, si->found_cap * sizeof(int), cap * sizeof(int));
+        si->found_lens = mem_realloc(MEM_SEARCH, si->found_lens, si->found_cap * sizeof(int),
+                                     cap * sizeof(int));
+        si->found_cap = cap;
+    }
+    si->found[si->nfound] = pos;
+    si->found_lens[si->nfound++] = len;
+}
+
+static void snapshot_drop(struct searchIndex *si) {
+    mem_free(MEM_SEARCH, si->snap, si->snap_cap);
+    si->snap = NULL;
+    si->snap_cap = si->snap_len = 0;
+}
+
+/* Copy the text a scan of [from, to) reads: a byte before it, for
+ * anchors, and after it as far as a match starting in it can reach.
+ * A copy that already covers it is kept. The copy is made SCAN_CHUNK
+ * bytes per lock hold; returns 0 if the text changed in between. */
+static int snapshot_take(struct searchIndex *si, int from, int to) {
+    int len = gap_length(si->g);
+    int lo = from > 0 ? from - 1 : 0;
+    int hi = to + si->sp.len - 1;
+    if (si->re) {
+        hi = regex_multiline(si->re) ? len : gap_line_end(si->g, gap_line_of(si->g, to)) + 1;
+    }
+    if (hi > len) hi = len;
+    if (si->snap_edits == si->edits && si->snap && lo >= si->snap_start &&
+        hi <= si->snap_start + si->snap_len) {
+        return 1;
+    }
+
+    if (hi - lo > si->snap_cap) {
+        mem_free(MEM_SEARCH, si->snap, si->snap_cap);
+        si->snap = mem_alloc(MEM_SEARCH, hi - lo);
+        si->snap_cap = hi - lo;
+    }
+    unsigned long edits = si->edits;
+    si->snap_start = lo;
+    si->snap_len = 0;
+    for (;;) {
+        int n = hi - lo - si->snap_len < SCAN_CHUNK ? hi - lo - si->snap_len : SCAN_CHUNK;
+        gap_get_range(si->g, lo + si->snap_len, n, si->snap + si->snap_len);
+        si->snap_len += n;
+        if (si->snap_len == hi - lo) break;
+
+        pthread_mutex_unlock(&si->lock);
+        pthread_mutex_lock(&si->lock);
+        if (si->edits != edits || si->quit) {
+            si->snap_len = 0;
+            return 0;
+        }
+    }
+    si->snap_edits = edits;
+    return 1;
+}
+
+/* Find the matches starting in [from, to) in the copy of the text.
+ * Literal matches may overlap; regex matches do not, so a match running
+ * past `to` pushes the point where scanning resumes. Returns that point. */
+static int scan_range(struct searchIndex *si, int from, int to) {
+    struct gapbuf view;     /* read-only view so the search code can scan the copy */
+    memset(&view, 0, sizeof(view));
+    view.buf = si->snap;
+    view.cap = view.gap_start = view.gap_end = si->snap_len;
+    int base = si->snap_start;
+
+    si->nfound = 0;
+    int next = to;
+    for (;;) {
+        int r, len = si->sp.len;
+        if (si->re) r = regex_search_range(si->re, &view, from - base, to - base, &len);
+        else r = search_range(&view, &si->sp, from - base, to - base);
+        if (r < 0) return next;
+        r += base;
+        add_found(si, r, len);
+        from = si->re ? r + (len > 0 ? len : 1) : r + 1;
+        if (from > next) next = from;
+    }
+}
+
+static int scan_complete(struct searchIndex *si) {
+    return si->ndirty == 0 && !si->truncated && si->scan_pos >= gap_length(si->g);
+}
+
+/* Scan the newest dirty range, or else the text past scan_pos, a chunk
+ * at a time. Only copying the text and merging the matches hold the
+ * lock; a chunk the text changed under is scanned again. */
+static void *search_index_worker(void *arg) {
+    struct searchIndex *si = arg;
+
+    pthread_mutex_lock(&si->lock);
+    while (!si->quit) {
+        if (!si->query || si->truncated || scan_complete(si)) {
+            snapshot_drop(si);
+            pthread_cond_wait(&si->wake, &si->lock);
+            continue;
+        }
+
+        int dirty = si->ndirty > 0;
+        int from, to;
+        if (dirty) {
+            struct dirtyRange *d = &si->dirty[si->ndirty - 1];
+            from = d->start;
+            to = d->end - d->start > SCAN_CHUNK ? d->start + SCAN_CHUNK : d->end;
+        } else {
+            int len = gap_length(si->g);
+            from = si->scan_pos;
+            to = from + SCAN_CHUNK < len ? from + SCAN_CHUNK : len;
+        }
+        if (!snapshot_take(si, from, to)) continue;
+
+        unsigned long edits = si->edits;
+        si->scanning = 1;
+        pthread_mutex_unlock(&si->lock);
+        int next = scan_range(si, from, to);
+        pthread_mutex_lock(&si->lock);
+        si->scanning = 0;
+        pthread_cond_broadcast(&si->idle);
+        if (si->edits != edits) continue;
+
+        for (int i = 0; i < si->nfound; i++) {
+            if (!add_match(si, si->found[i], si->found_lens[i])) break;
+        }
+        if (dirty) {
+            struct dirtyRange *d = &si->dirty[si->ndirty - 1];
+            if (to < d->end && next < d->end) d->start = next;
+            else si->ndirty--;
+        } else {
+            si->scan_pos = next;
+        }
+    }
+    pthread_mutex_unlock(&si->lock);
+    return NULL;
+}
+
+/* -------- buffer observer -------- */
+static void search_index_lock(void *arg) {
+    pthread_mutex_lock(&((struct searchIndex *)arg)->lock);
+}
+
+static void search_index_unlock(void *arg) {
+    pthread_mutex_unlock(&((struct searchIndex *)arg)->lock);
+}
+
+static int shift_point(int p, int pos, int removed, int delta) {
+    if (p <= pos) return p;
+    if (p >= pos + removed) return p + delta;
+    return pos;
+}
+
+/* Forget every match and scan again from the start */
+static void search_index_reset(struct searchIndex *si) {
+    si->edits++;
+    drop_chunks(si);
+    si->maxlen = si->sp.len;
+    si->truncated = 0;
+    si->scan_pos = 0;
+    si->ndirty = 0;
+}
+
+/* Give back the match arrays of an index that has no query */
+static void search_index_release(struct searchIndex *si) {
+    drop_chunks(si);
+    mem_free(MEM_SEARCH, si->chunks, si->chunkcap * sizeof(*si->chunks));
+    mem_free(MEM_SEARCH, si->dirty, si->dirtycap * sizeof(*si->dirty));
+    si->chunks = NULL;
+    si->dirty = NULL;
+    si->chunkcap = si->dirtycap = 0;
+}
+
+/* Keep the index valid across an edit without rescanning: matches that
+ * touched the edited bytes are dropped, later ones shift by the size
+ * change, and the few starts that could form new matches are queued. */
+static void search_index_changed(void *arg, int pos, int removed, int inserted) {
+    struct searchIndex *si = arg;
+    si->edits++;
+    if (!si->query) return;
+
+    int m = si->sp.len;
+    int delta = inserted - removed;
+    int start = pos - m + 1;
+    int end = pos + inserted;
+
+    if (si->re) {
+        /* A regex match can't be bounded by the pattern length, but one
+         * that never spans a newline is confined to the edited lines. */
+        if (regex_multiline(si->re)) {
+            search_index_reset(si);
+            pthread_cond_signal(&si->wake);
+            return;
+        }
+        start = gap_rfind_char(si->g, '\n', pos) + 1;
+        end = gap_find_char(si->g, '\n', pos + inserted);
+        if (end < 0) end = gap_length(si->g);
+        drop_matches(si, start, end - delta + 1, delta);
+        end++;
+    } else {
+        drop_matches(si, pos - m + 1, pos + removed, delta);
+    }
+
+    for (int i = 0; i < si->ndirty; i++) {
+        si->dirty[i].start = shift_point(si->dirty[i].start, pos, removed, delta);
+        si->dirty[i].end = shift_point(si->dirty[i].end, pos, removed, delta);
+    }
+    si->scan_pos = shift_point(si->scan_pos, pos, removed, delta);
+
+    /* Regex matches don't overlap, so each rescan has to begin where a
+     * full scan would: merge overlapping line ranges and never resume
+     * the main scan in the middle of one. */
+    if (si->re) {
+        if (si->scan_pos > start && si->scan_pos < end) si->scan_pos = end;
+        for (int i = 0; i < si->ndirty; i++) {
+            if (si->dirty[i].start < end && si->dirty[i].end > start) {
+                if (si->dirty[i].start < start) start = si->dirty[i].start;
+                if (si->dirty[i].end > end) end = si->dirty[i].end;
+                si->dirty[i--] = si->dirty[--si->ndirty];
+            }
+        }
+    }
+
+    /* anything at or past scan_pos is still ahead of the worker */
+    if (start < 0) start = 0;
+    if (end > si->scan_pos) end = si->scan_pos;
+    add_dirty(si, start, end);
+    pthread_cond_signal(&si->wake);
+}
+
+/* -------- public interface -------- */
+/* The pattern is about to change: wait out a scan that is using it */
+static void search_index_wait_idle(struct searchIndex *si) {
+    while (si->scanning) pthread_cond_wait(&si->idle, &si->lock);
+}
+
+void search_index_init(struct searchIndex *si, struct gapbuf *g) {
+    memset(si, 0, sizeof(*si));
+    pthread_mutex_init(&si->lock, NULL);
+    pthread_cond_init(&si->wake, NULL);
+    pthread_cond_init(&si->idle, NULL);
+    si->g = g;
+    si->obs.lock = search_index_lock;
+    si->obs.unlock = search_index_unlock;
+    si->obs.changed = search_index_changed;
+    si->obs.arg = si;
+    g->obs = &si->obs;
+}
+
+void search_index_free(struct searchIndex *si) {
+    pthread_mutex_lock(&si->lock);
+    si->quit = 1;
+    pthread_cond_signal(&si->wake);
+    pthread_mutex_unlock(&si->lock);
+    if (si->running) pthread_join(si->thread, NULL);
+
+    if (si->g->obs == &si->obs) si->g->obs = NULL;
+    pthread_mutex_destroy(&si->lock);
+    pthread_cond_destroy(&si->wake);
+    pthread_cond_destroy(&si->idle);
+    free(si->query);
+    regex_free(si->re);
+    search_index_release(si);
+    snapshot_drop(si);
+    mem_free(MEM_SEARCH, si->found, si->found_cap * sizeof(int));
+    mem_free(MEM_SEARCH, si->found_lens, si->found_cap * sizeof(int));
+}
+
+int search_index_set_query(struct searchIndex *si, const char *query, int len, int regex) {
+    struct regex *re = NULL;
+    if (regex && len > 0) re = regex_compile(query, len, NULL);
+    if (len <= 0 || (regex && !re)) {
+        search_index_clear(si);
+        return len <= 0 ? 0 : -1;
+    }
+
+    pthread_mutex_lock(&si->lock);
+    search_index_wait_idle(si);
+    free(si->query);
+    si->query = malloc(len);
+    memcpy(si->query, query, len);
+    search_index_reset(si);
+    regex_free(si->re);
+    si->re = re;
+    search_compile(&si->sp, si->query, re ? 0 : len);
+    if (!si->running) {
+        si->running = pthread_create(&si->thread, NULL, search_index_worker, si) == 0;
+    }
+    pthread_cond_signal(&si->wake);
+    pthread_mutex_unlock(&si->lock);
+    return 0;
+}
+
+void search_index_clear(struct searchIndex *si) {
+    pthread_mutex_lock(&si->lock);
+    search_index_wait_idle(si);
+    free(si->query);
+    si->query = NULL;
+    regex_free(si->re);
+    si->re = NULL;
+    search_index_reset(si);
+    search_index_release(si);
+    pthread_mutex_unlock(&si->lock);
+}
+
+int search_index_count(struct searchIndex *si, int *complete) {
+    pthread_mutex_lock(&si->lock);
+    int count = si->count;
+    if (complete) *complete = si->query && scan_complete(si);
+    pthread_mutex_unlock(&si->lock);
+    return count;
+}
+
+int search_index_next(struct searchIndex *si, int pos, int *mlen) {
+    int r = -2;
+    pthread_mutex_lock(&si->lock);
+    if (si->query && si->ndirty == 0) {
+        int i, j = seek_match(si, pos, &i);
+        if (j < si->nchunks) {
+            r = chunk_base(si, j, gap_length(si->g)) + si->chunks[j].off[i];
+            *mlen = match_len(si, j, i);
+        } else if (scan_complete(si)) {
+            r = -1;
+        }
+    }
+    pthread_mutex_unlock(&si->lock);
+    return r;
+}
+
+int search_index_prev(struct searchIndex *si, int pos, int *mlen) {
+    int r = -2;
+    pthread_mutex_lock(&si->lock);
+    if (si->query && si->ndirty == 0 && (pos <= si->scan_pos || scan_complete(si))) {
+        int i, j = seek_match(si, pos, &i);
+        if (i == 0 && j > 0) i = si->chunks[--j].count;
+        r = -1;
+        if (i > 0) {
+            r = chunk_base(si, j, gap_length(si->g)) + si->chunks[j].off[i - 1];
+            *mlen = match_len(si, j, i - 1);
+        }
+    }
+    pthread_mutex_unlock(&si->lock);
+    return r;
+}
+
+int search_index_ordinal(struct searchIndex *si, int pos) {
+    int ord = 0;
+    pthread_mutex_lock(&si->lock);
+    int i, j = seek_match(si, pos, &i);
+    if (j < si->nchunks && chunk_base(si, j, gap_length(si->g)) + si->chunks[j].off[i] == pos) {
+        ord = i + 1;
+        while (j > 0) ord += si->chunks[--j].count;
+    }
+    pthread_mutex_unlock(&si->lock);
+    return ord;
+}
+
+int search_index_collect(struct searchIndex *si, int from, int to, int *starts, int *lens, int max) {
+    int n = 0;
+    pthread_mutex_lock(&si->lock);
+    if (si->query) {
+        int len = gap_length(si->g);
+        int i, j = seek_match(si, from - si->maxlen + 1, &i);
+        for (; j < si->nchunks && n < max; j++, i = 0) {
+            struct matchChunk *c = &si->chunks[j];
+            int base = chunk_base(si, j, len);
+            for (; i < c->count && base + c->off[i] < to && n < max; i++) {
+                starts[n] = base + c->off[i];
+                lens[n++] = match_len(si, j, i);
+            }
+            if (i < c->count) break;
+        }
+    }
+    pthread_mutex_unlock(&si->lock);
+    return n;
+}
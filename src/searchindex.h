@@ -0,0 +1,97 @@
+/* searchindex.h - Background index of all search matches */
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <pthread.h>
+
+#include "buffer.h"
+#include "search.h"
+#include "regex.h"
+
+/* Range of match starts that an edit may have created and that still
+ * has to be rescanned */
+struct dirtyRange {
+    int start, end;
+};
+
+/* Up to MATCH_CHUNK sorted match starts, as offsets from base */
+struct matchChunk {
+    int base;
+    int count;
+    int *off;
+    int *lens;              /* match lengths, regex queries only */
+};
+
+#define MATCH_CHUNK 1024
+
+struct searchIndex {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;    /* signalled when the worker stops scanning */
+    pthread_t thread;
+    int running;
+    int quit;
+    int scanning;           /* the worker is using the pattern without the lock */
+    unsigned long edits;    /* bumped by every change to the text or the query */
+    struct gapbuf *g;
+    struct gapObserver obs;
+
+    char *query;
+    struct searchPattern sp;
+    struct regex *re;       /* set when the query is a regular expression */
+
+    /* The matches in order, split at the last edit like the line index:
+     * bases of the chunks before split are offsets from the start, the
+     * rest distances from the end, so an edit only renumbers the chunks
+     * it lands in */
+    struct matchChunk *chunks;
+    int nchunks, chunkcap;
+    int split;
+    int count;
+    int maxlen;             /* longest match seen since the query was set */
+    int truncated;          /* stopped collecting at SEARCH_INDEX_MAX */
+    int scan_pos;           /* everything before this has been scanned */
+    struct dirtyRange *dirty;
+    int ndirty, dirtycap;
+
+    /* The worker scans a copy of the text, made under the lock, and
+     * takes the lock again only to merge what it found */
+    char *snap;
+    int snap_start, snap_len, snap_cap;
+    unsigned long snap_edits;   /* edits when the copy was made */
+    int *found, *found_lens;
+    int nfound, found_cap;
+};
+
+#define SEARCH_INDEX_MAX (16 * 1024 * 1024)
+
+/* Attach an (empty) index to a buffer */
+void search_index_init(struct searchIndex *si, struct gapbuf *g);
+
+/* Stop the worker and release everything */
+void search_index_free(struct searchIndex *si);
+
+/* Start indexing a new query, dropping the old matches. Returns -1 if
+ * regex is set and the query does not compile. */
+int search_index_set_query(struct searchIndex *si, const char *query, int len, int regex);
+
+/* Forget the query and all matches */
+void search_index_clear(struct searchIndex *si);
+
+/* Number of matches found so far; *complete is set once the scan is done */
+int search_index_count(struct searchIndex *si, int *complete);
+
+/* First match at or after pos (-1 if none, -2 if not indexed yet);
+ * its length is stored in *mlen */
+int search_index_next(struct searchIndex *si, int pos, int *mlen);
+
+/* Last match before pos (-1 if none, -2 if not indexed yet) */
+int search_index_prev(struct searchIndex *si, int pos, int *mlen);
+
+/* 1-based position of the match starting at pos, 0 if pos is not a match */
+int search_index_ordinal(struct searchIndex *si, int pos);
+
+/* Copy up to max matches that touch [from, to) into starts and lens */
+int search_index_collect(struct searchIndex *si, int from, int to, int *starts, int *lens, int max);
+
+#endif /* SEARCHINDEX_H */
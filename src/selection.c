@@ -2,6 +2,9 @@
 #include "selection.h"
 #include "buffer.h"
 #include "history.h"
+#include "memstat.h"
+#include "replace.h"
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -9,6 +12,7 @@ void selection_start(struct selection *sel, int row, int col) {
     sel->active = 1;
     sel->start_row = sel->end_row = row;
     sel->start_col = sel->end_col = col;
+    sel->block = 0;
 }
 
 void selection_update(struct selection *sel, int row, int col) {
@@ -20,8 +24,21 @@ void selection_clear(struct selection *sel) {
     sel->active = 0;
 }
 
-int selection_contains(struct selection *sel, int row, int col) {
-    if (!sel->active) return 0;
+/* Rows top..bottom and columns [left, right) of a block selection */
+static void block_bounds(struct selection *sel, int *top, int *bottom, int *left, int *right) {
+    *top = sel->start_row < sel->end_row ? sel->start_row : sel->end_row;
+    *bottom = sel->start_row < sel->end_row ? sel->end_row : sel->start_row;
+    *left = sel->start_col < sel->end_col ? sel->start_col : sel->end_col;
+    *right = sel->start_col < sel->end_col ? sel->end_col : sel->start_col;
+}
+
+void selection_bounds(struct selection *sel, struct selectionBounds *b) {
+    b->active = sel->active;
+    b->block = sel->block;
+    if (sel->block) {
+        block_bounds(sel, &b->top, &b->bottom, &b->left, &b->right);
+        return;
+    }
     
     int sr = sel->start_row, sc = sel->start_col;
     int er = sel->end_row, ec = sel->end_col;
@@ -31,56 +48,121 @@ int selection_contains(struct selection *sel, int row, int col) {
         int tmp = sr; sr = er; er = tmp;
         tmp = sc; sc = ec; ec = tmp;
     }
-    
-    if (row < sr || row > er) return 0;
-    if (row == sr && row == er) return col >= sc && col < ec;
-    if (row == sr) return col >= sc;
-    if (row == er) return col < ec;
-    return 1;
+    b->top = sr;
+    b->left = sc;
+    b->bottom = er;
+    b->right = ec;
 }
 
-void pos_to_rowcol(struct gapbuf *g, int pos, int *row, int *col) {
-    *row = 0;
-    *col = 0;
-    for (int i = 0; i < pos; i++) {
-        char c = gap_char_at(g, i);
-        if (c == '\n') {
-            (*row)++;
-            *col = 0;
-        } else {
-            (*col)++;
-        }
+void selection_row(const struct selectionBounds *b, int row, int *from, int *to) {
+    *from = *to = 0;
+    if (!b->active || row < b->top || row > b->bottom) return;
+    if (b->block) {
+        /* a zero-width block shows as a column of cursors */
+        *from = b->left;
+        *to = b->left == b->right ? b->left + 1 : b->right;
+        return;
     }
+    *from = row == b->top ? b->left : 0;
+    *to = row == b->bottom ? b->right : INT_MAX;
+}
+
+int selection_contains(struct selection *sel, int row, int col) {
+    struct selectionBounds b;
+    int from, to;
+    selection_bounds(sel, &b);
+    selection_row(&b, row, &from, &to);
+    return col >= from && col < to;
+}
+
+/* Both directions go through the buffer's line index: a row's start is
+ * a lookup and the row of an offset a bisection, never a scan */
+void pos_to_rowcol(struct gapbuf *g, int pos, int *row, int *col) {
+    *row = gap_line_of(g, pos);
+    *col = pos - gap_line_start(g, *row);
 }
 
 int rowcol_to_pos(struct gapbuf *g, int row, int col) {
-    int pos = 0;
-    int cur_row = 0;
-    int cur_col = 0;
-    int len = gap_length(g);
-    
-    while (pos < len && cur_row < row) {
-        if (gap_char_at(g, pos) == '\n') {
-            cur_row++;
-            cur_col = 0;
-        } else {
-            cur_col++;
-        }
-        pos++;
+    if (row >= gap_line_count(g)) return gap_length(g);
+    int pos = gap_line_start(g, row);
+    int eol = gap_line_end(g, row);
+    if (col < 0) col = 0;
+    return pos + col < eol ? pos + col : eol;
+}
+
+/* The block's screen columns on each of its rows, as byte spans that
+ * never split a character, widened by `before` characters to the left
+ * and `after` to the right and cut back to the end of short rows. Rows
+ * whose text ends before the block are skipped if skip_short is set.
+ * starts and lens need room for every row; returns the number of spans. */
+static int block_spans(struct selection *sel, struct colMap *cm, int before, int after,
+                       int skip_short, int *starts, int *lens) {
+    struct gapbuf *g = cm->g;
+    int top, bottom, left, right;
+    block_bounds(sel, &top, &bottom, &left, &right);
+    int lines = gap_line_count(g);
+    int n = 0;
+    for (int row = top; row <= bottom && row < lines; row++) {
+        int line = gap_line_start(g, row);
+        int len = gap_line_end(g, row) - line;
+        int from = line + colmap_pos(cm, line, len, left);
+        if (skip_short && from == line + len && colmap_col(cm, line, len, len) < left) continue;
+        int to = line + colmap_pos(cm, line, len, right);
+        for (int k = 0; k < before && from > line; k++) from = colmap_prev_char(g, from);
+        for (int k = 0; k < after && to < line + len; k++) to = colmap_next_char(g, to);
+        starts[n] = from;
+        lens[n] = to - from;
+        n++;
     }
+    return n;
+}
+
+static int block_rows(struct selection *sel) {
+    int rows = sel->start_row - sel->end_row;
+    return (rows < 0 ? -rows : rows) + 1;
+}
+
+/* The pinned text is about to change: copy it out while it is intact */
+static void clipboard_release(struct gapPin *pin, struct gapbuf *g) {
+    struct clipboard *clip = pin->arg;
+    clip->data = mem_alloc(MEM_CLIPBOARD, clip->len + 1);
+    gap_get_range(g, pin->start, clip->len, clip->data);
+    clip->data[clip->len] = '\0';
+    clip->src = NULL;
+}
+
+/* Block text is taken out row by row, so it is copied right away */
+static void clipboard_copy_block(struct clipboard *clip, struct selection *sel, struct colMap *cm) {
+    if (sel->start_col == sel->end_col) return;
+    struct gapbuf *g = cm->g;
+    int rows = block_rows(sel);
+    int *starts = malloc(2 * rows * sizeof(int));
+    int *lens = starts + rows;
+    int n = block_spans(sel, cm, 0, 0, 0, starts, lens);
     
-    while (pos < len && cur_col < col) {
-        char c = gap_char_at(g, pos);
-        if (c == '\n') break;
-        cur_col++;
-        pos++;
+    int total = n - 1;
+    for (int i = 0; i < n; i++) total += lens[i];
+    clipboard_free(clip);
+    clip->data = mem_alloc(MEM_CLIPBOARD, total + 1);
+    char *p = clip->data;
+    for (int i = 0; i < n; i++) {
+        if (i > 0) *p++ = '\n';
+        gap_get_range(g, starts[i], lens[i], p);
+        p += lens[i];
     }
-    
-    return pos;
+    *p = '\0';
+    clip->len = total;
+    clip->block = 1;
+    free(starts);
 }
 
-void clipboard_copy(struct clipboard *clip, struct selection *sel, struct gapbuf *g) {
+void clipboard_copy(struct clipboard *clip, struct selection *sel, struct colMap *cm) {
+    struct gapbuf *g = cm->g;
     if (!sel->active) return;
+    if (sel->block) {
+        clipboard_copy_block(clip, sel, cm);
+        return;
+    }
     
     int sr = sel->start_row, sc = sel->start_col;
     int er = sel->end_row, ec = sel->end_col;
@@ -98,35 +180,122 @@ void clipboard_copy(struct clipboard *clip, struct selection *sel, struct gapbuf
     if (copy_len <= 0) return;
     
     clipboard_free(clip);
-    clip->data = malloc(copy_len + 1);
     clip->len = copy_len;
-    
-    for (int i = 0; i < copy_len; i++) {
-        clip->data[i] = gap_char_at(g, start_pos + i);
-    }
-    clip->data[copy_len] = '\0';
+    clip->src = g;
+    clip->pin.start = start_pos;
+    clip->pin.len = copy_len;
+    clip->pin.release = clipboard_release;
+    clip->pin.trim = NULL;
+    clip->pin.arg = clip;
+    gap_pin(g, &clip->pin);
 }
 
 void clipboard_paste(struct clipboard *clip, struct gapbuf *g, int pos, struct editHistory *hist) {
-    if (!clip->data || clip->len == 0) return;
+    if (clip->len == 0) return;
     
     gap_move(g, pos);
-    
-    for (int i = 0; i < clip->len; i++) {
-        gap_insert(g, clip->data[i]);
-        history_push(hist, EDIT_INSERT, pos + i, clip->data[i]);
+    if (clip->src) {
+        gap_insert_copy(g, clip->src, clip->pin.start, clip->len);
+    } else {
+        gap_insert_bytes(g, clip->data, clip->len);
     }
+    /* either way the text now sits just before the gap */
+    history_push_text(hist, EDIT_INSERT_TEXT, pos, g->buf + pos, clip->len);
+}
+
+char *clipboard_text(struct clipboard *clip) {
+    char *text = malloc(clip->len + 1);
+    if (clip->src) gap_get_range(clip->src, clip->pin.start, clip->len, text);
+    else if (clip->data) memcpy(text, clip->data, clip->len);
+    text[clip->len] = '\0';
+    return text;
 }
 
 void clipboard_free(struct clipboard *clip) {
-    if (clip->data) free(clip->data);
+    if (clip->src) gap_unpin(clip->src, &clip->pin);
+    mem_free(MEM_CLIPBOARD, clip->data, clip->len + 1);
     clip->data = NULL;
+    clip->src = NULL;
     clip->len = 0;
+    clip->block = 0;
 }
 
-void selection_delete(struct selection *sel, struct gapbuf *g, struct editHistory *hist) {
-    if (!sel->active) return;
+void clipboard_paste_block(struct clipboard *clip, struct colMap *cm, int row, int col,
+                           struct editHistory *hist) {
+    if (clip->len == 0) return;
+    struct gapbuf *g = cm->g;
+    
+    /* block clipboards always hold their own copy */
+    const char *line = clip->data, *end = clip->data + clip->len;
+    int rows = 1;
+    for (const char *p = line; (p = memchr(p, '\n', end - p)); p++) rows++;
+    
+    /* one insertion per row; every row past the end shares the last one */
+    int *starts = malloc(3 * rows * sizeof(int));
+    int *lens = starts + rows, *withlens = lens + rows;
+    char *with = malloc(clip->len + (size_t)rows * (col + 1));
+    int doclen = gap_length(g), lines = gap_line_count(g);
+    int n = 0, wlen = 0;
+    for (int i = 0; i < rows; i++) {
+        const char *nl = memchr(line, '\n', end - line);
+        int linelen = (nl ? nl : end) - line;
+        int pad = col;
+        if (row + i < lines) {
+            int start = gap_line_start(g, row + i);
+            int len = gap_line_end(g, row + i) - start;
+            int at = colmap_pos(cm, start, len, col);
+            int have = at < len ? col : colmap_col(cm, start, len, len);
+            starts[n] = start + at;
+            lens[n] = withlens[n] = 0;
+            n++;
+            pad = have < col && linelen > 0 ? col - have : 0;
+        } else {
+            if (starts[n - 1] != doclen) {
+                starts[n] = doclen;
+                lens[n] = withlens[n] = 0;
+                n++;
+            }
+            with[wlen++] = '\n';
+            withlens[n - 1]++;
+        }
+        memset(with + wlen, ' ', pad);
+        memcpy(with + wlen + pad, line, linelen);
+        wlen += pad + linelen;
+        withlens[n - 1] += pad + linelen;
+        line = nl ? nl + 1 : end;
+    }
     
+    history_push_replace(hist, replace_spans(g, starts, lens, n, with, withlens, wlen));
+    free(with);
+    free(starts);
+}
+
+void selection_block_edit(struct selection *sel, struct colMap *cm, struct editHistory *hist,
+                          int before, int after, const char *text, int len) {
+    struct gapbuf *g = cm->g;
+    if (sel->start_col != sel->end_col) before = after = 0;
+    int rows = block_rows(sel);
+    int *starts = malloc(2 * rows * sizeof(int));
+    int *lens = starts + rows;
+    int n = block_spans(sel, cm, before, after, 1, starts, lens);
+    
+    int left = sel->start_col < sel->end_col ? sel->start_col : sel->end_col;
+    int removing = 0, shift = 0;
+    for (int i = 0; i < n; i++) removing |= lens[i];
+    if (n > 0 && (removing || len > 0)) {
+        history_push_replace(hist, replace_spans(g, starts, lens, n, text, NULL, len));
+        /* the block goes on at the column the text ends at on its last row */
+        for (int i = 0; i < n - 1; i++) shift += len - lens[i];
+        int end = starts[n - 1] + shift + len;
+        int line = gap_line_start(g, gap_line_of(g, end));
+        left = colmap_col(cm, line, gap_line_end(g, gap_line_of(g, end)) - line, end - line);
+    }
+    free(starts);
+    sel->start_col = sel->end_col = left;
+}
+
+void selection_replace(struct selection *sel, struct gapbuf *g, struct editHistory *hist,
+                       const char *text, int len) {
     int sr = sel->start_row, sc = sel->start_col;
     int er = sel->end_row, ec = sel->end_col;
     
@@ -136,14 +305,20 @@ void selection_delete(struct selection *sel, struct gapbuf *g, struct editHistor
     }
     
     int start_pos = rowcol_to_pos(g, sr, sc);
-    int end_pos = rowcol_to_pos(g, er, ec);
-    
-    gap_move(g, start_pos);
-    for (int i = start_pos; i < end_pos; i++) {
-        char ch = gap_char_at(g, start_pos);
-        gap_delete(g);
-        history_push(hist, EDIT_DELETE, start_pos, ch);
+    int span = rowcol_to_pos(g, er, ec) - start_pos;
+    if (span > 0 || len > 0) {
+        history_push_replace(hist, replace_spans(g, &start_pos, &span, 1, text, NULL, len));
     }
-    
+    gap_move(g, start_pos + len);
     selection_clear(sel);
 }
+
+void selection_delete(struct selection *sel, struct colMap *cm, struct editHistory *hist) {
+    if (!sel->active) return;
+    if (sel->block) {
+        if (sel->start_col != sel->end_col) selection_block_edit(sel, cm, hist, 0, 0, NULL, 0);
+        selection_clear(sel);
+        return;
+    }
+    selection_replace(sel, cm->g, hist, NULL, 0);
+}
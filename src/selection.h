@@ -2,19 +2,37 @@
 #ifndef SELECTION_H
 #define SELECTION_H
 
+#include "buffer.h"
+#include "colmap.h"
+
 // Forward declarations
-struct gapbuf;
 struct editHistory;
 
+/* Columns are byte offsets into the row, except in a block, where they
+ * are screen columns so that its edges run straight down the screen */
 struct selection {
     int active;
     int start_row, start_col;
     int end_row, end_col;
+    int block;          /* the rectangle between the two corners */
+};
+
+/* A selection put in order once, for drawing many rows of it */
+struct selectionBounds {
+    int active, block;
+    int top, bottom;
+    int left, right;        /* columns on the top and bottom rows, or of
+                             * the block */
 };
 
+/* A copy only pins the selected text where it is. The clipboard takes
+ * its own copy when that text is about to change or go away. */
 struct clipboard {
-    char *data;
+    char *data;             /* own copy, or NULL while src holds the text */
     int len;
+    struct gapbuf *src;     /* buffer the text is pinned in */
+    struct gapPin pin;
+    int block;              /* rows of a block selection, joined by '\n' */
 };
 
 void selection_start(struct selection *sel, int row, int col);
@@ -22,10 +40,36 @@ void selection_update(struct selection *sel, int row, int col);
 void selection_clear(struct selection *sel);
 int selection_contains(struct selection *sel, int row, int col);
 
-void clipboard_copy(struct clipboard *clip, struct selection *sel, struct gapbuf *g);
+void selection_bounds(struct selection *sel, struct selectionBounds *b);
+
+/* Columns [*from, *to) of row that are selected; *to is INT_MAX when the
+ * rest of the row is, and *from == *to when none of it is */
+void selection_row(const struct selectionBounds *b, int row, int *from, int *to);
+
+void clipboard_copy(struct clipboard *clip, struct selection *sel, struct colMap *cm);
 void clipboard_paste(struct clipboard *clip, struct gapbuf *g, int pos, struct editHistory *hist);
 void clipboard_free(struct clipboard *clip);
-void selection_delete(struct selection *sel, struct gapbuf *g, struct editHistory *hist);
+void selection_delete(struct selection *sel, struct colMap *cm, struct editHistory *hist);
+
+/* A copy of the clipboard's text, for the caller to free */
+char *clipboard_text(struct clipboard *clip);
+
+/* Replace the text of a selection that is not a block with text, as one
+ * edit and one undo record, and leave the gap after it */
+void selection_replace(struct selection *sel, struct gapbuf *g, struct editHistory *hist,
+                       const char *text, int len);
+
+/* Replace the block on every row with text, or on a zero-width block the
+ * `before` characters before its column and the `after` characters after
+ * it, as one undo record. Rows too short to reach the column are left
+ * alone. The selection becomes a zero-width block after the text. */
+void selection_block_edit(struct selection *sel, struct colMap *cm, struct editHistory *hist,
+                          int before, int after, const char *text, int len);
+
+/* Paste a block clipboard one line per row from row, screen column col
+ * down, padding short rows with spaces and adding rows past the end */
+void clipboard_paste_block(struct clipboard *clip, struct colMap *cm, int row, int col,
+                           struct editHistory *hist);
 
 int rowcol_to_pos(struct gapbuf *g, int row, int col);
 void pos_to_rowcol(struct gapbuf *g, int pos, int *row, int *col);
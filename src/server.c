@@ -0,0 +1,180 @@
+/* server.c - Unix socket transport implementation */
+#define _DEFAULT_SOURCE
+
+#include "server.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int write_all(int fd, const char *buf, int len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, char *buf, int len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void socket_addr(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, path, sizeof(addr->sun_path) - 1);
+}
+
+/* -------- messages -------- */
+int msg_send(int fd, char type, const char *data, int len) {
+    if (len < 0 || len > MSG_MAX) return -1;
+    char head[3] = { type, (char)(len >> 8), (char)(len & 0xff) };
+    if (write_all(fd, head, 3) == -1) return -1;
+    return write_all(fd, data, len);
+}
+
+int msg_recv(int fd, char *type, char *buf, int cap) {
+    unsigned char head[3];
+    if (read_all(fd, (char *)head, 3) == -1) return -1;
+    int len = head[1] << 8 | head[2];
+    if (len >= cap || read_all(fd, buf, len) == -1) return -1;
+    *type = head[0];
+    buf[len] = '\0';
+    return len;
+}
+
+/* -------- server -------- */
+void server_abspath(const char *name, char *buf, int size) {
+    char full[PATH_MAX], cwd[PATH_MAX];
+    if (realpath(name, full)) {
+        snprintf(buf, size, "%s", full);
+    } else if (name[0] == '/' || !getcwd(cwd, sizeof(cwd))) {
+        snprintf(buf, size, "%s", name);
+    } else {
+        snprintf(buf, size, "%s/%s", cwd, name);
+    }
+}
+
+void server_socket_path(char *buf, int size) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir && *dir) {
+        snprintf(buf, size, "%s/editor.sock", dir);
+    } else {
+        snprintf(buf, size, "/tmp/editor-%d.sock", (int)getuid());
+    }
+}
+
+int server_listen(const char *path) {
+    struct sockaddr_un addr;
+    socket_addr(&addr, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        /* a socket nobody answers on was left behind by a server that died */
+        int stale = errno == EADDRINUSE;
+        if (stale) {
+            int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            stale = probe != -1 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == -1;
+            if (probe != -1) close(probe);
+        }
+        if (!stale || unlink(path) == -1 ||
+            bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            close(fd);
+            return -1;
+        }
+    }
+    chmod(path, 0600);
+    if (listen(fd, 16) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* -------- client -------- */
+static volatile sig_atomic_t client_winch = 0;
+
+static void client_handle_winch(int sig) {
+    (void)sig;
+    client_winch = 1;
+}
+
+static int client_size(char *buf, int size) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+        ws.ws_row = 24;
+        ws.ws_col = 80;
+    }
+    return snprintf(buf, size, "%d %d", ws.ws_row, ws.ws_col);
+}
+
+int client_run(const char *path, int argc, char *argv[]) {
+    struct sockaddr_un addr;
+    socket_addr(&addr, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    static char msg[MSG_MAX + 1];
+    int len = client_size(msg, sizeof(msg)) + 1;
+    for (int i = 0; i < argc; i++) {
+        char full[PATH_MAX];
+        server_abspath(argv[i], full, sizeof(full));
+        int n = snprintf(msg + len, MSG_MAX - len, "%s", full);
+        if (n >= MSG_MAX - len) break;
+        len += n + 1;
+    }
+    msg_send(fd, MSG_HELLO, msg, len);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = client_handle_winch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+
+    struct pollfd fds[2] = { { STDIN_FILENO, POLLIN, 0 }, { fd, POLLIN, 0 } };
+    for (;;) {
+        if (client_winch) {
+            client_winch = 0;
+            int n = client_size(msg, sizeof(msg));
+            if (msg_send(fd, MSG_RESIZE, msg, n) == -1) break;
+        }
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(STDIN_FILENO, msg, MSG_INPUT_MAX);
+            if (n > 0 && msg_send(fd, MSG_INPUT, msg, n) == -1) break;
+            if (n == 0 && (fds[0].revents & POLLHUP)) break;
+        }
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(fd, msg, sizeof(msg));
+            if (n <= 0 || write_all(STDOUT_FILENO, msg, n) == -1) break;
+        }
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,37 @@
+/* server.h - Unix socket transport between the editor server and clients */
+#ifndef SERVER_H
+#define SERVER_H
+
+/* Client to server messages: one type byte, a two byte big-endian
+ * length, then the payload. The server answers with plain terminal
+ * output and closes the connection when the session ends. */
+#define MSG_HELLO  'H'      /* "rows cols", then NUL separated absolute paths */
+#define MSG_INPUT  'I'      /* bytes typed on the client terminal */
+#define MSG_RESIZE 'R'      /* "rows cols" */
+
+#define MSG_MAX 65535
+#define MSG_INPUT_MAX 4095  /* input is sent in pieces of at most this */
+
+/* Socket path: $XDG_RUNTIME_DIR/editor.sock, else /tmp/editor-<uid>.sock */
+void server_socket_path(char *buf, int size);
+
+/* name as an absolute path, canonical if the file exists. The server
+ * runs in some other directory and finds open documents by name. */
+void server_abspath(const char *name, char *buf, int size);
+
+/* Listen on path, replacing a stale socket. Returns the fd or -1. */
+int server_listen(const char *path);
+
+/* Send one framed message. Returns 0, or -1 on error. */
+int msg_send(int fd, char type, const char *data, int len);
+
+/* Read one framed message into buf (NUL terminated, so cap must leave a
+ * byte spare). Returns the payload length, or -1 on EOF or error. */
+int msg_recv(int fd, char *type, char *buf, int cap);
+
+/* Attach the terminal to the server at path and relay until the session
+ * ends. The terminal must already be in raw mode. Returns 0, or -1 if
+ * no server answers. */
+int client_run(const char *path, int argc, char *argv[]);
+
+#endif /* SERVER_H */
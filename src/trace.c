@@ -0,0 +1,118 @@
+/* trace.c - Frame timings for the overlay and Chrome trace dumps */
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *span_names[SPAN_COUNT + 1] = {
+    "read-key", "process-key", "line-lookup", "highlight", "render", "flush", "frame"
+};
+
+void trace_init(struct trace *t, int keep_events) {
+    memset(t, 0, sizeof(*t));
+    t->epoch = trace_now();
+    if (keep_events) t->events = malloc(TRACE_EVENTS * sizeof(struct traceEvent));
+}
+
+void trace_free(struct trace *t) {
+    free(t->events);
+    t->events = NULL;
+}
+
+double trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct traceEvent *trace_event(struct trace *t, int span, double start, double dur) {
+    if (!t->events) return NULL;
+    struct traceEvent *e = &t->events[t->nevents++ % TRACE_EVENTS];
+    e->span = span;
+    e->start = start;
+    e->dur = dur;
+    return e;
+}
+
+void trace_accum(struct trace *t, enum traceSpan s, double start) {
+    if (!t->enabled) return;
+    t->cur.span[s] += trace_now() - start;
+}
+
+void trace_span(struct trace *t, enum traceSpan s, double start) {
+    if (!t->enabled) return;
+    double dur = trace_now() - start;
+    t->cur.span[s] += dur;
+    trace_event(t, s, start, dur);
+}
+
+void trace_frame_begin(struct trace *t) {
+    t->cur.start = trace_now();
+}
+
+void trace_frame_end(struct trace *t, long long bytes_out) {
+    if (!t->enabled) {
+        t->bytes_seen = bytes_out;
+        return;
+    }
+    struct traceFrame *f = &t->cur;
+    f->end = trace_now();
+    /* frames drawn without a key, for a prompt or background work, start
+     * with their first span */
+    if (f->start == 0) f->start = f->end - f->span[SPAN_RENDER] - f->span[SPAN_FLUSH];
+    f->bytes = bytes_out - t->bytes_seen;
+    t->bytes_seen = bytes_out;
+    struct traceEvent *e = trace_event(t, SPAN_COUNT, f->start, f->end - f->start);
+    if (e) {
+        e->highlight = f->span[SPAN_HIGHLIGHT];
+        e->bytes = f->bytes;
+    }
+
+    t->frames[t->nframes++ % TRACE_FRAMES] = *f;
+    memset(f, 0, sizeof(*f));
+}
+
+int trace_by_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+int trace_stats(struct trace *t, double *p50, double *p99, double *bytes) {
+    int n = t->nframes < TRACE_FRAMES ? t->nframes : TRACE_FRAMES;
+    double times[TRACE_FRAMES];
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        times[i] = t->frames[i].end - t->frames[i].start;
+        total += t->frames[i].bytes;
+    }
+    qsort(times, n, sizeof(double), trace_by_double);
+    *p50 = n ? times[(n - 1) / 2] : 0;
+    *p99 = n ? times[(n - 1) * 99 / 100] : 0;
+    *bytes = n ? total / n : 0;
+    return n;
+}
+
+int trace_write(struct trace *t, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+
+    fprintf(fp, "{\"traceEvents\": [\n");
+    long long first = t->nevents > TRACE_EVENTS ? t->nevents - TRACE_EVENTS : 0;
+    for (long long i = first; t->events && i < t->nevents; i++) {
+        struct traceEvent *e = &t->events[i % TRACE_EVENTS];
+        fprintf(fp, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, "
+                    "\"ts\": %.3f, \"dur\": %.3f",
+                i > first ? ",\n" : "", span_names[e->span],
+                (e->start - t->epoch) * 1e6, e->dur * 1e6);
+        if (e->span == SPAN_COUNT) {
+            fprintf(fp, ", \"args\": {\"highlight_us\": %.3f, \"bytes\": %lld}",
+                    e->highlight * 1e6, e->bytes);
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n], \"displayTimeUnit\": \"ms\"}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
@@ -0,0 +1,77 @@
+/* trace.h - Frame timings for the overlay and Chrome trace dumps */
+#ifndef TRACE_H
+#define TRACE_H
+
+enum traceSpan {
+    SPAN_READ_KEY,
+    SPAN_PROCESS_KEY,
+    SPAN_LINE_LOOKUP,
+    SPAN_HIGHLIGHT,
+    SPAN_RENDER,
+    SPAN_FLUSH,
+    SPAN_COUNT
+};
+
+#define TRACE_FRAMES 256        /* frames kept for the percentiles */
+#define TRACE_EVENTS 65536      /* spans kept for a dump */
+
+/* A frame runs from a key arriving to its screen update being written */
+struct traceFrame {
+    double start, end;
+    double span[SPAN_COUNT];    /* seconds spent in each span */
+    long long bytes;            /* written to the terminal */
+};
+
+struct traceEvent {
+    int span;                   /* SPAN_COUNT for a whole frame */
+    double start, dur;
+    double highlight;           /* frames: the highlight total, too short-lived
+                                 * to keep as events of their own */
+    long long bytes;            /* frames: written to the terminal */
+};
+
+/* Nothing is timed while enabled is 0. Events are only kept when a dump
+ * was asked for. */
+struct trace {
+    int enabled;
+    double epoch;
+    struct traceFrame frames[TRACE_FRAMES];
+    long long nframes;
+    struct traceFrame cur;
+    long long bytes_seen;
+    struct traceEvent *events;
+    long long nevents;
+};
+
+/* Start with timing off, keeping events for a dump if keep_events */
+void trace_init(struct trace *t, int keep_events);
+
+void trace_free(struct trace *t);
+
+/* Monotonic clock in seconds */
+double trace_now(void);
+
+/* qsort order for doubles, smallest first */
+int trace_by_double(const void *a, const void *b);
+
+/* The span s that began at start ends now */
+void trace_span(struct trace *t, enum traceSpan s, double start);
+
+/* As trace_span, but only added to the frame's total: for spans timed
+ * too often to keep each one */
+void trace_accum(struct trace *t, enum traceSpan s, double start);
+
+/* A key arrived; the frame it causes starts now */
+void trace_frame_begin(struct trace *t);
+
+/* The frame was flushed; bytes_out counts everything written so far */
+void trace_frame_end(struct trace *t, long long bytes_out);
+
+/* Frame time percentiles in seconds and mean bytes per frame over the
+ * frames kept. Returns the number of frames they cover. */
+int trace_stats(struct trace *t, double *p50, double *p99, double *bytes);
+
+/* Write the kept events as Chrome trace-event JSON. Returns 0 or -1. */
+int trace_write(struct trace *t, const char *path);
+
+#endif /* TRACE_H */
@@ -0,0 +1,143 @@
+/* utf8.c - Decoding UTF-8 and the screen columns text takes */
+#include "utf8.h"
+#include <stdint.h>
+#include <string.h>
+
+int utf8_is_cont(char c) {
+    return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+int utf8_decode(const char *s, int len, int *cp) {
+    const unsigned char *u = (const unsigned char *)s;
+    int n, c;
+    if (u[0] < 0x80) {
+        *cp = u[0];
+        return 1;
+    } else if (u[0] >= 0xC2 && u[0] <= 0xDF) {
+        n = 2;
+        c = u[0] & 0x1F;
+    } else if (u[0] >= 0xE0 && u[0] <= 0xEF) {
+        n = 3;
+        c = u[0] & 0x0F;
+    } else if (u[0] >= 0xF0 && u[0] <= 0xF4) {
+        n = 4;
+        c = u[0] & 0x07;
+    } else {
+        *cp = 0xFFFD;
+        return 1;
+    }
+    if (n > len) {
+        *cp = 0xFFFD;
+        return 1;
+    }
+    for (int i = 1; i < n; i++) {
+        if ((u[i] & 0xC0) != 0x80) {
+            *cp = 0xFFFD;
+            return 1;
+        }
+        c = (c << 6) | (u[i] & 0x3F);
+    }
+    /* overlong forms, surrogates and past the last plane */
+    if ((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > 0x10FFFF)) ||
+        (c >= 0xD800 && c <= 0xDFFF)) {
+        *cp = 0xFFFD;
+        return 1;
+    }
+    *cp = c;
+    return n;
+}
+
+/* -------- widths -------- */
+struct cpRange {
+    int first, last;
+};
+
+static const struct cpRange combining[] = {
+    { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD }, { 0x05BF, 0x05BF },
+    { 0x05C1, 0x05C2 }, { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x0610, 0x061A },
+    { 0x064B, 0x065F }, { 0x0670, 0x0670 }, { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 },
+    { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0711, 0x0711 }, { 0x0730, 0x074A },
+    { 0x07A6, 0x07B0 }, { 0x0900, 0x0902 }, { 0x093A, 0x093A }, { 0x093C, 0x093C },
+    { 0x0941, 0x0948 }, { 0x094D, 0x094D }, { 0x0951, 0x0957 }, { 0x0962, 0x0963 },
+    { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x1AB0, 0x1AFF },
+    { 0x1DC0, 0x1DFF }, { 0x200B, 0x200F }, { 0x202A, 0x202E }, { 0x2060, 0x2064 },
+    { 0x20D0, 0x20FF }, { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F }, { 0xFEFF, 0xFEFF },
+    { 0xE0100, 0xE01EF },
+};
+
+static const struct cpRange wide[] = {
+    { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A }, { 0x23E9, 0x23EC },
+    { 0x25FD, 0x25FE }, { 0x2614, 0x2615 }, { 0x2648, 0x2653 }, { 0x26AA, 0x26AB },
+    { 0x26BD, 0x26BE }, { 0x26F5, 0x26F5 }, { 0x26FA, 0x26FA }, { 0x2705, 0x2705 },
+    { 0x270A, 0x270B }, { 0x2728, 0x2728 }, { 0x274C, 0x274C }, { 0x2753, 0x2755 },
+    { 0x2795, 0x2797 }, { 0x2B1B, 0x2B1C }, { 0x2B50, 0x2B50 }, { 0x2E80, 0x303E },
+    { 0x3041, 0x33FF }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF },
+    { 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF }, { 0xFE10, 0xFE19 },
+    { 0xFE30, 0xFE6F }, { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x16FE4 },
+    { 0x17000, 0x18CFF }, { 0x1B000, 0x1B2FF }, { 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF },
+    { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A }, { 0x1F200, 0x1F251 }, { 0x1F300, 0x1F64F },
+    { 0x1F680, 0x1F6FF }, { 0x1F7E0, 0x1F7EB }, { 0x1F900, 0x1F9FF }, { 0x1FA70, 0x1FAFF },
+    { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD },
+};
+
+static int in_ranges(const struct cpRange *r, int n, int cp) {
+    if (cp < r[0].first || cp > r[n - 1].last) return 0;
+    int lo = 0, hi = n - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (cp > r[mid].last) lo = mid + 1;
+        else if (cp < r[mid].first) hi = mid - 1;
+        else return 1;
+    }
+    return 0;
+}
+
+int utf8_cp_width(int cp) {
+    if (cp < 0x300) return 1;
+    if (in_ranges(combining, sizeof(combining) / sizeof(combining[0]), cp)) return 0;
+    if (in_ranges(wide, sizeof(wide) / sizeof(wide[0]), cp)) return 2;
+    return 1;
+}
+
+/* -------- plain runs -------- */
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+int utf8_plain_run(const char *s, int len) {
+    int i = 0;
+    /* a word is plain unless some byte has its high bit set, is below a
+     * space or is DEL; the tests may flag a plain word, never the reverse */
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, 8);
+        uint64_t del = w ^ (ONES * 0x7F);
+        if ((w | ((w - ONES * 0x20) & ~w) | ((del - ONES) & ~del)) & HIGHS) break;
+    }
+    for (; i < len; i++) {
+        unsigned char c = s[i];
+        if (c < 0x20 || c >= 0x7F) break;
+    }
+    return i;
+}
+
+int utf8_printable(const char *s, int bytes) {
+    unsigned char c = s[0];
+    if (bytes == 1) return c >= 0x20 && c < 0x7F;
+    /* C1 controls */
+    return !(c == 0xC2 && (unsigned char)s[1] < 0xA0);
+}
+
+int utf8_char_cols(const char *s, int len, int col, int *bytes) {
+    unsigned char c = s[0];
+    if (c >= 0x20 && c < 0x7F) {
+        *bytes = 1;
+        return 1;
+    }
+    if (c == '\t') {
+        *bytes = 1;
+        return TAB_STOP - col % TAB_STOP;
+    }
+    int cp;
+    *bytes = utf8_decode(s, len, &cp);
+    return cp < 0x20 || cp == 0x7F ? 1 : utf8_cp_width(cp);
+}
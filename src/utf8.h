@@ -0,0 +1,31 @@
+/* utf8.h - Decoding UTF-8 and the screen columns text takes */
+#ifndef UTF8_H
+#define UTF8_H
+
+/* Columns between tab stops, and spaces the Tab key inserts */
+#define TAB_STOP 4
+
+/* Whether byte c continues a multi-byte sequence rather than starting one */
+int utf8_is_cont(char c);
+
+/* Bytes of the character at s, at most len, with its code point in *cp.
+ * A malformed or cut off sequence is taken one byte at a time. */
+int utf8_decode(const char *s, int len, int *cp);
+
+/* Columns code point cp takes: 0 for combining marks, 2 for East Asian
+ * wide and fullwidth characters, 1 for the rest */
+int utf8_cp_width(int cp);
+
+/* Length of the run at the start of s that is printable ASCII, one column
+ * a byte. Checked a word at a time, since that is most text. */
+int utf8_plain_run(const char *s, int len);
+
+/* Whether the character of that many bytes at s can go to the terminal
+ * as it is: not a control character and not a malformed sequence */
+int utf8_printable(const char *s, int bytes);
+
+/* Columns the character at s takes when it starts at column col, tabs
+ * going to the next stop; its length in bytes goes in *bytes */
+int utf8_char_cols(const char *s, int len, int col, int *bytes);
+
+#endif /* UTF8_H */
@@ -0,0 +1,137 @@
+/* view.c - Read-only files mapped whole, for editor --view */
+#define _GNU_SOURCE     /* memrchr */
+
+#include "view.h"
+#include "memstat.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* -------- counting -------- */
+static long long view_count(const char *p, long long len) {
+    const char *end = p + len;
+    long long n = 0;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        n++;
+        p++;
+    }
+    return n;
+}
+
+/* The index thread: a chunk at a time from the start, published as it goes */
+static void *view_index(void *arg) {
+    struct fileView *v = arg;
+    for (long long k = 0; k < v->nchunks; k++) {
+        long long from = k * VIEW_CHUNK;
+        long long len = v->size - from < VIEW_CHUNK ? v->size - from : VIEW_CHUNK;
+        long long n = view_count(v->data + from, len);
+
+        pthread_mutex_lock(&v->lock);
+        v->lines[k + 1] = v->lines[k] + n;
+        v->chunks = k + 1;
+        int cancel = v->cancel;
+        pthread_mutex_unlock(&v->lock);
+        if (cancel) break;
+    }
+    return NULL;
+}
+
+int view_open(struct fileView *v, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    v->size = st.st_size;
+    v->data = NULL;
+    if (v->size > 0) {
+        void *map = mmap(NULL, v->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        v->data = map;
+    }
+    close(fd);
+
+    v->nchunks = (v->size + VIEW_CHUNK - 1) / VIEW_CHUNK;
+    v->lines = mem_calloc(MEM_BUFFER, v->nchunks + 1, sizeof(long long));
+    v->chunks = 0;
+    v->cancel = 0;
+    pthread_mutex_init(&v->lock, NULL);
+    v->started = pthread_create(&v->thread, NULL, view_index, v) == 0;
+    if (!v->started) view_index(v);     /* counted before the first frame instead */
+    return 0;
+}
+
+void view_close(struct fileView *v) {
+    pthread_mutex_lock(&v->lock);
+    v->cancel = 1;
+    pthread_mutex_unlock(&v->lock);
+    if (v->started) pthread_join(v->thread, NULL);
+
+    pthread_mutex_destroy(&v->lock);
+    mem_free(MEM_BUFFER, v->lines, (v->nchunks + 1) * sizeof(long long));
+    if (v->data) munmap((void *)v->data, v->size);
+    memset(v, 0, sizeof(*v));
+}
+
+void view_progress(struct fileView *v, long long *lines, long long *bytes) {
+    pthread_mutex_lock(&v->lock);
+    *lines = v->lines[v->chunks];
+    *bytes = v->chunks == v->nchunks ? v->size : v->chunks * VIEW_CHUNK;
+    pthread_mutex_unlock(&v->lock);
+}
+
+long long view_line_of(struct fileView *v, long long pos) {
+    long long k = pos / VIEW_CHUNK;
+    pthread_mutex_lock(&v->lock);
+    long long before = k <= v->chunks ? v->lines[k] : -1;
+    pthread_mutex_unlock(&v->lock);
+    if (before == -1) return -1;
+    return before + view_count(v->data + k * VIEW_CHUNK, pos - k * VIEW_CHUNK);
+}
+
+/* -------- lines -------- */
+/* Last newline in [from, to), or -1 */
+static long long view_last_nl(struct fileView *v, long long from, long long to) {
+    if (from >= to) return -1;
+    const char *p = memrchr(v->data + from, '\n', to - from);
+    return p ? p - v->data : -1;
+}
+
+/* First newline in [from, to), or -1 */
+static long long view_first_nl(struct fileView *v, long long from, long long to) {
+    if (to > v->size) to = v->size;
+    if (from >= to) return -1;
+    const char *p = memchr(v->data + from, '\n', to - from);
+    return p ? p - v->data : -1;
+}
+
+/* Lines start after a newline, and at a chunk boundary that has a whole
+ * chunk without one before it */
+long long view_line_begin(struct fileView *v, long long pos) {
+    long long b = pos - pos % VIEW_CHUNK;
+    long long n = view_last_nl(v, b, pos);
+    if (n >= 0) return n + 1;
+    if (b == 0) return 0;
+    n = view_last_nl(v, b - VIEW_CHUNK, b);
+    return n >= 0 ? n + 1 : b;
+}
+
+long long view_line_next(struct fileView *v, long long start) {
+    long long b = start - start % VIEW_CHUNK + VIEW_CHUNK;
+    long long n = view_first_nl(v, start, b);
+    if (n >= 0) return n + 1;
+    if (b >= v->size) return v->size;
+    /* a line starting on a boundary that reaches the next one is cut there */
+    if (start % VIEW_CHUNK == 0) return b;
+    n = view_first_nl(v, b, b + VIEW_CHUNK);
+    if (n >= 0) return n + 1;
+    return b + VIEW_CHUNK < v->size ? b + VIEW_CHUNK : v->size;
+}
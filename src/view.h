@@ -0,0 +1,46 @@
+/* view.h - Read-only files mapped whole, for editor --view */
+#ifndef VIEW_H
+#define VIEW_H
+
+#include <pthread.h>
+
+/* Newlines are counted a chunk at a time in the background. A line
+ * longer than a whole chunk is shown cut where the next chunk starts, so
+ * finding either end of a line never reads more than two chunks. */
+#define VIEW_CHUNK (1 << 20)
+
+struct fileView {
+    const char *data;       /* the file as it was when opened, NULL if empty */
+    long long size;
+    long long nchunks;
+    long long *lines;       /* newlines before the start of each chunk */
+
+    pthread_t thread;
+    int started;            /* counting in a thread of its own */
+    pthread_mutex_t lock;   /* guards chunks and cancel */
+    long long chunks;       /* chunks counted so far; lines[0..chunks] are set */
+    int cancel;
+};
+
+/* Map path and start counting its lines. Returns -1 if it cannot be
+ * read as a regular file. */
+int view_open(struct fileView *v, const char *path);
+
+/* Stop the count and unmap the file */
+void view_close(struct fileView *v);
+
+/* Lines and bytes counted so far; the count is done when bytes is size */
+void view_progress(struct fileView *v, long long *lines, long long *bytes);
+
+/* Number of the line, from 0, that pos is on, or -1 if the count has
+ * not got that far yet */
+long long view_line_of(struct fileView *v, long long pos);
+
+/* Start of the line pos is on */
+long long view_line_begin(struct fileView *v, long long pos);
+
+/* Start of the line after the one starting at start, or size if it is
+ * the last */
+long long view_line_next(struct fileView *v, long long start);
+
+#endif /* VIEW_H */
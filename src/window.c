@@ -0,0 +1,104 @@
+/* window.c - Split pane tree */
+#include "window.h"
+#include "memstat.h"
+#include <stdlib.h>
+
+/* The damage hashes were sized for the rows of the last layout */
+static void window_drop_hashes(struct window *w) {
+    mem_free(MEM_SCREEN, w->row_hash, w->rows * sizeof(unsigned int));
+    w->row_hash = NULL;
+}
+
+struct window *window_new(struct document *doc) {
+    struct window *w = calloc(1, sizeof(struct window));
+    selection_clear(&w->sel);
+    window_show(w, doc);
+    return w;
+}
+
+void window_free(struct window *w) {
+    if (!w) return;
+    window_free(w->child[0]);
+    window_free(w->child[1]);
+    if (w->doc) w->doc->windows--;
+    window_drop_hashes(w);
+    free(w);
+}
+
+void window_show(struct window *w, struct document *doc) {
+    if (w->doc) w->doc->windows--;
+    w->doc = doc;
+    if (doc) doc->windows++;
+}
+
+struct window *window_split(struct window *w, int vertical) {
+    struct window *a = malloc(sizeof(struct window));
+    struct window *b = malloc(sizeof(struct window));
+    *a = *w;
+    *b = *w;
+    a->parent = b->parent = w;
+    a->row_hash = b->row_hash = NULL;
+    b->doc->windows++;
+
+    window_drop_hashes(w);
+    w->doc = NULL;
+    w->child[0] = a;
+    w->child[1] = b;
+    w->vertical = vertical;
+    return b;
+}
+
+struct window *window_close(struct window *w) {
+    struct window *p = w->parent;
+    if (!p) return NULL;
+
+    /* the sibling moves up into the parent's place */
+    struct window *s = p->child[w == p->child[0]];
+    window_show(w, NULL);
+    window_drop_hashes(w);
+    free(w);
+
+    struct window *grand = p->parent;
+    *p = *s;
+    p->parent = grand;
+    if (p->child[0]) {
+        p->child[0]->parent = p;
+        p->child[1]->parent = p;
+    }
+    free(s);
+    return window_first(p);
+}
+
+struct window *window_first(struct window *w) {
+    while (w->child[0]) w = w->child[0];
+    return w;
+}
+
+struct window *window_next(struct window *w) {
+    while (w->parent && w == w->parent->child[1]) w = w->parent;
+    if (!w->parent) return window_first(w);
+    return window_first(w->parent->child[1]);
+}
+
+void window_layout(struct window *w, int top, int left, int rows, int cols) {
+    window_drop_hashes(w);
+    if (rows < WINDOW_MIN_ROWS) rows = WINDOW_MIN_ROWS;
+    if (cols < WINDOW_MIN_COLS) cols = WINDOW_MIN_COLS;
+    w->top = top;
+    w->left = left;
+    w->rows = rows;
+    w->cols = cols;
+
+    if (!w->child[0]) {
+        w->row_hash = mem_calloc(MEM_SCREEN, rows, sizeof(unsigned int));
+    } else if (w->vertical) {
+        /* one column between the panes for the separator */
+        int half = (cols - 1) / 2;
+        window_layout(w->child[0], top, left, rows, half);
+        window_layout(w->child[1], top, left + half + 1, rows, cols - half - 1);
+    } else {
+        int half = rows / 2;
+        window_layout(w->child[0], top, left, half, cols);
+        window_layout(w->child[1], top + half, left, rows - half, cols);
+    }
+}
@@ -0,0 +1,60 @@
+/* window.h - Split panes viewing documents */
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include "document.h"
+#include "selection.h"
+
+/* Smallest pane: a text row and its status line. Panes never get less,
+ * even when the screen is too small to show them all. */
+#define WINDOW_MIN_ROWS 2
+#define WINDOW_MIN_COLS 1
+
+/* Windows form a tree: a split holds two children, a pane shows a
+ * document. Panes on the same document share its buffer and index and
+ * keep only their own view of it. */
+struct window {
+    struct window *parent;
+    struct window *child[2];    /* set on splits, NULL on panes */
+    int vertical;               /* children side by side instead of stacked */
+
+    struct document *doc;       /* panes only */
+    int cx, cy;                 /* view, saved while the pane is not focused */
+    int rowoff, coloff;
+    int rowsub;                 /* visual row of line rowoff at the top, when wrapping */
+    int wrap;                   /* soft wrap long lines instead of scrolling */
+    struct selection sel;
+
+    int top, left;              /* screen area, the pane's status line included */
+    int rows, cols;
+    unsigned int *row_hash;     /* each row of a pane as last drawn */
+};
+
+/* A single pane on doc */
+struct window *window_new(struct document *doc);
+
+/* Free a window and everything below it */
+void window_free(struct window *w);
+
+/* Show doc in pane w */
+void window_show(struct window *w, struct document *doc);
+
+/* Split pane w in two panes with the same view; returns the new one,
+ * below or to the right. w itself becomes the split. */
+struct window *window_split(struct window *w, int vertical);
+
+/* Remove pane w; its sibling takes the space. Returns the pane that
+ * should get the focus, or NULL if w is the only pane. */
+struct window *window_close(struct window *w);
+
+/* First pane under w */
+struct window *window_first(struct window *w);
+
+/* Next pane after w in screen order, wrapping around */
+struct window *window_next(struct window *w);
+
+/* Assign screen areas to w and everything below it; parts that do not
+ * fit run past the bottom or the right of the screen */
+void window_layout(struct window *w, int top, int left, int rows, int cols);
+
+#endif /* WINDOW_H */
@@ -0,0 +1,150 @@
+/* wrap.c - Soft wrap layout of long lines, cached per line */
+#include "wrap.h"
+#include "memstat.h"
+#include "utf8.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int one_row_start = 0;
+
+void wrap_init(struct wrapCache *wc, struct gapbuf *g) {
+    wc->g = g;
+    wc->lines = calloc(WRAP_CACHE_LINES, sizeof(struct wrapLine));
+    wc->clock = 0;
+}
+
+static void wrap_drop(struct wrapLine *wl) {
+    mem_free(MEM_SCREEN, wl->starts, wl->rows * sizeof(int));
+    wl->starts = NULL;
+    wl->rows = 0;
+}
+
+/* The line's text is changing or going away */
+static void wrap_release(struct gapPin *pin, struct gapbuf *g) {
+    (void)g;
+    wrap_drop(pin->arg);
+}
+
+void wrap_free(struct wrapCache *wc) {
+    if (!wc->lines) return;
+    for (int i = 0; i < WRAP_CACHE_LINES; i++) {
+        struct wrapLine *wl = &wc->lines[i];
+        if (wl->rows == 0) continue;
+        gap_unpin(wc->g, &wl->pin);
+        wrap_drop(wl);
+    }
+    free(wc->lines);
+    wc->lines = NULL;
+}
+
+/* Break the line into rows of at most width columns, after the last
+ * space that fits when there is one. A row is read once, as at most
+ * width characters of up to four bytes. */
+static int wrap_layout(struct gapbuf *g, int start, int len, int width, int **out) {
+    int cap = len / width + 2, rows = 0;
+    int *starts = mem_alloc(MEM_SCREEN, cap * sizeof(int));
+    int window = 4 * width + 4;
+    char *copy = malloc(window);
+    int pos = 0;
+    for (;;) {
+        if (rows == cap) {
+            starts = mem_realloc(MEM_SCREEN, starts, cap * sizeof(int), 2 * cap * sizeof(int));
+            cap *= 2;
+        }
+        starts[rows++] = pos;
+
+        int n = len - pos < window ? len - pos : window;
+        int avail;
+        const char *p = gap_span(g, start + pos, &avail);
+        if (avail < n) {
+            gap_get_range(g, start + pos, n, copy);
+            p = copy;
+        }
+
+        /* up to the first character that does not fit */
+        int i = 0, col = 0, bytes = 1;
+        while (i < n && col < width) {
+            int run = utf8_plain_run(p + i, n - i < width - col ? n - i : width - col);
+            i += run;
+            col += run;
+            if (i == n || col == width) break;
+            int w = utf8_char_cols(p + i, n - i, col, &bytes);
+            if (col + w > width) break;
+            i += bytes;
+            col += w;
+        }
+        if (i == len - pos) break;
+
+        int brk = i;
+        while (brk > 1 && p[brk - 1] != ' ') brk--;
+        if (brk == 1) brk = i;
+        if (brk == 0) utf8_char_cols(p, n, 0, &brk);   /* wider than the row */
+        pos += brk;
+    }
+    free(copy);
+
+    *out = mem_realloc(MEM_SCREEN, starts, cap * sizeof(int), rows * sizeof(int));
+    return rows;
+}
+
+/* Whether the line fits in width columns without a layout: short enough
+ * and no tab to widen it */
+static int wrap_fits(struct gapbuf *g, int start, int len, int width) {
+    if (len > width) return 0;
+    if (len <= width / TAB_STOP) return 1;
+    int avail;
+    const char *p = gap_span(g, start, &avail);
+    if (avail >= len) return memchr(p, '\t', len) == NULL;
+    char *copy = malloc(len);
+    gap_get_range(g, start, len, copy);
+    int fits = memchr(copy, '\t', len) == NULL;
+    free(copy);
+    return fits;
+}
+
+const struct wrapLine *wrap_line(struct wrapCache *wc, int start, int len, int width) {
+    static struct wrapLine one_row = { { 0, 0, NULL, NULL, NULL, NULL }, 0, 0, 1, &one_row_start, 0 };
+    if (width < 1 || wrap_fits(wc->g, start, len, width)) return &one_row;
+
+    /* a hit, or else a free entry, or else the least recently used */
+    struct wrapLine *victim = NULL;
+    for (int i = 0; i < WRAP_CACHE_LINES; i++) {
+        struct wrapLine *wl = &wc->lines[i];
+        if (wl->rows == 0) {
+            if (!victim || victim->rows) victim = wl;
+        } else if (wl->pin.start == start && wl->len == len && wl->width == width) {
+            wl->used = ++wc->clock;
+            return wl;
+        } else if (!victim || (victim->rows && wl->used < victim->used)) {
+            victim = wl;
+        }
+    }
+
+    if (victim->rows) {
+        gap_unpin(wc->g, &victim->pin);
+        wrap_drop(victim);
+    }
+    victim->rows = wrap_layout(wc->g, start, len, width, &victim->starts);
+    victim->len = len;
+    victim->width = width;
+    victim->used = ++wc->clock;
+    /* the newline belongs to the line, so joining it to the next one
+     * counts as an edit inside it */
+    victim->pin.start = start;
+    victim->pin.len = start + len < gap_length(wc->g) ? len + 1 : len;
+    victim->pin.release = wrap_release;
+    victim->pin.trim = NULL;
+    victim->pin.arg = victim;
+    gap_pin(wc->g, &victim->pin);
+    return victim;
+}
+
+int wrap_row_of(const struct wrapLine *wl, int col) {
+    int lo = 0, hi = wl->rows - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (wl->starts[mid] <= col) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
@@ -0,0 +1,39 @@
+/* wrap.h - Soft wrap layout of long lines, cached per line */
+#ifndef WRAP_H
+#define WRAP_H
+
+#include "buffer.h"
+
+/* Lines laid out at once; the ones on screen have to fit */
+#define WRAP_CACHE_LINES 256
+
+/* Where the visual rows of one line start. The line's text is pinned, so
+ * an edit inside it drops the layout and edits before it shift it along
+ * without a rewrap. */
+struct wrapLine {
+    struct gapPin pin;
+    int len;                /* the line's length, its newline aside */
+    int width;
+    int rows;               /* 0 while the entry is free */
+    int *starts;            /* offset of each row in the line, starts[0] is 0 */
+    unsigned long used;
+};
+
+struct wrapCache {
+    struct gapbuf *g;
+    struct wrapLine *lines;
+    unsigned long clock;
+};
+
+void wrap_init(struct wrapCache *wc, struct gapbuf *g);
+void wrap_free(struct wrapCache *wc);
+
+/* Layout at width screen columns of the len-byte line at start. Lines
+ * that fit are one row and never cached. The result stays valid until
+ * the next lookup or edit. */
+const struct wrapLine *wrap_line(struct wrapCache *wc, int start, int len, int width);
+
+/* Visual row that byte col of the line is on */
+int wrap_row_of(const struct wrapLine *wl, int col);
+
+#endif /* WRAP_H */
@@ -0,0 +1,436 @@
+/* test_buffer.c - Gap buffer line index, pins and regex checks against
+ * plain reference implementations, over random edits and patterns */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "regex.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        failures++; \
+        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+        if (failures > 20) exit(1); \
+    } \
+} while (0)
+
+/* -------- reference text -------- */
+/* The text as a plain array, edited alongside the buffer */
+struct model {
+    char *s;
+    int len, cap;
+};
+
+static void model_edit(struct model *m, int pos, int removed, const char *text, int inserted) {
+    if (m->len - removed + inserted >= m->cap) {
+        m->cap = (m->len - removed + inserted) * 2 + 16;
+        m->s = realloc(m->s, m->cap);
+    }
+    memmove(m->s + pos + inserted, m->s + pos + removed, m->len - pos - removed);
+    if (inserted) memcpy(m->s + pos, text, inserted);
+    m->len += inserted - removed;
+}
+
+static void random_text(char *out, int n, const char *alphabet) {
+    int k = strlen(alphabet);
+    for (int i = 0; i < n; i++) out[i] = alphabet[rand() % k];
+}
+
+/* One random primitive on both the buffer and the model */
+static void random_edit(struct gapbuf *g, struct model *m) {
+    char text[64];
+    int len = gap_length(g);
+    int pos = rand() % (len + 1);
+    int n = rand() % 16;
+    switch (rand() % 6) {
+        case 0:
+            random_text(text, 1, "ab\n");
+            gap_move(g, pos);
+            gap_insert(g, text[0]);
+            model_edit(m, pos, 0, text, 1);
+            break;
+        case 1:
+            random_text(text, n, "abc\n\n");
+            gap_move(g, pos);
+            gap_insert_bytes(g, text, n);
+            model_edit(m, pos, 0, text, n);
+            break;
+        case 2:
+            gap_move(g, pos);
+            n = gap_delete_bytes(g, n);
+            model_edit(m, pos, n, NULL, 0);
+            break;
+        case 3:
+            gap_move(g, pos);
+            if (gap_backspace(g)) model_edit(m, pos - 1, 1, NULL, 0);
+            break;
+        case 4:
+            gap_move(g, pos);
+            if (gap_delete(g)) model_edit(m, pos, 1, NULL, 0);
+            break;
+        case 5:
+            gap_move(g, pos);
+            gap_compact(g, rand() % 8);
+            break;
+    }
+}
+
+/* -------- line index -------- */
+static void check_lines(struct gapbuf *g, struct model *m) {
+    int rows = 1;
+    for (int i = 0; i < m->len; i++) rows += m->s[i] == '\n';
+    CHECK(gap_line_count(g) == rows, "line count %d, expected %d", gap_line_count(g), rows);
+
+    int row = 0, start = 0;
+    for (int i = 0; i <= m->len; i++) {
+        CHECK(gap_line_of(g, i) == row, "line of %d is %d, expected %d", i, gap_line_of(g, i), row);
+        if (i == m->len || m->s[i] == '\n') {
+            CHECK(gap_line_start(g, row) == start, "line %d starts at %d, expected %d",
+                  row, gap_line_start(g, row), start);
+            CHECK(gap_line_end(g, row) == i, "line %d ends at %d, expected %d",
+                  row, gap_line_end(g, row), i);
+            row++;
+            start = i + 1;
+        }
+    }
+    CHECK(gap_line_start(g, rows + 3) == gap_line_start(g, rows - 1), "start past the last line");
+}
+
+static void test_line_index(void) {
+    for (int round = 0; round < 200; round++) {
+        struct gapbuf g;
+        struct model m = { NULL, 0, 0 };
+        gap_init(&g, 1 + rand() % 32);
+        for (int i = 0; i < 200; i++) {
+            random_edit(&g, &m);
+            check_lines(&g, &m);
+        }
+
+        /* text written into buf directly and reindexed */
+        char *flat = malloc(m.len + 1);
+        gap_get(&g, flat, m.len + 1);
+        CHECK(memcmp(flat, m.s, m.len) == 0, "text differs from the model");
+        struct gapbuf other;
+        gap_init(&other, m.len + 1);
+        memcpy(other.buf, flat, m.len);
+        other.gap_start = m.len;
+        gap_reindex(&other);
+        gap_swap(&g, &other);
+        check_lines(&g, &m);
+        gap_free(&other);
+        free(flat);
+
+        gap_free(&g);
+        free(m.s);
+    }
+}
+
+/* -------- pins -------- */
+struct testPin {
+    struct gapPin pin;
+    char text[16];
+    int expect;             /* where the pinned text should be, -1 once released */
+    int len;                /* how much of it should still be pinned */
+    int released;
+};
+
+static void test_release(struct gapPin *pin, struct gapbuf *g) {
+    struct testPin *tp = pin->arg;
+    char text[16];
+    gap_get_range(g, pin->start, pin->len, text);
+    CHECK(memcmp(text, tp->text, pin->len) == 0, "released pin's text already changed");
+    tp->released++;
+}
+
+static void test_trim(struct gapPin *pin, struct gapbuf *g, int keep) {
+    struct testPin *tp = pin->arg;
+    char text[16];
+    CHECK(keep > 0 && keep < pin->len, "pin of %d bytes cut to %d", pin->len, keep);
+    gap_get_range(g, pin->start, pin->len, text);
+    CHECK(memcmp(text, tp->text, pin->len) == 0, "trimmed pin's text already changed");
+    pin->len = keep;
+}
+
+static void test_pins(void) {
+    for (int round = 0; round < 200; round++) {
+        struct gapbuf g;
+        struct model m = { NULL, 0, 0 };
+        gap_init(&g, 16);
+        char text[256];
+        random_text(text, 256, "abc\n");
+        gap_insert_bytes(&g, text, 256);
+        model_edit(&m, 0, 0, text, 256);
+
+        struct testPin pins[8];
+        for (int i = 0; i < 8; i++) {
+            struct testPin *tp = &pins[i];
+            tp->pin.len = 1 + rand() % 15;
+            tp->pin.start = rand() % (m.len - tp->pin.len);
+            tp->pin.release = test_release;
+            tp->pin.trim = i % 4 == 3 ? test_trim : NULL;
+            tp->pin.arg = tp;
+            tp->expect = tp->pin.start;
+            tp->len = tp->pin.len;
+            tp->released = 0;
+            memcpy(tp->text, m.s + tp->pin.start, tp->pin.len);
+            gap_pin(&g, &tp->pin);
+        }
+
+        for (int step = 0; step < 100; step++) {
+            int len = gap_length(&g);
+            int pos = rand() % (len + 1);
+            int removed = rand() % 3 ? 0 : rand() % 8;
+            if (removed > len - pos) removed = len - pos;
+            int inserted = rand() % 6;
+            random_text(text, inserted, "xyz");
+            if (removed == 0 && inserted == 0) continue;
+
+            for (int i = 0; i < 8; i++) {
+                struct testPin *tp = &pins[i];
+                if (tp->expect < 0 || pos >= tp->expect + tp->len) continue;
+                if (pos + removed <= tp->expect) tp->expect += inserted - removed;
+                else if (tp->pin.trim && pos > tp->expect) tp->len = pos - tp->expect;
+                else tp->expect = -1;
+            }
+            gap_move(&g, pos);
+            gap_delete_bytes(&g, removed);
+            gap_insert_bytes(&g, text, inserted);
+            model_edit(&m, pos, removed, text, inserted);
+
+            for (int i = 0; i < 8; i++) {
+                struct testPin *tp = &pins[i];
+                if (tp->expect < 0) {
+                    CHECK(tp->released == 1, "pin released %d times", tp->released);
+                    continue;
+                }
+                CHECK(!tp->released, "pin released by an edit outside it");
+                CHECK(tp->pin.start == tp->expect, "pin at %d, expected %d", tp->pin.start, tp->expect);
+                CHECK(tp->pin.len == tp->len, "pin of %d bytes, expected %d", tp->pin.len, tp->len);
+                CHECK(memcmp(m.s + tp->expect, tp->text, tp->pin.len) == 0, "pinned text moved");
+            }
+        }
+
+        /* what is left goes when the text does, unpinned ones stay quiet */
+        struct gapbuf empty;
+        gap_init(&empty, 1);
+        for (int i = 0; i < 8; i += 2) {
+            if (pins[i].expect >= 0) gap_unpin(&g, &pins[i].pin);
+        }
+        gap_swap(&g, &empty);
+        for (int i = 0; i < 8; i++) {
+            int want = pins[i].expect < 0 || i % 2 == 1;
+            CHECK(pins[i].released == want, "pin %d released %d times after swap", i, pins[i].released);
+        }
+        gap_free(&empty);
+        gap_free(&g);
+        free(m.s);
+    }
+}
+
+/* -------- regex -------- */
+/* Patterns are built as trees, printed for regex_compile and matched
+ * directly on the text as sets of end positions, one bit each */
+enum refType { R_CHAR, R_DOT, R_SET, R_NSET, R_BOL, R_EOL, R_EMPTY,
+               R_CAT, R_ALT, R_STAR, R_PLUS, R_QUEST, R_COUNT };
+
+struct ref {
+    enum refType type;
+    char c;
+    int min, max;
+    struct ref *a, *b;
+};
+
+static struct ref *ref_random(int depth) {
+    static const enum refType leaves[] = { R_CHAR, R_CHAR, R_CHAR, R_DOT, R_SET, R_NSET,
+                                           R_BOL, R_EOL, R_EMPTY };
+    struct ref *r = calloc(1, sizeof(struct ref));
+    if (depth == 0 || rand() % 3 == 0) r->type = leaves[rand() % 9];
+    else r->type = (enum refType)(R_CAT + rand() % 6);
+    r->c = "abc"[rand() % 3];
+    if (r->type >= R_CAT && r->type <= R_COUNT) {
+        r->a = ref_random(depth - 1);
+        if (r->type <= R_ALT) r->b = ref_random(depth - 1);
+    }
+    if (r->type == R_COUNT) {
+        r->min = rand() % 3;
+        r->max = rand() % 4 == 0 ? -1 : r->min + rand() % 3;
+    }
+    return r;
+}
+
+static void ref_free(struct ref *r) {
+    if (!r) return;
+    ref_free(r->a);
+    ref_free(r->b);
+    free(r);
+}
+
+static void ref_print(struct ref *r, char *out, int *n) {
+    switch (r->type) {
+        case R_CHAR: out[(*n)++] = r->c; break;
+        case R_DOT: out[(*n)++] = '.'; break;
+        case R_SET: *n += sprintf(out + *n, "[%c\\n]", r->c); break;
+        case R_NSET: *n += sprintf(out + *n, "[^%c]", r->c); break;
+        case R_BOL: out[(*n)++] = '^'; break;
+        case R_EOL: out[(*n)++] = '$'; break;
+        case R_EMPTY: *n += sprintf(out + *n, "()"); break;
+        case R_CAT:
+        case R_ALT:
+            out[(*n)++] = '(';
+            ref_print(r->a, out, n);
+            if (r->type == R_ALT) out[(*n)++] = '|';
+            ref_print(r->b, out, n);
+            out[(*n)++] = ')';
+            break;
+        default:
+            out[(*n)++] = '(';
+            ref_print(r->a, out, n);
+            out[(*n)++] = ')';
+            if (r->type == R_STAR) out[(*n)++] = '*';
+            else if (r->type == R_PLUS) out[(*n)++] = '+';
+            else if (r->type == R_QUEST) out[(*n)++] = '?';
+            else if (r->max < 0) *n += sprintf(out + *n, "{%d,}", r->min);
+            else *n += sprintf(out + *n, "{%d,%d}", r->min, r->max);
+            break;
+    }
+    out[*n] = '\0';
+}
+
+/* Positions a match of r can end at, from any of the positions in starts */
+static uint64_t ref_ends(struct ref *r, const char *s, int len, uint64_t starts) {
+    uint64_t out = 0, step;
+    switch (r->type) {
+        case R_CAT:
+            return ref_ends(r->b, s, len, ref_ends(r->a, s, len, starts));
+        case R_ALT:
+            return ref_ends(r->a, s, len, starts) | ref_ends(r->b, s, len, starts);
+        case R_QUEST:
+            return starts | ref_ends(r->a, s, len, starts);
+        case R_PLUS:
+            starts = ref_ends(r->a, s, len, starts);
+            /* fall through */
+        case R_STAR:
+            do {
+                out = starts;
+                starts |= ref_ends(r->a, s, len, starts);
+            } while (starts != out);
+            return starts;
+        case R_COUNT:
+            for (int i = 0; i < r->min; i++) starts = ref_ends(r->a, s, len, starts);
+            if (r->max < 0) {
+                do {
+                    out = starts;
+                    starts |= ref_ends(r->a, s, len, starts);
+                } while (starts != out);
+                return starts;
+            }
+            for (int i = r->min; i < r->max; i++) {
+                step = ref_ends(r->a, s, len, starts);
+                starts |= step;
+            }
+            return starts;
+        default:
+            break;
+    }
+    for (int p = 0; p <= len; p++) {
+        if (!(starts >> p & 1)) continue;
+        int ok;
+        switch (r->type) {
+            case R_BOL: if (p == 0 || s[p - 1] == '\n') out |= 1ULL << p; continue;
+            case R_EOL: if (p == len || s[p] == '\n') out |= 1ULL << p; continue;
+            case R_EMPTY: out |= 1ULL << p; continue;
+            case R_CHAR: ok = s[p] == r->c; break;
+            case R_DOT: ok = s[p] != '\n'; break;
+            case R_SET: ok = s[p] == r->c || s[p] == '\n'; break;
+            default: ok = s[p] != r->c; break;
+        }
+        if (p < len && ok) out |= 1ULL << (p + 1);
+    }
+    return out;
+}
+
+/* Leftmost-longest match starting in [from, to) */
+static int ref_search(struct ref *r, const char *s, int len, int from, int to, int *mlen) {
+    for (int p = from; p < to && p <= len; p++) {
+        uint64_t ends = ref_ends(r, s, len, 1ULL << p);
+        if (!ends) continue;
+        int e = 63;
+        while (!(ends >> e & 1)) e--;
+        *mlen = e - p;
+        return p;
+    }
+    return -1;
+}
+
+static void test_regex(void) {
+    char pat[4096], text[48];
+    for (int round = 0; round < 3000; round++) {
+        struct ref *r = ref_random(1 + rand() % 4);
+        int n = 0;
+        ref_print(r, pat, &n);
+        const char *error = NULL;
+        struct regex *re = regex_compile(pat, n, &error);
+        CHECK(re != NULL, "%s: %s", pat, error);
+        if (!re) {
+            ref_free(r);
+            continue;
+        }
+
+        for (int k = 0; k < 20; k++) {
+            int len = rand() % (int)sizeof(text);
+            random_text(text, len, "abc\n");
+            struct gapbuf g;
+            gap_init(&g, 8);
+            gap_insert_bytes(&g, text, len);
+            gap_move(&g, rand() % (len + 1));
+
+            int from = rand() % (len + 1), to = from + rand() % (len + 2 - from);
+            int got_len = -1, want_len = -1;
+            int got = regex_search_range(re, &g, from, to, &got_len);
+            int want = ref_search(r, text, len, from, to, &want_len);
+            CHECK(got == want && (got < 0 || got_len == want_len),
+                  "%s on \"%.*s\" in [%d, %d): got %d+%d, expected %d+%d",
+                  pat, len, text, from, to, got, got_len, want, want_len);
+            gap_free(&g);
+        }
+        regex_free(re);
+        ref_free(r);
+    }
+}
+
+/* Counters nest by sharing their atom, so a pattern can stand for far
+ * more than it emits; those have to fail fast rather than expand */
+static void test_regex_size(void) {
+    static const char *large[] = { "(){256}{256}{256}", "(){256}{256}{256}{256}",
+                                   "a{0}{256}{256}{256}", "(^|$){200}{200}" };
+    static const char *fine[] = { "a{256}", "(ab|c){100}", "a{0,100}{64}", "(){256}" };
+    for (int i = 0; i < 4; i++) {
+        const char *error = NULL;
+        struct regex *re = regex_compile(large[i], strlen(large[i]), &error);
+        CHECK(!re && error && strcmp(error, "pattern too large") == 0, "%s compiled", large[i]);
+        regex_free(re);
+        re = regex_compile(fine[i], strlen(fine[i]), &error);
+        CHECK(re != NULL, "%s: %s", fine[i], error);
+        regex_free(re);
+    }
+}
+
+int main(void) {
+    srand(1);
+    test_line_index();
+    test_pins();
+    test_regex();
+    test_regex_size();
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}